@@ -18,10 +18,20 @@
 
 #include "QUdev.h"
 #include "QUdev_private.h"
+#include "QUdevMonitorHub_private.h"
+#include "QUdevLibudevBackend_private.h"
+#include "QUdevNetlinkBackend_private.h"
 
 QUdev::QUdev(QObject *parent /*= 0*/)
  : QObject(parent),
-   d_ptr(new QUdevPrivate(this))
+   d_ptr(new QUdevPrivate(this, QString()))
+{
+
+}
+
+QUdev::QUdev(const QString &strMonitorGroup, QObject *parent /*= 0*/)
+ : QObject(parent),
+   d_ptr(new QUdevPrivate(this, strMonitorGroup))
 {
 
 }
@@ -32,20 +42,200 @@ QUdev::~QUdev()
     delete d;
 }
 
+bool QUdev::setMonitorSource(const QString &strMonitorGroup, QUdevMonitorSource eSource)
+{
+    QUdevBackend *pBackend = (eMonitorKernel == eSource) ? static_cast<QUdevBackend*>(new QUdevNetlinkBackend) : static_cast<QUdevBackend*>(new QUdevLibudevBackend);
+
+    if(QUdevMonitorHub::installBackend(strMonitorGroup, pBackend)) return true;
+
+    delete pBackend;
+    return false;
+}
+
 QUdevDeviceList QUdev::getUDevDevicesForSubsystem(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType)
 {
     Q_D(QUdev);
     return d->getUDevDevicesForSubsystem(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType);
 }
 
-bool QUdev::addNewMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType)
+QList<QUdevDeviceList> QUdev::getUDevDevicesForQueries(const QList<QUdevDeviceQuery> &lQueries)
+{
+    Q_D(QUdev);
+    return d->getUDevDevicesForQueries(lQueries);
+}
+
+QFuture<QUdevDeviceList> QUdev::getUDevDevicesForSubsystemAsync(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType)
+{
+    Q_D(QUdev);
+    return d->getUDevDevicesForSubsystemAsync(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType);
+}
+
+void QUdev::setEnumerationParallelism(int iThreads)
+{
+    Q_D(QUdev);
+    d->setEnumerationParallelism(iThreads);
+}
+
+int QUdev::visitUDevDevicesForSubsystem(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                        QUdevDeviceVisitor *pVisitor, int iChunkSize /*= 1*/)
+{
+    Q_D(QUdev);
+    return d->visitUDevDevicesForSubsystem(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType, pVisitor, iChunkSize);
+}
+
+bool QUdev::addNewMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                              const QStringList &lTags /*= QStringList()*/, const QUdevPropertyMap &mProperties /*= QUdevPropertyMap()*/)
+{
+    Q_D(QUdev);
+    return d->addNewMonitorRule(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType, lTags, mProperties);
+}
+
+bool QUdev::addNewMonitorRuleWithSnapshot(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                          QUdevDeviceList &lSnapshot, const QStringList &lTags /*= QStringList()*/, const QUdevPropertyMap &mProperties /*= QUdevPropertyMap()*/,
+                                          quint64 *piSnapshotSeqnum /*= 0*/)
+{
+    Q_D(QUdev);
+    return d->addSnapshotRule(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType, lSnapshot, lTags, mProperties, piSnapshotSeqnum);
+}
+
+QUdevSubscription QUdev::addNewMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                           QUdevSubscriber *pSubscriber, QUdevDeliveryMode eMode /*= eDeliverQueued*/, QThread *pTargetThread /*= 0*/,
+                                           const QStringList &lTags /*= QStringList()*/, const QUdevPropertyMap &mProperties /*= QUdevPropertyMap()*/)
+{
+    Q_D(QUdev);
+    return d->addSubscription(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType, pSubscriber, eMode, pTargetThread, lTags, mProperties);
+}
+
+bool QUdev::removeMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                              const QStringList &lTags /*= QStringList()*/, const QUdevPropertyMap &mProperties /*= QUdevPropertyMap()*/)
+{
+    Q_D(QUdev);
+    return d->removeMonitorRule(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType, lTags, mProperties);
+}
+
+void QUdev::setBatchDelivery(bool bEnabled)
+{
+    Q_D(QUdev);
+    d->setBatchDelivery(bEnabled);
+}
+
+void QUdev::setEventQueue(int iCapacity, QUdevOverflowPolicy ePolicy /*= eOverflowDropOldest*/)
+{
+    Q_D(QUdev);
+    d->setEventQueue(iCapacity, ePolicy);
+}
+
+void QUdev::setMergedDelivery(bool bEnabled)
+{
+    Q_D(QUdev);
+    d->setMergedDelivery(bEnabled);
+}
+
+int QUdev::getMonitorRuleId(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                            const QStringList &lTags /*= QStringList()*/, const QUdevPropertyMap &mProperties /*= QUdevPropertyMap()*/)
+{
+    Q_D(QUdev);
+    return d->getMonitorRuleId(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType, lTags, mProperties);
+}
+
+void QUdev::setBatchMaxSize(int iMaxEvents)
+{
+    Q_D(QUdev);
+    d->setBatchMaxSize(iMaxEvents);
+}
+
+void QUdev::setBatchMaxLatency(int iMaxLatencyMs)
+{
+    Q_D(QUdev);
+    d->setBatchMaxLatency(iMaxLatencyMs);
+}
+
+void QUdev::setEventCoalescing(bool bEnabled)
+{
+    Q_D(QUdev);
+    d->setEventCoalescing(bEnabled);
+}
+
+void QUdev::setCoalescingWindow(int iWindowMs)
+{
+    Q_D(QUdev);
+    d->setCoalescingWindow(iWindowMs);
+}
+
+QVariantMap QUdev::getStatistics()
+{
+    Q_D(QUdev);
+    return d->getStatistics();
+}
+
+void QUdev::setStatisticsInterval(int iIntervalMs)
+{
+    Q_D(QUdev);
+    d->setStatisticsInterval(iIntervalMs);
+}
+
+bool QUdev::startRecording(const QString &strTraceFile)
+{
+    Q_D(QUdev);
+    return d->startRecording(strTraceFile);
+}
+
+void QUdev::stopRecording()
+{
+    Q_D(QUdev);
+    d->stopRecording();
+}
+
+bool QUdev::setReceiveBufferSize(int iBytes)
+{
+    Q_D(QUdev);
+    return d->setReceiveBufferSize(iBytes);
+}
+
+void QUdev::setAutoResync(bool bEnabled)
+{
+    Q_D(QUdev);
+    d->setAutoResync(bEnabled);
+}
+
+int QUdev::getOverflowCount()
+{
+    Q_D(QUdev);
+    return d->getOverflowCount();
+}
+
+void QUdev::setParentCacheSize(int iEntries)
+{
+    Q_D(QUdev);
+    d->setParentCacheSize(iEntries);
+}
+
+void QUdev::setDeviceRegistryEnabled(bool bEnabled)
+{
+    Q_D(QUdev);
+    d->setDeviceRegistryEnabled(bEnabled);
+}
+
+bool QUdev::addDeviceRegistrySubsystem(const QString &strSubSystem)
+{
+    Q_D(QUdev);
+    return d->addDeviceRegistrySubsystem(strSubSystem);
+}
+
+QUdevDevice QUdev::getDeviceBySysfsPath(const QString &strSysfsPath)
+{
+    Q_D(QUdev);
+    return d->getDeviceBySysfsPath(strSysfsPath);
+}
+
+QUdevDevice QUdev::getDeviceByDevPath(const QString &strDevPath)
 {
     Q_D(QUdev);
-    return d->addNewMonitorRule(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType);
+    return d->getDeviceByDevPath(strDevPath);
 }
 
-bool QUdev::removeMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType)
+QUdevDeviceList QUdev::getDevicesBySerial(const QString &strSerial)
 {
     Q_D(QUdev);
-    return d->removeMonitorRule(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType);
+    return d->getDevicesBySerial(strSerial);
 }
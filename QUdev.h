@@ -21,11 +21,14 @@
 
 #include <QObject>
 #include <QMetaType>
+#include <QFuture>
+#include <QVariantMap>
 
 #include "QUdev_global.h"
 #include "QUdevDeclarations.h"
 
 class QUdevPrivate;
+class QThread;
 
 /**
  * Public class used for retrieving udev events with qt signals
@@ -44,11 +47,42 @@ public:
      */
     explicit QUdev(QObject *parent = 0);
 
+    /**
+     * Constructor for a QUdev using the monitor of the given group
+     *
+     * All QUdev instances of a process with the same monitor group share one udev monitor socket and monitoring
+     * thread. The socket filter holds the rules of all of them and each event is only emitted by the instances
+     * with a matching rule. Instances created with the default constructor use the group with the empty name.
+     *
+     * @param strMonitorGroup The name of the monitor group
+     */
+    explicit QUdev(const QString &strMonitorGroup, QObject *parent = 0);
+
     /**
      * Default destructor
+     *
+     * Slots connected directly to the signals run on the monitoring thread, which still uses the instance after they
+     * returned. They must not delete any QUdev instance, use deleteLater() instead.
      */
     ~QUdev();
 
+    /**
+     * Select where the monitor group receives its events from
+     *
+     * With eMonitorKernel the group listens to the uevents of the kernel directly instead of the ones processed
+     * by udevd, which makes monitoring work in containers without udevd. Kernel events carry no udev properties
+     * (ID_SERIAL, ...) and no tags, so rules requiring tags never match, and the device node may not exist yet
+     * when the event is emitted. Enumerations are not affected. Besides a full receive buffer, a gap in the uevent
+     * sequence numbers is reported as overflow once the group received a uevent proving it sees all of them (inside
+     * another network namespace than the initial one the kernel only sends the uevents of its network devices).
+     *
+     * @param strMonitorGroup The monitor group
+     * @param eSource The source of the events
+     *
+     * @return False if the group is already used by an instance or a source was already selected for it
+     */
+    static bool setMonitorSource(const QString &strMonitorGroup, QUdevMonitorSource eSource);
+
     /**
      * Get all devices currently present in the system for the given parameters
      *
@@ -70,6 +104,62 @@ public:
      */
     QUdevDeviceList getUDevDevicesForSubsystem(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType);
 
+    /**
+     * Run several queries with one single sysfs scan
+     *
+     * Every device of the union of all subsystems is read once and checked against all queries, devices matching
+     * several queries are shared. The device registry is not used, sysfs is always scanned. If all queries require the
+     * same sysfs attributes (QUdevDeviceQuery::m_mSysAttrs) libudev checks them during the scan, otherwise they are
+     * checked for the devices of the subsystem of a query only.
+     *
+     * Example usage:\n
+     * - getUDevDevicesForQueries(QList<QUdevDeviceQuery>() << QUdevDeviceQuery("block", "disk") << QUdevDeviceQuery("tty"))\n
+     *
+     * @param lQueries The queries, see getUDevDevicesForSubsystem() for the meaning of the parameters
+     *
+     * @return One device list per query, in the order of lQueries
+     */
+    QList<QUdevDeviceList> getUDevDevicesForQueries(const QList<QUdevDeviceQuery> &lQueries);
+
+    /**
+     * Asynchronous variant of getUDevDevicesForSubsystem()
+     *
+     * The scan runs on an internal thread pool with its own udev context. Afterwards the detail attributes
+     * (vendor, product, serial, ...) of the result are read in parallel, so accessing them does not touch sysfs anymore.
+     * Canceling the future stops the enumeration. The device registry is not used, sysfs is always scanned.
+     *
+     * @return The future receiving the list with all devices matching the given constraints
+     */
+    QFuture<QUdevDeviceList> getUDevDevicesForSubsystemAsync(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType);
+
+    /**
+     * Set the number of threads used by one asynchronous enumeration (default: QThread::idealThreadCount())
+     *
+     * Each thread reading attributes uses its own udev context.
+     *
+     * @param iThreads The number of threads, values smaller than 1 are treated as 1
+     */
+    void setEnumerationParallelism(int iThreads);
+
+    /**
+     * Streaming variant of getUDevDevicesForSubsystem()
+     *
+     * The devices are handed to the visitor while the enumeration walks sysfs, so the first devices are available
+     * right away and no complete list is built. The visitor is called on the calling thread before this method returns.
+     * The device registry is not used, sysfs is always scanned.
+     *
+     * @param strSubSystem The desired subsystem, see getUDevDevicesForSubsystem()
+     * @param strDeviceType The desired devicetype, see getUDevDevicesForSubsystem()
+     * @param strParentSubSystem The parent subsystem, see getUDevDevicesForSubsystem()
+     * @param strParentDeviceType The device type for the parent, see getUDevDevicesForSubsystem()
+     * @param pVisitor Receives the devices, the enumeration stops as soon as it returns false
+     * @param iChunkSize The number of devices handed to the visitor at once (the last chunk may be smaller)
+     *
+     * @return The number of devices handed to the visitor
+     */
+    int visitUDevDevicesForSubsystem(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                     QUdevDeviceVisitor *pVisitor, int iChunkSize = 1);
+
     /**
      * Add a new monitor rule to the list of monitored udev devices.
      *
@@ -82,10 +172,77 @@ public:
      *        With an empty string this parameter is ignored
      * @param strParentDeviceType The device type for the parent
      *        With an empty string this parameter is ignored
+     * @param lTags The device must carry all of these udev tags (for example: systemd, uaccess, ...)
+     *        With an empty list this parameter is ignored
+     * @param mProperties The device must have all of these udev properties with exactly these values (for example: ID_BUS=usb)
+     *        With an empty map this parameter is ignored
+     *
+     * Subsystem, devicetype and tags are installed as socket filter, so events not matching any rule
+     * never wake up the monitoring thread. Tags are only used for the socket filter if every rule has one.
      *
      * @return True if the rule could be added to the monitoring framework. False if the parameters are invalid or such a rule is already present
      */
-    bool addNewMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType);
+    bool addNewMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                           const QStringList &lTags = QStringList(), const QUdevPropertyMap &mProperties = QUdevPropertyMap());
+
+    /**
+     * Add a new monitor rule and get the devices currently matching it, without losing the events in between
+     *
+     * Calling getUDevDevicesForSubsystem() and then addNewMonitorRule() loses the changes happening between both calls.
+     * Here the rule is active before the single enumeration starts and its events are held back. The kernel uevent
+     * sequence number is read right before the enumeration: held events with a SEQNUM up to it are already reflected by
+     * the snapshot and dropped, newer ones are emitted after the snapshot was taken, followed by all later events.
+     * A newer event may repeat a state the snapshot already shows (for example an add of a device the enumeration found
+     * already), but no change is lost. Events without SEQNUM are emitted if they were received after the enumeration started.
+     *
+     * The held events are emitted by the monitoring thread after this call returned the snapshot, so slots connected
+     * with a queued connection see the snapshot first.
+     *
+     * @param strSubSystem The desired subsystem, see addNewMonitorRule()
+     * @param strDeviceType The desired devicetype, see addNewMonitorRule()
+     * @param strParentSubSystem The parent subsystem, see addNewMonitorRule()
+     * @param strParentDeviceType The device type for the parent, see addNewMonitorRule()
+     * @param lSnapshot Receives the devices matching the rule when it was added
+     * @param lTags The device must carry all of these udev tags
+     * @param mProperties The device must have all of these udev properties with exactly these values
+     * @param piSnapshotSeqnum Receives the kernel uevent sequence number when the enumeration started (0 if unknown), may be 0
+     *
+     * This call waits until the monitor filters for the new rule. Called from a slot running on the monitoring thread
+     * (a direct connection) that is not possible, nothing is added, a warning is logged and false is returned. The same
+     * happens if the monitoring thread does not apply the filter within a few seconds, see setEventQueue().
+     *
+     * @return True if the rule was added, false if the parameters are invalid, such a rule is already present or the filter could not be applied (lSnapshot is empty then)
+     */
+    bool addNewMonitorRuleWithSnapshot(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                       QUdevDeviceList &lSnapshot, const QStringList &lTags = QStringList(), const QUdevPropertyMap &mProperties = QUdevPropertyMap(),
+                                       quint64 *piSnapshotSeqnum = 0);
+
+    /**
+     * Add a new monitor rule whose events are only handed to the given subscriber
+     *
+     * The events of the rule are not emitted with newUDevEvent()/newUDevEvents(), only the subscriber of the
+     * matching rule receives them. Several subscriptions may use the same rule parameters. Coalescing applies
+     * to subscriptions as well, batching does not. The rule stays until QUdevSubscription::cancel() is called
+     * (removeMonitorRule() does not remove it) and the subscriber must stay alive until then.
+     *
+     * Example usage:\n
+     * - addNewMonitorRule(QString("block"), QString("disk"), QString(), QString(), &subscriber, eDeliverDirect)\n
+     *
+     * @param strSubSystem The desired subsystem, see the other addNewMonitorRule()
+     * @param strDeviceType The desired devicetype, see the other addNewMonitorRule()
+     * @param strParentSubSystem The parent subsystem, see the other addNewMonitorRule()
+     * @param strParentDeviceType The device type for the parent, see the other addNewMonitorRule()
+     * @param pSubscriber Receives the matching events
+     * @param eMode eDeliverDirect to call the subscriber on the monitoring thread, eDeliverQueued to call it from the event loop of pTargetThread
+     * @param pTargetThread The thread receiving queued events, 0 for the calling thread
+     * @param lTags The device must carry all of these udev tags
+     * @param mProperties The device must have all of these udev properties with exactly these values
+     *
+     * @return The handle of the subscription, invalid if pSubscriber is 0
+     */
+    QUdevSubscription addNewMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                        QUdevSubscriber *pSubscriber, QUdevDeliveryMode eMode = eDeliverQueued, QThread *pTargetThread = 0,
+                                        const QStringList &lTags = QStringList(), const QUdevPropertyMap &mProperties = QUdevPropertyMap());
 
     /**
      * Remove an existing monitor rule from the list of monitored udev devices.
@@ -94,10 +251,222 @@ public:
      * @param strDeviceType The desired devicetype
      * @param strParentSubSystem The parent subsystem
      * @param strParentDeviceType The device type for the parent
+     * @param lTags The required tags of the rule
+     * @param mProperties The required properties of the rule
      *
      * @return True if the rule could be removed from the monitoring framework. False if such a rule could not be found in the current monitor list
      */
-    bool removeMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType);
+    bool removeMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                           const QStringList &lTags = QStringList(), const QUdevPropertyMap &mProperties = QUdevPropertyMap());
+
+    /**
+     * Enable or disable batched event delivery.
+     *
+     * With batched delivery enabled matching events are collected and emitted with newUDevEvents()
+     * instead of newUDevEvent(). A batch is emitted as soon as it holds setBatchMaxSize() events or
+     * its first event is older than setBatchMaxLatency() milliseconds. Disabled by default.
+     *
+     * @param bEnabled True to emit newUDevEvents(), false to emit newUDevEvent()
+     */
+    void setBatchDelivery(bool bEnabled);
+
+    /**
+     * Enable or disable merged delivery (default: disabled).
+     *
+     * Without merged delivery a udev event matching several rules is emitted once per rule. With merged delivery
+     * it is emitted once and QUdevEvent::m_vMatchedRules holds the ids of all matching rules. The device data
+     * (and so the source of the detail attributes) is the one of the first matching rule in the order the rules
+     * were added. Resync events after an overflow are still emitted per rule. Subscriptions are not affected.
+     *
+     * @param bEnabled True to emit every udev event only once
+     */
+    void setMergedDelivery(bool bEnabled);
+
+    /**
+     * Get the id of a rule added with addNewMonitorRule(), see QUdevEvent::m_vMatchedRules
+     *
+     * @return The id of the rule, -1 if there is no such rule
+     */
+    int getMonitorRuleId(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                         const QStringList &lTags = QStringList(), const QUdevPropertyMap &mProperties = QUdevPropertyMap());
+
+    /**
+     * Set the maximum number of events in one batch (default: 64)
+     *
+     * @param iMaxEvents The batch size, values smaller than 1 are treated as 1
+     */
+    void setBatchMaxSize(int iMaxEvents);
+
+    /**
+     * Set the maximum time an event may wait for its batch to be delivered (default: 10ms)
+     *
+     * @param iMaxLatencyMs The latency window in milliseconds
+     */
+    void setBatchMaxLatency(int iMaxLatencyMs);
+
+    /**
+     * Enable or disable the coalescing of events per device (default: disabled).
+     *
+     * With coalescing enabled the events of a device (per monitor rule) are held back for setCoalescingWindow()
+     * milliseconds after its first event. Within the window changes following an add or change fold into it,
+     * a remove following changes replaces them and an add followed by a remove is not reported at all.
+     * The emitted event carries the latest device data. QUdevEvent::m_iRawEvents tells how many udev events an emitted event represents.
+     *
+     * @param bEnabled True to coalesce the events
+     */
+    void setEventCoalescing(bool bEnabled);
+
+    /**
+     * Set the coalescing window (default: 50ms)
+     *
+     * @param iWindowMs The window in milliseconds, starting with the first event of a device
+     */
+    void setCoalescingWindow(int iWindowMs);
+
+    /**
+     * Hand the events to their consumers through bounded queues (default: 0, disabled).
+     *
+     * Without queue the signals are emitted by the monitoring thread and every event of a queued subscription is posted
+     * on its own, so a slow consumer lets the posted events pile up without limit. With a queue the monitoring thread
+     * only fills a lock-free ring and the thread of this object (respectively the target thread of a queued subscription)
+     * takes the events out and delivers them, batched delivery collects its batches there. A full queue applies the policy:
+     * eOverflowDropOldest and eOverflowDropNewest drop an event, eOverflowCoalesce holds the events back (the latest
+     * event per device, see QUdevEvent::m_iRawEvents, for up to iCapacity devices, further devices are dropped) until
+     * there is room again and eOverflowBlock makes the monitoring thread wait for the consumer. eventQueueOverflow()
+     * reports the dropped and coalesced events.
+     *
+     * With eOverflowBlock the monitoring thread is shared by all instances of the monitor group, so a stalled consumer
+     * stalls all of them. While it waits it does not apply new rules: addNewMonitorRuleWithSnapshot() and the registry
+     * seeding of addDeviceRegistrySubsystem() and getUDevDevicesForSubsystem() fail after a few seconds when they are
+     * called by the consumer thread it waits for.
+     * Queued subscriptions get their queue when they are added, later calls do not change it.
+     *
+     * @param iCapacity The number of events per queue (rounded up to a power of two), 0 to disable the queues
+     * @param ePolicy What happens to the events of a full queue
+     */
+    void setEventQueue(int iCapacity, QUdevOverflowPolicy ePolicy = eOverflowDropOldest);
+
+    /**
+     * Get the runtime statistics of this instance
+     *
+     * The map holds the counters "received", "matched", "dropped" (received but matching no rule), "emitted",
+     * "coalesced" (udev events folded or canceled by the coalescing), "ruleEvaluations", "parentWalks",
+     * "parentCacheHits", "overflows", "queueDropped", "queueCoalesced" and "queueBlocked" (see setEventQueue()),
+     * the current "queueDepth" (events held for coalescing or batching)
+     * and the histograms "latencyUs" (receive to emit) and "processingUs" (matching one received device including
+     * its sysfs and udev database reads). A histogram is a map with the upper bucket bounds "boundsUs" (powers of two,
+     * the last one is -1 for all larger values) and the number of values per bucket "counts".
+     */
+    QVariantMap getStatistics();
+
+    /**
+     * Emit statisticsUpdated() periodically while the monitor is running (default: 0, disabled)
+     *
+     * @param iIntervalMs The interval in milliseconds, 0 to disable
+     */
+    void setStatisticsInterval(int iIntervalMs);
+
+    /**
+     * Record every udev event received by this instance into a trace file
+     *
+     * The trace holds action, sequence number, timestamp, properties, tags and ancestors of every event passing
+     * the socket filter of the monitor group (and markers for lost events), so it can be replayed later through
+     * the complete matching and dispatch path. Attribute values are not recorded. Events are only received while
+     * at least one monitor rule is present. An active recording is replaced.
+     *
+     * @param strTraceFile The trace file, an existing file is overwritten
+     *
+     * @return False if the file could not be created
+     */
+    bool startRecording(const QString &strTraceFile);
+
+    /**
+     * Stop a recording started with startRecording() and close the trace file
+     */
+    void stopRecording();
+
+    /**
+     * Set the size of the netlink receive buffer used by the monitor.
+     *
+     * If the consumer falls behind and this buffer is exhausted the kernel drops udev events.
+     * The buffer belongs to the socket shared by all instances of the monitor group.
+     *
+     * @param iBytes The new buffer size in bytes
+     *
+     * @return True if the buffer size could be applied
+     */
+    bool setReceiveBufferSize(int iBytes);
+
+    /**
+     * Enable or disable the automatic resynchronization after a receive buffer overflow (default: disabled).
+     *
+     * When enabled every monitor rule keeps track of its present devices (seeded with one enumeration when the
+     * rule is added, so addNewMonitorRule() scans sysfs and each rule holds all its devices in memory). After an
+     * overflow all rules are enumerated again and the difference is delivered as eDeviceAdd/eDeviceRemove events,
+     * so no device gets lost silently. Without it only monitorOverflow() reports the overflow.
+     *
+     * @param bEnabled True to resynchronize after an overflow
+     */
+    void setAutoResync(bool bEnabled);
+
+    /**
+     * Get the number of receive buffer overflows detected since construction
+     */
+    int getOverflowCount();
+
+    /**
+     * Set the maximum number of entries in the parent cache (default: 512).
+     *
+     * Monitor rules with a parent constraint remember the resolved parent (and its lazily read attributes) for
+     * all devices in the same sysfs directory, so repeated events do not walk the sysfs tree again.
+     * Entries are dropped on remove events of the involved devices. A size of 0 disables the cache.
+     *
+     * @param iEntries The maximum number of cached parent lookups
+     */
+    void setParentCacheSize(int iEntries);
+
+    /**
+     * Enable or disable the device registry (default: disabled).
+     *
+     * With the registry enabled every subsystem is enumerated only once (on its first query or with
+     * addDeviceRegistrySubsystem()). Afterwards the monitor keeps the registry up to date with the add, change
+     * and remove events of these subsystems and getUDevDevicesForSubsystem() is answered from memory.
+     * Disabling the registry drops all registered devices.
+     *
+     * @param bEnabled True to answer queries from the registry
+     */
+    void setDeviceRegistryEnabled(bool bEnabled);
+
+    /**
+     * Start tracking all devices of the given subsystem in the device registry
+     *
+     * @param strSubSystem The subsystem to be tracked (for example: block, tty, ...)
+     *
+     * The subsystem is enumerated once the monitor receives its events, this call waits for that. Called from a slot
+     * running on the monitoring thread (a direct connection) the subsystem cannot be tracked and false is returned.
+     *
+     * @return True if the subsystem was enumerated, false if the registry is disabled, the subsystem is already tracked or called on the monitoring thread
+     */
+    bool addDeviceRegistrySubsystem(const QString &strSubSystem);
+
+    /**
+     * Get a device of a tracked subsystem by its path inside /sys
+     *
+     * @return The device, check QUdevDevice::isValid() to see if it was found
+     */
+    QUdevDevice getDeviceBySysfsPath(const QString &strSysfsPath);
+
+    /**
+     * Get a device of a tracked subsystem by its device node (for example: /dev/sdb)
+     *
+     * @return The device, check QUdevDevice::isValid() to see if it was found
+     */
+    QUdevDevice getDeviceByDevPath(const QString &strDevPath);
+
+    /**
+     * Get all devices of the tracked subsystems with the given serial (the ID_SERIAL_SHORT or ID_SERIAL property)
+     */
+    QUdevDeviceList getDevicesBySerial(const QString &strSerial);
 
 Q_SIGNALS:
 
@@ -106,6 +475,31 @@ Q_SIGNALS:
      */
     void newUDevEvent(QUdevEvent);
 
+    /**
+     * Emitted with all collected events if batched delivery is enabled
+     */
+    void newUDevEvents(QVector<QUdevEvent>);
+
+    /**
+     * Emitted if the kernel dropped udev events because the receive buffer was full
+     *
+     * @param iOverflowCount The number of overflows detected so far
+     */
+    void monitorOverflow(int iOverflowCount);
+
+    /**
+     * Emitted periodically with the statistics if setStatisticsInterval() was called, see getStatistics()
+     */
+    void statisticsUpdated(QVariantMap mStatistics);
+
+    /**
+     * Emitted by the monitoring thread if a full event queue dropped or coalesced events, at most every 100ms
+     *
+     * @param iDropped The number of events dropped by all queues of this instance so far
+     * @param iCoalesced The number of events coalesced by all queues of this instance so far
+     */
+    void eventQueueOverflow(int iDropped, int iCoalesced);
+
 private:
 
     /**
@@ -12,12 +12,37 @@ TEMPLATE = lib
 DEFINES += QUDEV_LIBRARY
 
 SOURCES += QUdev.cpp \
-    QUdev_private.cpp
+    QUdev_private.cpp \
+    QUdevDevice.cpp \
+    QUdevDeviceRegistry.cpp \
+    QUdevMonitorHub.cpp \
+    QUdevStatistics.cpp \
+    QUdevLibudevBackend.cpp \
+    QUdevSyntheticBackend.cpp \
+    QUdevTrace.cpp \
+    QUdevReplayBackend.cpp \
+    QUdevNetlinkBackend.cpp \
+    QUdevSubscription.cpp \
+    QUdevEventQueue.cpp \
+    QUdevSnapshotGate.cpp
 
 HEADERS += QUdev.h\
         QUdev_global.h \
     QUdevDeclarations.h \
-    QUdev_private.h
+    QUdev_private.h \
+    QUdevDevice_private.h \
+    QUdevDeviceRegistry_private.h \
+    QUdevMonitorHub_private.h \
+    QUdevStatistics_private.h \
+    QUdevBackend_private.h \
+    QUdevLibudevBackend_private.h \
+    QUdevSyntheticBackend_private.h \
+    QUdevTrace_private.h \
+    QUdevReplayBackend_private.h \
+    QUdevNetlinkBackend_private.h \
+    QUdevSubscription_private.h \
+    QUdevEventQueue_private.h \
+    QUdevSnapshotGate_private.h
 
 symbian {
     #Symbian specific definitions
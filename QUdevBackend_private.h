@@ -0,0 +1,187 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVBACKEND_PRIVATE_H
+#define QUDEVBACKEND_PRIVATE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+
+/**
+ * An ancestor of a device, see QUdevBackendEvent::getAncestors()
+ */
+struct QUdevBackendAncestor
+{
+    QByteArray m_baSysPath;
+    QByteArray m_baSubsystem;
+    QByteArray m_baDevType;
+};
+
+/**
+ * Receives the properties of an event, see QUdevBackendEvent::visitProperties()
+ */
+class QUdevBackendPropertyVisitor
+{
+    public:
+
+        virtual ~QUdevBackendPropertyVisitor() {}
+
+        /**
+         * Called for every property
+         *
+         * @param iKeyLength Length of the key, the key is not necessarily NUL terminated
+         */
+        virtual void visitProperty(const char *pcKey, int iKeyLength, const char *pcValue) = 0;
+};
+
+/**
+ * Read-only view on one received uevent, only valid during QUdevBackendReceiver::processEvent()
+ *
+ * All strings are owned by the backend, 0 is returned for missing values.
+ */
+class QUdevBackendEvent
+{
+    public:
+
+        virtual ~QUdevBackendEvent() {}
+
+        virtual const char *getAction() const = 0;
+
+        /**
+         * The sysfs path including the sysfs mount point
+         */
+        virtual const char *getSysPath() const = 0;
+
+        /**
+         * The kernel devpath (the sysfs path without the sysfs mount point)
+         */
+        virtual const char *getDevPath() const = 0;
+
+        virtual const char *getSubsystem() const = 0;
+
+        virtual const char *getDevType() const = 0;
+
+        /**
+         * The device node inside /dev
+         */
+        virtual const char *getDevNode() const = 0;
+
+        virtual bool hasTag(const char *pcTag) const = 0;
+
+        virtual const char *getPropertyValue(const char *pcKey) const = 0;
+
+        /**
+         * Get the sysfs path of the closest ancestor with the given subsystem and devicetype
+         *
+         * @param pcDevType The devicetype of the ancestor, 0 to ignore it
+         */
+        virtual const char *getParentSysPath(const char *pcSubsystem, const char *pcDevType) const = 0;
+
+        /**
+         * Pass all properties to the visitor without copying them (used on the dispatch path)
+         */
+        virtual void visitProperties(QUdevBackendPropertyVisitor &visitor) const = 0;
+
+        /**
+         * Get all properties as key/value pairs (used for recording, not on the dispatch path)
+         */
+        virtual QList<QPair<QByteArray, QByteArray> > getProperties() const = 0;
+
+        /**
+         * Get all udev tags (used for recording, not on the dispatch path)
+         */
+        virtual QList<QByteArray> getTags() const = 0;
+
+        /**
+         * Get all ancestors from the direct parent up to the root (used for recording, not on the dispatch path)
+         */
+        virtual QList<QUdevBackendAncestor> getAncestors() const = 0;
+};
+
+/**
+ * Receives the events of a backend on the monitoring thread
+ */
+class QUdevBackendReceiver
+{
+    public:
+
+        virtual ~QUdevBackendReceiver() {}
+
+        virtual void processEvent(const QUdevBackendEvent &ev) = 0;
+};
+
+/**
+ * Union of the monitor rules of all QUdev instances sharing a backend
+ */
+struct QUdevBackendFilter
+{
+    /**
+     * Subsystem/devicetype pairs, one of them has to match (an empty devicetype matches any devicetype)
+     */
+    QList<QPair<QByteArray, QByteArray> > m_lMatches;
+
+    /**
+     * The event has to carry one of these tags, ignored if empty
+     */
+    QList<QByteArray> m_lbaTags;
+};
+
+/**
+ * Source of the uevents of a monitor group
+ *
+ * The default backend reads the udev netlink socket through libudev, other backends may generate or replay events.
+ * A backend is owned by its QUdevMonitorHub and, apart from the constructor and setReceiveBufferSize(), only used
+ * by the monitoring thread.
+ */
+class QUdevBackend
+{
+    public:
+
+        virtual ~QUdevBackend() {}
+
+        /**
+         * Start delivering events, called once when the monitoring thread starts
+         *
+         * @return A descriptor usable with poll(), readable while events are pending
+         */
+        virtual int start() = 0;
+
+        /**
+         * Hand all pending events to the receiver
+         *
+         * @return True if events were lost since the last call (e.g. the receive buffer overflowed)
+         */
+        virtual bool receiveEvents(QUdevBackendReceiver *pReceiver) = 0;
+
+        /**
+         * Only deliver events matching the filter, an empty filter delivers all events
+         */
+        virtual void applyFilter(const QUdevBackendFilter &filter) = 0;
+
+        /**
+         * Set the size of the kernel receive buffer, if the backend has one
+         */
+        virtual bool setReceiveBufferSize(int iBytes)
+        {
+            Q_UNUSED(iBytes);
+            return false;
+        }
+};
+
+#endif // QUDEVBACKEND_PRIVATE_H
@@ -22,6 +22,8 @@
 #include <QtCore>
 #include <QMetaType>
 
+#include "QUdev_global.h"
+
 /**
  * All current supported udev event actions
  */
@@ -37,9 +39,69 @@ enum QUdevEventAction
 };
 
 /**
- * This class represents one single udev event
+ * Where the events of a monitor group come from, see QUdev::setMonitorSource()
+ */
+enum QUdevMonitorSource
+{
+    /**
+     * The events processed by udevd (default)
+     */
+    eMonitorUdev,
+    /**
+     * The raw events of the kernel, for systems without udevd
+     */
+    eMonitorKernel
+};
+
+/**
+ * How the events of a subscription reach its subscriber, see QUdev::addNewMonitorRule()
+ */
+enum QUdevDeliveryMode
+{
+    /**
+     * The subscriber is called on the monitoring thread right after matching, without any marshalling
+     */
+    eDeliverDirect,
+    /**
+     * The events are posted to the target thread and the subscriber is called by its event loop
+     */
+    eDeliverQueued
+};
+
+/**
+ * What happens to an event not fitting into a full event queue, see QUdev::setEventQueue()
+ */
+enum QUdevOverflowPolicy
+{
+    /**
+     * The oldest queued event is dropped to make room
+     */
+    eOverflowDropOldest,
+    /**
+     * The new event is dropped
+     */
+    eOverflowDropNewest,
+    /**
+     * The event is held back until there is room, later events of the same device replace it
+     *
+     * At most the capacity of the queue is held back, events of further devices are dropped.
+     */
+    eOverflowCoalesce,
+    /**
+     * The monitoring thread waits until the consumer made room
+     */
+    eOverflowBlock
+};
+
+class QUdevDeviceData;
+
+/**
+ * The public fields QUdevDevice had before it became a handle
+ *
+ * Code written against the fields can keep them: QUdevDevice::getFields() fills them and QUdevDevice(const QUdevDeviceFields&)
+ * creates a device from them. Prefer the getters of QUdevDevice, they only read the attributes actually used.
  */
-struct QUdevDevice
+struct QUdevDeviceFields
 {
     QString m_strSysfsPath;
     QString m_strDevPath;
@@ -52,6 +114,139 @@ struct QUdevDevice
     QString m_strManufacturer;
     QString m_strProduct;
     QString m_strSerial;
+};
+
+/**
+ * This class represents one single udev device
+ *
+ * QUdevDevice is an implicitly shared read-only handle, copying it only increases a reference count.
+ * The detail attributes (vendor, product, serial, ...) are read from sysfs on first access
+ * and cached afterwards, attributes never asked for do not cause any sysfs access. The attributes of remove
+ * events are read when the event is received, the device is gone by the time a consumer asks.
+ *
+ * The former public fields are replaced by the getters, see QUdevDeviceFields for code still using them.
+ */
+class QUDEVSHARED_EXPORT QUdevDevice
+{
+public:
+
+    /**
+     * Default constructor, creates an empty device
+     */
+    QUdevDevice();
+
+    /**
+     * Internal constructor used by the QUdev implementation, takes a reference to the data
+     */
+    explicit QUdevDevice(QUdevDeviceData *pData);
+
+    /**
+     * Create a device from the former public fields, the attributes are taken as given instead of reading sysfs
+     */
+    explicit QUdevDevice(const QUdevDeviceFields &Fields);
+
+    /**
+     * Copy constructor
+     */
+    QUdevDevice(const QUdevDevice &Other);
+
+    /**
+     * Default destructor
+     */
+    ~QUdevDevice();
+
+    /**
+     * Assignment operator
+     */
+    QUdevDevice &operator=(const QUdevDevice &Other);
+
+    /**
+     * Check if this is an actual device (false for a default constructed device or a failed lookup)
+     */
+    bool isValid() const;
+
+    /**
+     * Get the path of the device inside /sys
+     */
+    QString getSysfsPath() const;
+
+    /**
+     * Get the path of the device node inside /dev (empty if the device has no node)
+     */
+    QString getDevPath() const;
+
+    /**
+     * Get the subsystem of the device
+     */
+    QString getSubsystem() const;
+
+    /**
+     * Get the devicetype of the device
+     */
+    QString getDeviceType() const;
+
+    /**
+     * Get the idVendor attribute (read from the requested parent if a parent constraint was given)
+     */
+    QString getVendorID() const;
+
+    /**
+     * Get the idProduct attribute (read from the requested parent if a parent constraint was given)
+     */
+    QString getProductID() const;
+
+    /**
+     * Get the manufacturer attribute (read from the requested parent if a parent constraint was given)
+     */
+    QString getManufacturer() const;
+
+    /**
+     * Get the product attribute (read from the requested parent if a parent constraint was given)
+     */
+    QString getProduct() const;
+
+    /**
+     * Get the serial attribute (read from the requested parent if a parent constraint was given)
+     */
+    QString getSerial() const;
+
+    /**
+     * Get a udev property of the device itself (ID_SERIAL, ID_FS_UUID, ID_PATH, MAJOR, ...), empty if not set
+     *
+     * The properties are taken from the udev database when the device is enumerated or monitored,
+     * asking for them does not cause any further access.
+     */
+    QString getProperty(const QString &strKey) const;
+
+    /**
+     * Check if the device has a udev property
+     */
+    bool hasProperty(const QString &strKey) const;
+
+    /**
+     * Get the names of all udev properties of the device
+     */
+    QStringList getPropertyNames() const;
+
+    /**
+     * Get all former public fields at once, this reads all detail attributes
+     */
+    QUdevDeviceFields getFields() const;
+
+private:
+
+    friend class QUdevPrivate;
+    friend class QUdevDeviceRegistry;
+
+    /**
+     * Shared read-only device data, returned to its pool (if any) when the last handle is gone
+     *
+     * Not a QExplicitlySharedDataPointer as that would delete the data instead of recycling it. Every handle owns one
+     * reference, taken with the ordered QAtomicInt::ref() before the pointer is stored and dropped with the ordered deref(),
+     * the handle dropping the last one passes the data to QUdevDeviceData::release(). The data is not modified while
+     * handles exist.
+     */
+    QUdevDeviceData *d;
 
 };
 
@@ -60,6 +255,13 @@ struct QUdevDevice
  */
 struct QUdevEvent
 {
+    QUdevEvent()
+      : m_ueAction(eDeviceUnknownAction),
+        m_iRawEvents(1)
+    {
+
+    }
+
     /**
      * This is the udev action causing this event (add/remove/...)
      */
@@ -70,10 +272,164 @@ struct QUdevEvent
      */
     QUdevDevice m_udDev;
 
+    /**
+     * Number of udev events represented by this event (more than 1 if events were coalesced)
+     */
+    int m_iRawEvents;
+
+    /**
+     * Ids of all rules matching the device, see QUdev::getMonitorRuleId() (only filled with QUdev::setMergedDelivery())
+     */
+    QVector<int> m_vMatchedRules;
+
 };
 Q_DECLARE_METATYPE(QUdevEvent);
+Q_DECLARE_METATYPE(QVector<QUdevEvent>);
 
 typedef QList<QUdevDevice> QUdevDeviceList;
 typedef QSharedPointer<QList<QUdevDevice> > QUdevDeviceListPtr;
 
+/**
+ * Name to value pairs a device must match, for example the udev properties of a rule
+ */
+typedef QMap<QString, QString> QUdevPropertyMap;
+
+/**
+ * The parameters of one device query, see QUdev::getUDevDevicesForQueries()
+ */
+struct QUdevDeviceQuery
+{
+    QUdevDeviceQuery(const QString &strSubSystem = QString(), const QString &strDeviceType = QString(),
+                     const QString &strParentSubSystem = QString(), const QString &strParentDeviceType = QString())
+      : m_strSubsystem(strSubSystem),
+        m_strDeviceType(strDeviceType),
+        m_strParentSubSystem(strParentSubSystem),
+        m_strParentDeviceType(strParentDeviceType)
+    {
+
+    }
+
+    /**
+     * The desired subsystem
+     */
+    QString m_strSubsystem;
+
+    /**
+     * The desired devicetype (ignored if empty)
+     */
+    QString m_strDeviceType;
+
+    /**
+     * The parent subsystem (ignored if empty)
+     */
+    QString m_strParentSubSystem;
+
+    /**
+     * The device type for the parent (ignored if empty)
+     */
+    QString m_strParentDeviceType;
+
+    /**
+     * The sysfs attributes the device must have, the values are shell glob patterns like in udev rules (ignored if empty)
+     */
+    QUdevPropertyMap m_mSysAttrs;
+};
+
+/**
+ * Receives the devices of a streaming enumeration, see QUdev::visitUDevDevicesForSubsystem()
+ */
+class QUDEVSHARED_EXPORT QUdevDeviceVisitor
+{
+public:
+
+    virtual ~QUdevDeviceVisitor() {}
+
+    /**
+     * Called with the next chunk of devices as soon as the enumeration found them
+     *
+     * @param lDevices The devices of this chunk (at most the requested chunk size)
+     *
+     * @return True to continue the enumeration, false to stop it
+     */
+    virtual bool visitDevices(const QUdevDeviceList &lDevices) = 0;
+};
+
+/**
+ * Receives the events of a subscription, see QUdev::addNewMonitorRule()
+ */
+class QUDEVSHARED_EXPORT QUdevSubscriber
+{
+public:
+
+    virtual ~QUdevSubscriber() {}
+
+    /**
+     * Called for every event matching the rule of the subscription
+     *
+     * With eDeliverDirect this runs on the monitoring thread and delays all further events of the monitor
+     * group, so it must not block.
+     */
+    virtual void onUdevEvent(const QUdevEvent &e) = 0;
+};
+
+class QUdevSubscriptionData;
+
+/**
+ * Handle of a subscription, see QUdev::addNewMonitorRule()
+ *
+ * Copies refer to the same subscription. Dropping the handle does not end the subscription,
+ * it stays active until cancel() is called or the QUdev is destroyed.
+ */
+class QUDEVSHARED_EXPORT QUdevSubscription
+{
+public:
+
+    /**
+     * Default constructor, creates an invalid handle
+     */
+    QUdevSubscription();
+
+    /**
+     * Internal constructor used by the QUdev implementation
+     */
+    explicit QUdevSubscription(QUdevSubscriptionData *pData);
+
+    /**
+     * Copy constructor
+     */
+    QUdevSubscription(const QUdevSubscription &Other);
+
+    /**
+     * Default destructor
+     */
+    ~QUdevSubscription();
+
+    /**
+     * Assignment operator
+     */
+    QUdevSubscription &operator=(const QUdevSubscription &Other);
+
+    /**
+     * Check if the handle refers to a subscription (false if the rule could not be added)
+     */
+    bool isValid() const;
+
+    /**
+     * Check if the subscriber still receives events
+     */
+    bool isActive() const;
+
+    /**
+     * End the subscription and remove its rule
+     *
+     * A delivery running on another thread is waited for, afterwards the subscriber is never called again
+     * and may be deleted. Calling it from within the subscriber is allowed.
+     */
+    void cancel();
+
+private:
+
+    QExplicitlySharedDataPointer<QUdevSubscriptionData> d;
+};
+
 #endif // QUDEVDECLARATIONS_H
@@ -0,0 +1,530 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QUdevDevice_private.h"
+#include "QUdevBackend_private.h"
+
+#include <QReadWriteLock>
+#include <QThreadStorage>
+
+#include <string.h>
+#include <algorithm>
+
+/**
+ * sysfs attribute names, indexed by QUdevDeviceAttribute
+ */
+static const char * const s_apcAttributeNames[eAttrCount] =
+{
+    "idVendor",
+    "idProduct",
+    "manufacturer",
+    "product",
+    "serial"
+};
+
+/**
+ * The udev contexts of the threads, deleted by Qt when a thread ends
+ */
+static QThreadStorage<QUdevThreadContext*> s_ThreadContexts;
+
+QUdevThreadContext::QUdevThreadContext()
+  : m_pUdev(udev_new())
+{
+
+}
+
+QUdevThreadContext::~QUdevThreadContext()
+{
+    if(m_pUdev) udev_unref(m_pUdev);
+}
+
+struct udev *QUdevThreadContext::get()
+{
+    if(false == s_ThreadContexts.hasLocalData()) s_ThreadContexts.setLocalData(new QUdevThreadContext);
+    return s_ThreadContexts.localData()->m_pUdev;
+}
+
+QUdevDeviceAttributes::QUdevDeviceAttributes(const QString &strSysfsPath)
+  : m_strSysfsPath(strSysfsPath),
+    m_iLoaded(0)
+{
+
+}
+
+QString QUdevDeviceAttributes::getSysfsPath() const
+{
+    return m_strSysfsPath;
+}
+
+QString QUdevDeviceAttributes::getAttribute(QUdevDeviceAttribute eAttr) const
+{
+    Q_ASSERT(eAttr >= 0 && eAttr < eAttrCount);
+
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    //the context is the one of the reading thread, never the one of the QUdev instance
+    if(0 == (m_iLoaded & (1 << eAttr))) load(QUdevThreadContext::get());
+    return m_astrValues[eAttr];
+}
+
+void QUdevDeviceAttributes::assign(QUdevDeviceAttribute eAttr, const QString &strValue)
+{
+    Q_ASSERT(eAttr >= 0 && eAttr < eAttrCount);
+
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    m_astrValues[eAttr] = strValue;
+    m_iLoaded |= (1 << eAttr);
+}
+
+void QUdevDeviceAttributes::reset(const char *pcSysfsPath)
+{
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    QUdevDeviceData::assignLatin1(m_strSysfsPath, pcSysfsPath);
+    m_iLoaded = 0;
+    for(int i = 0; i < eAttrCount; ++i)
+    {
+        m_astrValues[i].clear();
+    }
+}
+
+void QUdevDeviceAttributes::preload(struct udev *pUdev) const
+{
+    QMutexLocker l(&m_Mutex);
+    load(pUdev);
+    Q_UNUSED(l);
+}
+
+void QUdevDeviceAttributes::load(struct udev *pUdev) const
+{
+    const int iAll = (1 << eAttrCount) - 1;
+    if(iAll == m_iLoaded) return;
+
+    //one device object for all attributes, the device may already be gone (the attributes stay empty then)
+    struct udev_device *dev = pUdev ? udev_device_new_from_syspath(pUdev, m_strSysfsPath.toLatin1().constData()) : 0;
+    if(dev)
+    {
+        for(int i = 0; i < eAttrCount; ++i)
+        {
+            if(m_iLoaded & (1 << i)) continue;
+            m_astrValues[i] = QString::fromLatin1(udev_device_get_sysattr_value(dev, s_apcAttributeNames[i]));
+        }
+        udev_device_unref(dev);
+    }
+    m_iLoaded = iAll;
+}
+
+/**
+ * Protects the property key table
+ */
+static QReadWriteLock s_PropertyKeysLock;
+
+/**
+ * The property keys, key id i is stored at index i - 1
+ */
+static QVector<QByteArray> s_vPropertyKeys;
+
+/**
+ * The property keys as QString
+ */
+static QVector<QString> s_vPropertyKeyNames;
+
+/**
+ * The key ids ordered by their keys
+ */
+static QVector<int> s_vSortedPropertyKeys;
+
+/**
+ * Compare a known key with a key that is not necessarily NUL terminated
+ */
+static int comparePropertyKey(const QByteArray &baKey, const char *pcKey, int iKeyLength)
+{
+    int iResult = qstrncmp(baKey.constData(), pcKey, iKeyLength);
+    if(0 != iResult) return iResult;
+    return baKey.size() - iKeyLength;
+}
+
+/**
+ * Get the position of the key in s_vSortedPropertyKeys, or the position it would have to be inserted at (lock held)
+ */
+static int findSortedPropertyKey(const char *pcKey, int iKeyLength)
+{
+    int iLow = 0;
+    int iHigh = s_vSortedPropertyKeys.size();
+    while(iLow < iHigh)
+    {
+        int iMid = (iLow + iHigh) / 2;
+        if(comparePropertyKey(s_vPropertyKeys.at(s_vSortedPropertyKeys.at(iMid) - 1), pcKey, iKeyLength) < 0) iLow = iMid + 1;
+        else iHigh = iMid;
+    }
+    return iLow;
+}
+
+int QUdevPropertyKeys::intern(const char *pcKey, int iKeyLength)
+{
+    {
+        QReadLocker l(&s_PropertyKeysLock);
+        int iPos = findSortedPropertyKey(pcKey, iKeyLength);
+        if((iPos < s_vSortedPropertyKeys.size()) && (0 == comparePropertyKey(s_vPropertyKeys.at(s_vSortedPropertyKeys.at(iPos) - 1), pcKey, iKeyLength))) return s_vSortedPropertyKeys.at(iPos);
+        Q_UNUSED(l);
+    }
+
+    QWriteLocker l(&s_PropertyKeysLock);
+    Q_UNUSED(l);
+
+    //another thread may have added the key in between
+    int iPos = findSortedPropertyKey(pcKey, iKeyLength);
+    if((iPos < s_vSortedPropertyKeys.size()) && (0 == comparePropertyKey(s_vPropertyKeys.at(s_vSortedPropertyKeys.at(iPos) - 1), pcKey, iKeyLength))) return s_vSortedPropertyKeys.at(iPos);
+
+    QByteArray baKey(pcKey, iKeyLength);
+    s_vPropertyKeys.append(baKey);
+    s_vPropertyKeyNames.append(QString::fromLatin1(baKey.constData()));
+    s_vSortedPropertyKeys.insert(iPos, s_vPropertyKeys.size());
+    return s_vPropertyKeys.size();
+}
+
+int QUdevPropertyKeys::find(const QString &strKey)
+{
+    QByteArray baKey = strKey.toLatin1();
+
+    QReadLocker l(&s_PropertyKeysLock);
+    Q_UNUSED(l);
+
+    int iPos = findSortedPropertyKey(baKey.constData(), baKey.size());
+    if((iPos < s_vSortedPropertyKeys.size()) && (0 == comparePropertyKey(s_vPropertyKeys.at(s_vSortedPropertyKeys.at(iPos) - 1), baKey.constData(), baKey.size()))) return s_vSortedPropertyKeys.at(iPos);
+    return 0;
+}
+
+QString QUdevPropertyKeys::getName(int iKey)
+{
+    QReadLocker l(&s_PropertyKeysLock);
+    Q_UNUSED(l);
+
+    return ((iKey > 0) && (iKey <= s_vPropertyKeyNames.size())) ? s_vPropertyKeyNames.at(iKey - 1) : QString();
+}
+
+/**
+ * Appends the visited properties to the device data
+ */
+class QUdevDevicePropertyCollector : public QUdevBackendPropertyVisitor
+{
+    public:
+
+        explicit QUdevDevicePropertyCollector(QUdevDeviceData *pData)
+          : m_pData(pData)
+        {
+
+        }
+
+        virtual void visitProperty(const char *pcKey, int iKeyLength, const char *pcValue)
+        {
+            QUdevDeviceProperty prop;
+            prop.m_iKey = QUdevPropertyKeys::intern(pcKey, iKeyLength);
+            prop.m_iValueOffset = m_pData->m_baPropertyValues.size();
+            m_pData->m_vProperties.append(prop);
+
+            //the terminating NUL is appended as well
+            m_pData->m_baPropertyValues.append(pcValue ? pcValue : "", pcValue ? static_cast<int>(strlen(pcValue)) + 1 : 1);
+        }
+
+    private:
+
+        QUdevDeviceData *m_pData;
+};
+
+void QUdevDeviceData::setProperties(const QUdevBackendEvent &ev)
+{
+    //resizing keeps the reserved capacity of recycled data
+    m_vProperties.resize(0);
+    m_baPropertyValues.resize(0);
+
+    QUdevDevicePropertyCollector collector(this);
+    ev.visitProperties(collector);
+
+    //key ids are assigned in order of appearance, a few dozen properties are sorted quickly
+    std::sort(m_vProperties.begin(), m_vProperties.end());
+}
+
+const char *QUdevDeviceData::findProperty(int iKey) const
+{
+    if(iKey <= 0) return 0;
+
+    QUdevDeviceProperty prop;
+    prop.m_iKey = iKey;
+    prop.m_iValueOffset = 0;
+
+    QVector<QUdevDeviceProperty>::const_iterator it = std::lower_bound(m_vProperties.constBegin(), m_vProperties.constEnd(), prop);
+    if((it == m_vProperties.constEnd()) || (it->m_iKey != iKey)) return 0;
+    return m_baPropertyValues.constData() + it->m_iValueOffset;
+}
+
+void QUdevDeviceData::release(QUdevDeviceData *pData)
+{
+    if(pData->m_pPool) pData->m_pPool->recycle(pData);
+    else delete pData;
+}
+
+/**
+ * Data of all default constructed devices, holds a reference of its own so it is never released
+ */
+class QUdevSharedEmptyDeviceData : public QUdevDeviceData
+{
+    public:
+
+        QUdevSharedEmptyDeviceData()
+        {
+            ref.ref();
+        }
+};
+
+static QUdevSharedEmptyDeviceData s_SharedEmptyData;
+
+QUdevDeviceData *QUdevDeviceData::getSharedEmpty()
+{
+    return &s_SharedEmptyData;
+}
+
+void QUdevDeviceData::assignLatin1(QString &str, const char *pcLatin1)
+{
+    int iLength = pcLatin1 ? static_cast<int>(strlen(pcLatin1)) : 0;
+    str.resize(iLength);
+
+    QChar *pChars = str.data();
+    for(int i = 0; i < iLength; ++i)
+    {
+        pChars[i] = QLatin1Char(pcLatin1[i]);
+    }
+}
+
+QUdevDeviceDataPool::QUdevDeviceDataPool(int iMaxFree /*= 256*/)
+  : m_iMaxFree(iMaxFree),
+    m_iOutstanding(0),
+    m_bClosed(false)
+{
+    m_vFree.reserve(m_iMaxFree);
+}
+
+QUdevDeviceDataPool::~QUdevDeviceDataPool()
+{
+    qDeleteAll(m_vFree);
+}
+
+QUdevDeviceData *QUdevDeviceDataPool::acquire()
+{
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    ++m_iOutstanding;
+    if(false == m_vFree.isEmpty())
+    {
+        QUdevDeviceData *pData = m_vFree.last();
+        m_vFree.pop_back();
+        return pData;
+    }
+
+    QUdevDeviceData *pData = new QUdevDeviceData;
+    pData->m_pPool = this;
+
+    //fixed capacity keeps the buffers from being shrunk and reallocated for shorter paths
+    pData->m_strSysfsPath.reserve(128);
+    pData->m_strDevPath.reserve(64);
+    pData->m_vProperties.reserve(32);
+    pData->m_baPropertyValues.reserve(1024);
+    return pData;
+}
+
+void QUdevDeviceDataPool::recycle(QUdevDeviceData *pData)
+{
+    bool bDeletePool = false;
+    {
+        QMutexLocker l(&m_Mutex);
+        --m_iOutstanding;
+
+        /*
+         * Attributes also used elsewhere (a parent, the registry) are not ours to reuse. Without handles the attributes are
+         * only reachable through holders owning a reference already, so a count of 1 cannot grow anymore. The acquire
+         * pairs with the ordered deref() of the last other holder, its accesses happen before the reuse.
+         */
+        if(pData->m_pAttributes && (1 != pData->m_pAttributes->ref.fetchAndAddAcquire(0))) pData->m_pAttributes.reset();
+
+        if(m_bClosed || (m_vFree.size() >= m_iMaxFree)) delete pData;
+        else m_vFree.append(pData);
+
+        bDeletePool = m_bClosed && (0 == m_iOutstanding);
+        Q_UNUSED(l);
+    }
+
+    if(bDeletePool) delete this;
+}
+
+void QUdevDeviceDataPool::close()
+{
+    bool bDeletePool = false;
+    {
+        QMutexLocker l(&m_Mutex);
+        m_bClosed = true;
+
+        qDeleteAll(m_vFree);
+        m_vFree.clear();
+
+        bDeletePool = (0 == m_iOutstanding);
+        Q_UNUSED(l);
+    }
+
+    if(bDeletePool) delete this;
+}
+
+QUdevDevice::QUdevDevice()
+  : d(QUdevDeviceData::getSharedEmpty())
+{
+    d->ref.ref();
+}
+
+QUdevDevice::QUdevDevice(QUdevDeviceData *pData)
+  : d(pData)
+{
+    d->ref.ref();
+}
+
+QUdevDevice::QUdevDevice(const QUdevDeviceFields &Fields)
+  : d(new QUdevDeviceData)
+{
+    d->ref.ref();
+
+    d->m_strSysfsPath = Fields.m_strSysfsPath;
+    d->m_strDevPath = Fields.m_strDevPath;
+    d->m_strSubsystem = Fields.m_strSubsystem;
+    d->m_strDeviceType = Fields.m_strDeviceType;
+
+    //the given values win over sysfs
+    d->m_pAttributes = new QUdevDeviceAttributes(Fields.m_strSysfsPath);
+    d->m_pAttributes->assign(eAttrVendorID, Fields.m_strVendorID);
+    d->m_pAttributes->assign(eAttrProductID, Fields.m_strProductID);
+    d->m_pAttributes->assign(eAttrManufacturer, Fields.m_strManufacturer);
+    d->m_pAttributes->assign(eAttrProduct, Fields.m_strProduct);
+    d->m_pAttributes->assign(eAttrSerial, Fields.m_strSerial);
+}
+
+QUdevDevice::QUdevDevice(const QUdevDevice &Other)
+  : d(Other.d)
+{
+    d->ref.ref();
+}
+
+QUdevDevice::~QUdevDevice()
+{
+    if(false == d->ref.deref()) QUdevDeviceData::release(d);
+}
+
+QUdevDevice &QUdevDevice::operator=(const QUdevDevice &Other)
+{
+    //take the new reference first, the assignment may be to itself
+    Other.d->ref.ref();
+    if(false == d->ref.deref()) QUdevDeviceData::release(d);
+    d = Other.d;
+    return *this;
+}
+
+bool QUdevDevice::isValid() const
+{
+    return false == d->m_strSysfsPath.isEmpty();
+}
+
+QString QUdevDevice::getSysfsPath() const
+{
+    return d->m_strSysfsPath;
+}
+
+QString QUdevDevice::getDevPath() const
+{
+    return d->m_strDevPath;
+}
+
+QString QUdevDevice::getSubsystem() const
+{
+    return d->m_strSubsystem;
+}
+
+QString QUdevDevice::getDeviceType() const
+{
+    return d->m_strDeviceType;
+}
+
+QString QUdevDevice::getVendorID() const
+{
+    return d->m_pAttributes ? d->m_pAttributes->getAttribute(eAttrVendorID) : QString();
+}
+
+QString QUdevDevice::getProductID() const
+{
+    return d->m_pAttributes ? d->m_pAttributes->getAttribute(eAttrProductID) : QString();
+}
+
+QString QUdevDevice::getManufacturer() const
+{
+    return d->m_pAttributes ? d->m_pAttributes->getAttribute(eAttrManufacturer) : QString();
+}
+
+QString QUdevDevice::getProduct() const
+{
+    return d->m_pAttributes ? d->m_pAttributes->getAttribute(eAttrProduct) : QString();
+}
+
+QString QUdevDevice::getSerial() const
+{
+    return d->m_pAttributes ? d->m_pAttributes->getAttribute(eAttrSerial) : QString();
+}
+
+QString QUdevDevice::getProperty(const QString &strKey) const
+{
+    return QString::fromUtf8(d->findProperty(QUdevPropertyKeys::find(strKey)));
+}
+
+bool QUdevDevice::hasProperty(const QString &strKey) const
+{
+    return 0 != d->findProperty(QUdevPropertyKeys::find(strKey));
+}
+
+QStringList QUdevDevice::getPropertyNames() const
+{
+    QStringList lstrNames;
+    foreach(const QUdevDeviceProperty &prop, d->m_vProperties)
+    {
+        lstrNames.append(QUdevPropertyKeys::getName(prop.m_iKey));
+    }
+    return lstrNames;
+}
+
+QUdevDeviceFields QUdevDevice::getFields() const
+{
+    QUdevDeviceFields Fields;
+    Fields.m_strSysfsPath = getSysfsPath();
+    Fields.m_strDevPath = getDevPath();
+    Fields.m_strSubsystem = getSubsystem();
+    Fields.m_strDeviceType = getDeviceType();
+    Fields.m_strVendorID = getVendorID();
+    Fields.m_strProductID = getProductID();
+    Fields.m_strManufacturer = getManufacturer();
+    Fields.m_strProduct = getProduct();
+    Fields.m_strSerial = getSerial();
+    return Fields;
+}
@@ -0,0 +1,323 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QUdevDeviceRegistry_private.h"
+
+QUdevDeviceRegistry::QUdevDeviceRegistry()
+{
+
+}
+
+QUdevDeviceRegistry::~QUdevDeviceRegistry()
+{
+
+}
+
+bool QUdevDeviceRegistry::isTracking(const QString &strSubsystem) const
+{
+    QReadLocker l(&m_Lock);
+    Q_UNUSED(l);
+    return m_sSubsystems.contains(strSubsystem);
+}
+
+bool QUdevDeviceRegistry::beginSeed(const QString &strSubsystem)
+{
+    QWriteLocker l(&m_Lock);
+    Q_UNUSED(l);
+
+    if(m_sSubsystems.contains(strSubsystem)) return false;
+
+    m_sSubsystems.insert(strSubsystem);
+    m_hSeedTouched.insert(strSubsystem, QSet<QString>());
+    return true;
+}
+
+void QUdevDeviceRegistry::finishSeed(const QString &strSubsystem, const QList<QUdevRegistryDevice> &lDevices)
+{
+    QWriteLocker l(&m_Lock);
+    Q_UNUSED(l);
+
+    //the registry might have been cleared during the scan
+    if(false == m_hSeedTouched.contains(strSubsystem)) return;
+
+    QSet<QString> sTouched = m_hSeedTouched.take(strSubsystem);
+    foreach(const QUdevRegistryDevice &device, lDevices)
+    {
+        //the monitor already reported something newer than our enumeration
+        if(sTouched.contains(device.first.getSysfsPath())) continue;
+        insertEntry(device.first, device.second);
+    }
+}
+
+void QUdevDeviceRegistry::abortSeed(const QString &strSubsystem)
+{
+    QWriteLocker l(&m_Lock);
+    Q_UNUSED(l);
+
+    foreach(const QString &strSysfsPath, m_hBySubsystem.value(strSubsystem))
+    {
+        removeEntry(strSysfsPath);
+    }
+    m_hSeedTouched.remove(strSubsystem);
+    m_sSubsystems.remove(strSubsystem);
+}
+
+void QUdevDeviceRegistry::resetSubsystem(const QString &strSubsystem, const QList<QUdevRegistryDevice> &lDevices)
+{
+    QWriteLocker l(&m_Lock);
+    Q_UNUSED(l);
+
+    if(false == m_sSubsystems.contains(strSubsystem)) return;
+
+    foreach(const QString &strSysfsPath, m_hBySubsystem.value(strSubsystem))
+    {
+        removeEntry(strSysfsPath);
+    }
+    m_hSeedTouched.remove(strSubsystem);
+
+    foreach(const QUdevRegistryDevice &device, lDevices)
+    {
+        insertEntry(device.first, device.second);
+    }
+}
+
+void QUdevDeviceRegistry::clear()
+{
+    QWriteLocker l(&m_Lock);
+    Q_UNUSED(l);
+
+    m_sSubsystems.clear();
+    m_hSeedTouched.clear();
+    m_hBySysfsPath.clear();
+    m_hByDevPath.clear();
+    m_hBySerial.clear();
+    m_hBySubsystem.clear();
+    m_hBySubsystemType.clear();
+}
+
+void QUdevDeviceRegistry::updateDevice(const QUdevDevice &udDev, const QString &strSerial)
+{
+    QWriteLocker l(&m_Lock);
+    Q_UNUSED(l);
+
+    if(false == m_sSubsystems.contains(udDev.getSubsystem())) return;
+    markTouched(udDev.getSubsystem(), udDev.getSysfsPath());
+
+    //the parents of a device do not change with a change event
+    QHash<QByteArray, QExplicitlySharedDataPointer<QUdevDeviceAttributes> > hParents = m_hBySysfsPath.value(udDev.getSysfsPath()).m_hParents;
+
+    removeEntry(udDev.getSysfsPath());
+    insertEntry(udDev, strSerial);
+    m_hBySysfsPath[udDev.getSysfsPath()].m_hParents = hParents;
+}
+
+void QUdevDeviceRegistry::removeDevice(const QString &strSysfsPath)
+{
+    QWriteLocker l(&m_Lock);
+    Q_UNUSED(l);
+
+    QHash<QString, QUdevRegistryEntry>::const_iterator it = m_hBySysfsPath.constFind(strSysfsPath);
+    if(it != m_hBySysfsPath.constEnd())
+    {
+        markTouched(it.value().m_udDev.getSubsystem(), strSysfsPath);
+    }
+    else
+    {
+        //not known yet, but the enumeration running right now must not bring it back
+        foreach(const QString &strSubsystem, m_hSeedTouched.keys())
+        {
+            markTouched(strSubsystem, strSysfsPath);
+        }
+    }
+
+    removeEntry(strSysfsPath);
+}
+
+QUdevDevice QUdevDeviceRegistry::findBySysfsPath(const QString &strSysfsPath) const
+{
+    QReadLocker l(&m_Lock);
+    Q_UNUSED(l);
+    return m_hBySysfsPath.value(strSysfsPath).m_udDev;
+}
+
+QUdevDevice QUdevDeviceRegistry::findByDevPath(const QString &strDevPath) const
+{
+    QReadLocker l(&m_Lock);
+    Q_UNUSED(l);
+
+    QHash<QString, QString>::const_iterator it = m_hByDevPath.constFind(strDevPath);
+    if(it == m_hByDevPath.constEnd()) return QUdevDevice();
+    return m_hBySysfsPath.value(it.value()).m_udDev;
+}
+
+QUdevDeviceList QUdevDeviceRegistry::findBySerial(const QString &strSerial) const
+{
+    QReadLocker l(&m_Lock);
+    Q_UNUSED(l);
+
+    QUdevDeviceList lDevices;
+    foreach(const QString &strSysfsPath, m_hBySerial.value(strSerial))
+    {
+        lDevices.append(m_hBySysfsPath.value(strSysfsPath).m_udDev);
+    }
+    return lDevices;
+}
+
+QUdevDeviceList QUdevDeviceRegistry::findDevices(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType)
+{
+    QUdevDeviceList lDevices;
+
+    QByteArray baParentSubSystem = strParentSubSystem.toLatin1();
+    QByteArray baParentDeviceType = strParentDeviceType.toLatin1();
+    bool bParentConstraint = !baParentSubSystem.isEmpty() && !baParentDeviceType.isEmpty();
+    QByteArray baParentKey = baParentSubSystem + '\0' + baParentDeviceType;
+
+    //devices whose parent was never resolved for this constraint
+    QList<QUdevDevice> lUnresolved;
+
+    {
+        QReadLocker l(&m_Lock);
+        Q_UNUSED(l);
+
+        const QSet<QString> sSysfsPaths = strDeviceType.isEmpty() ? m_hBySubsystem.value(strSubSystem) : m_hBySubsystemType.value(qMakePair(strSubSystem, strDeviceType));
+        foreach(const QString &strSysfsPath, sSysfsPaths)
+        {
+            //every indexed path is present, constFind() does not detach while readers share the lock
+            const QUdevRegistryEntry &entry = m_hBySysfsPath.constFind(strSysfsPath).value();
+            if(false == bParentConstraint)
+            {
+                lDevices.append(entry.m_udDev);
+                continue;
+            }
+
+            QHash<QByteArray, QExplicitlySharedDataPointer<QUdevDeviceAttributes> >::const_iterator it = entry.m_hParents.constFind(baParentKey);
+            if(it == entry.m_hParents.constEnd())
+            {
+                lUnresolved.append(entry.m_udDev);
+            }
+            else if(it.value())
+            {
+                //the detail attributes of the result come from the parent
+                QUdevDeviceData *pData = new QUdevDeviceData;
+                pData->m_strSysfsPath = entry.m_udDev.getSysfsPath();
+                pData->m_strDevPath = entry.m_udDev.getDevPath();
+                pData->m_strSubsystem = entry.m_udDev.getSubsystem();
+                pData->m_strDeviceType = entry.m_udDev.getDeviceType();
+                pData->m_pAttributes = it.value();
+                pData->m_vProperties = entry.m_udDev.d->m_vProperties;
+                pData->m_baPropertyValues = entry.m_udDev.d->m_baPropertyValues;
+                lDevices.append(QUdevDevice(pData));
+            }
+        }
+    }
+
+    if(lUnresolved.isEmpty()) return lDevices;
+
+    //walk the sysfs tree outside of the lock, this is done only once per device and parent constraint.
+    //The monitoring thread updates the registry meanwhile, so the context is the one of the calling thread.
+    struct udev *pUdev = QUdevThreadContext::get();
+    QList<QExplicitlySharedDataPointer<QUdevDeviceAttributes> > lParents;
+    foreach(const QUdevDevice &udDev, lUnresolved)
+    {
+        QExplicitlySharedDataPointer<QUdevDeviceAttributes> pParent;
+
+        struct udev_device *dev = udev_device_new_from_syspath(pUdev, udDev.getSysfsPath().toLatin1().constData());
+        if(dev)
+        {
+            struct udev_device *parent_dev = udev_device_get_parent_with_subsystem_devtype(dev, baParentSubSystem.constData(), baParentDeviceType.constData());
+            if(parent_dev) pParent = new QUdevDeviceAttributes(QString::fromLatin1(udev_device_get_syspath(parent_dev)));
+            //NOTE: parent_dev needs NOT to be unreferenced, it is owned by dev
+            udev_device_unref(dev);
+        }
+        lParents.append(pParent);
+
+        if(pParent)
+        {
+            QUdevDeviceData *pData = new QUdevDeviceData;
+            pData->m_strSysfsPath = udDev.getSysfsPath();
+            pData->m_strDevPath = udDev.getDevPath();
+            pData->m_strSubsystem = udDev.getSubsystem();
+            pData->m_strDeviceType = udDev.getDeviceType();
+            pData->m_pAttributes = pParent;
+            pData->m_vProperties = udDev.d->m_vProperties;
+            pData->m_baPropertyValues = udDev.d->m_baPropertyValues;
+            lDevices.append(QUdevDevice(pData));
+        }
+    }
+
+    //remember the resolved parents for the next query
+    QWriteLocker l(&m_Lock);
+    Q_UNUSED(l);
+    for(int i = 0; i < lUnresolved.size(); ++i)
+    {
+        QHash<QString, QUdevRegistryEntry>::iterator it = m_hBySysfsPath.find(lUnresolved.at(i).getSysfsPath());
+        if(it != m_hBySysfsPath.end()) it.value().m_hParents.insert(baParentKey, lParents.at(i));
+    }
+
+    return lDevices;
+}
+
+void QUdevDeviceRegistry::insertEntry(const QUdevDevice &udDev, const QString &strSerial)
+{
+    const QString strSysfsPath = udDev.getSysfsPath();
+
+    QUdevRegistryEntry &entry = m_hBySysfsPath[strSysfsPath];
+    entry.m_udDev = udDev;
+    entry.m_strSerial = strSerial;
+
+    if(false == udDev.getDevPath().isEmpty()) m_hByDevPath.insert(udDev.getDevPath(), strSysfsPath);
+    if(false == strSerial.isEmpty()) m_hBySerial[strSerial].insert(strSysfsPath);
+    m_hBySubsystem[udDev.getSubsystem()].insert(strSysfsPath);
+    m_hBySubsystemType[qMakePair(udDev.getSubsystem(), udDev.getDeviceType())].insert(strSysfsPath);
+}
+
+void QUdevDeviceRegistry::removeEntry(const QString &strSysfsPath)
+{
+    QHash<QString, QUdevRegistryEntry>::iterator it = m_hBySysfsPath.find(strSysfsPath);
+    if(it == m_hBySysfsPath.end()) return;
+
+    const QUdevDevice &udDev = it.value().m_udDev;
+    const QString &strSerial = it.value().m_strSerial;
+
+    //only drop the device node if it was not taken over by another device meanwhile
+    if(m_hByDevPath.value(udDev.getDevPath()) == strSysfsPath) m_hByDevPath.remove(udDev.getDevPath());
+
+    if(false == strSerial.isEmpty())
+    {
+        QSet<QString> &sSerial = m_hBySerial[strSerial];
+        sSerial.remove(strSysfsPath);
+        if(sSerial.isEmpty()) m_hBySerial.remove(strSerial);
+    }
+
+    QSet<QString> &sSubsystem = m_hBySubsystem[udDev.getSubsystem()];
+    sSubsystem.remove(strSysfsPath);
+    if(sSubsystem.isEmpty()) m_hBySubsystem.remove(udDev.getSubsystem());
+
+    QPair<QString, QString> type = qMakePair(udDev.getSubsystem(), udDev.getDeviceType());
+    QSet<QString> &sType = m_hBySubsystemType[type];
+    sType.remove(strSysfsPath);
+    if(sType.isEmpty()) m_hBySubsystemType.remove(type);
+
+    m_hBySysfsPath.erase(it);
+}
+
+void QUdevDeviceRegistry::markTouched(const QString &strSubsystem, const QString &strSysfsPath)
+{
+    QHash<QString, QSet<QString> >::iterator it = m_hSeedTouched.find(strSubsystem);
+    if(it != m_hSeedTouched.end()) it.value().insert(strSysfsPath);
+}
@@ -0,0 +1,188 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVDEVICEREGISTRY_PRIVATE_H
+#define QUDEVDEVICEREGISTRY_PRIVATE_H
+
+#include <QReadWriteLock>
+#include <libudev.h>
+
+#include "QUdevDeclarations.h"
+#include "QUdevDevice_private.h"
+
+/**
+ * In-memory registry of all devices of the tracked subsystems
+ *
+ * The registry is seeded with one enumeration per subsystem and afterwards kept up to date by the
+ * monitoring thread. Queries are answered from memory, lookups by sysfs path, device node and serial
+ * are hash lookups. Parent constraints are resolved once per device and constraint and then remembered.
+ *
+ * All methods are thread safe.
+ */
+class QUdevDeviceRegistry
+{
+    public:
+
+        /**
+         * A device together with the serial it is indexed by
+         */
+        typedef QPair<QUdevDevice, QString> QUdevRegistryDevice;
+
+        QUdevDeviceRegistry();
+
+        ~QUdevDeviceRegistry();
+
+        /**
+         * Check if the devices of the given subsystem are held by the registry
+         */
+        bool isTracking(const QString &strSubsystem) const;
+
+        /**
+         * Start tracking a subsystem, events for it are recorded until finishSeed() is called
+         *
+         * @return False if the subsystem is already tracked
+         */
+        bool beginSeed(const QString &strSubsystem);
+
+        /**
+         * Insert the enumerated devices of a subsystem
+         *
+         * Devices changed or removed by events since beginSeed() are skipped, the event is newer than the enumeration.
+         */
+        void finishSeed(const QString &strSubsystem, const QList<QUdevRegistryDevice> &lDevices);
+
+        /**
+         * Stop tracking a subsystem whose seed could not be completed, devices inserted by events meanwhile are dropped
+         */
+        void abortSeed(const QString &strSubsystem);
+
+        /**
+         * Replace all devices of a subsystem (for example after a receive buffer overflow)
+         */
+        void resetSubsystem(const QString &strSubsystem, const QList<QUdevRegistryDevice> &lDevices);
+
+        /**
+         * Drop all devices and stop tracking all subsystems
+         */
+        void clear();
+
+        /**
+         * Insert or update a device reported by the monitor
+         */
+        void updateDevice(const QUdevDevice &udDev, const QString &strSerial);
+
+        /**
+         * Remove a device reported by the monitor
+         */
+        void removeDevice(const QString &strSysfsPath);
+
+        /**
+         * Get the device with the given sysfs path (an invalid device if unknown)
+         */
+        QUdevDevice findBySysfsPath(const QString &strSysfsPath) const;
+
+        /**
+         * Get the device with the given device node (an invalid device if unknown)
+         */
+        QUdevDevice findByDevPath(const QString &strDevPath) const;
+
+        /**
+         * Get all devices with the given serial
+         */
+        QUdevDeviceList findBySerial(const QString &strSerial) const;
+
+        /**
+         * Get all devices matching the given parameters, see QUdev::getUDevDevicesForSubsystem()
+         */
+        QUdevDeviceList findDevices(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType);
+
+    private:
+
+        Q_DISABLE_COPY(QUdevDeviceRegistry);
+
+        /**
+         * One registered device
+         */
+        struct QUdevRegistryEntry
+        {
+            QUdevDevice m_udDev;
+            QString m_strSerial;
+
+            /**
+             * Attributes of the resolved parents keyed by parent subsystem/devtype, null if there is no such parent
+             */
+            QHash<QByteArray, QExplicitlySharedDataPointer<QUdevDeviceAttributes> > m_hParents;
+        };
+
+        /**
+         * Insert a device into all indexes (m_Lock must be held for writing)
+         */
+        void insertEntry(const QUdevDevice &udDev, const QString &strSerial);
+
+        /**
+         * Remove a device from all indexes (m_Lock must be held for writing)
+         */
+        void removeEntry(const QString &strSysfsPath);
+
+        /**
+         * Remember that an event touched the device while its subsystem is being seeded (m_Lock must be held for writing)
+         */
+        void markTouched(const QString &strSubsystem, const QString &strSysfsPath);
+
+        /**
+         * Protects all members below
+         */
+        mutable QReadWriteLock m_Lock;
+
+        /**
+         * The tracked subsystems
+         */
+        QSet<QString> m_sSubsystems;
+
+        /**
+         * Devices changed by events per subsystem currently being seeded
+         */
+        QHash<QString, QSet<QString> > m_hSeedTouched;
+
+        /**
+         * All devices by sysfs path
+         */
+        QHash<QString, QUdevRegistryEntry> m_hBySysfsPath;
+
+        /**
+         * Sysfs path by device node
+         */
+        QHash<QString, QString> m_hByDevPath;
+
+        /**
+         * Sysfs paths by serial
+         */
+        QHash<QString, QSet<QString> > m_hBySerial;
+
+        /**
+         * Sysfs paths by subsystem
+         */
+        QHash<QString, QSet<QString> > m_hBySubsystem;
+
+        /**
+         * Sysfs paths by subsystem and devicetype
+         */
+        QHash<QPair<QString, QString>, QSet<QString> > m_hBySubsystemType;
+};
+
+#endif // QUDEVDEVICEREGISTRY_PRIVATE_H
@@ -0,0 +1,329 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVDEVICE_PRIVATE_H
+#define QUDEVDEVICE_PRIVATE_H
+
+#include <QSharedData>
+#include <QMutex>
+#include <QVector>
+#include <libudev.h>
+
+#include "QUdevDeclarations.h"
+
+/**
+ * The detail attributes a QUdevDevice can provide
+ */
+enum QUdevDeviceAttribute
+{
+    eAttrVendorID,
+    eAttrProductID,
+    eAttrManufacturer,
+    eAttrProduct,
+    eAttrSerial,
+
+    eAttrCount
+};
+
+/**
+ * The udev context of the calling thread
+ *
+ * A libudev context is not thread safe, so objects shared between threads never keep one.
+ * Code running on arbitrary threads (attribute reads, registry queries, resyncs) uses the context of its thread.
+ */
+class QUdevThreadContext
+{
+    public:
+
+        /**
+         * Get the context of the calling thread, created on first use and released when the thread ends
+         */
+        static struct udev *get();
+
+        ~QUdevThreadContext();
+
+    private:
+
+        QUdevThreadContext();
+
+        Q_DISABLE_COPY(QUdevThreadContext);
+
+        struct udev *m_pUdev;
+};
+
+/**
+ * Lazily loaded sysfs attributes of one device
+ *
+ * All attributes are read from sysfs at once on the first access and cached afterwards. One instance can be
+ * shared by several QUdevDevice objects (for example all children of the same usb parent).
+ */
+class QUdevDeviceAttributes : public QSharedData
+{
+    public:
+
+        /**
+         * Constructor
+         *
+         * @param strSysfsPath The sysfs path of the device the attributes are read from
+         */
+        explicit QUdevDeviceAttributes(const QString &strSysfsPath);
+
+        /**
+         * Get the sysfs path the attributes are read from
+         */
+        QString getSysfsPath() const;
+
+        /**
+         * Get the value of the given attribute, reading all attributes with the context of the calling thread if not done yet
+         */
+        QString getAttribute(QUdevDeviceAttribute eAttr) const;
+
+        /**
+         * Set an attribute instead of reading it from sysfs
+         *
+         * Only allowed before the attributes are shared.
+         */
+        void assign(QUdevDeviceAttribute eAttr, const QString &strValue);
+
+        /**
+         * Point the attributes to another device and forget the cached values
+         *
+         * Only allowed while nobody else uses the attributes (used to recycle pooled attributes).
+         */
+        void reset(const char *pcSysfsPath);
+
+        /**
+         * Read all attributes not read yet at once
+         *
+         * @param pUdev The udev context used for reading (the calling thread may use its own context)
+         */
+        void preload(struct udev *pUdev) const;
+
+    private:
+
+        Q_DISABLE_COPY(QUdevDeviceAttributes);
+
+        /**
+         * Read all attributes not read yet from one device object (m_Mutex must be held)
+         */
+        void load(struct udev *pUdev) const;
+
+        /**
+         * The sysfs path of the device
+         */
+        QString m_strSysfsPath;
+
+        /**
+         * Serialize the lazy loading, the attributes may be shared between threads
+         */
+        mutable QMutex m_Mutex;
+
+        /**
+         * The cached attribute values
+         */
+        mutable QString m_astrValues[eAttrCount];
+
+        /**
+         * Bitmask of the attributes already read from sysfs
+         */
+        mutable int m_iLoaded;
+};
+
+/**
+ * Process wide table of the udev property keys, devices store key ids instead of the key strings
+ *
+ * Keys are only added, never removed, so an id stays valid for the lifetime of the process.
+ */
+class QUdevPropertyKeys
+{
+    public:
+
+        /**
+         * Get the id of a key (starting at 1), adding it if it is unknown
+         *
+         * @param iKeyLength Length of the key, the key is not necessarily NUL terminated
+         */
+        static int intern(const char *pcKey, int iKeyLength);
+
+        /**
+         * Get the id of a key, 0 if no device had the key so far
+         */
+        static int find(const QString &strKey);
+
+        /**
+         * Get the key of an id
+         */
+        static QString getName(int iKey);
+};
+
+/**
+ * One property of a device, the value is stored in QUdevDeviceData::m_baPropertyValues
+ */
+struct QUdevDeviceProperty
+{
+    int m_iKey;
+    int m_iValueOffset;
+
+    bool operator<(const QUdevDeviceProperty &Other) const
+    {
+        return m_iKey < Other.m_iKey;
+    }
+};
+Q_DECLARE_TYPEINFO(QUdevDeviceProperty, Q_PRIMITIVE_TYPE);
+
+class QUdevBackendEvent;
+class QUdevDeviceDataPool;
+
+/**
+ * Shared data of a QUdevDevice
+ */
+class QUdevDeviceData : public QSharedData
+{
+    public:
+
+        QUdevDeviceData()
+          : m_pPool(0)
+        {
+
+        }
+
+        /**
+         * Called when the last QUdevDevice dropped its reference, deletes the data or returns it to its pool
+         *
+         * The caller owns the data exclusively then: the reference count only grows through an existing handle.
+         */
+        static void release(QUdevDeviceData *pData);
+
+        /**
+         * Shared empty data of all default constructed devices
+         */
+        static QUdevDeviceData *getSharedEmpty();
+
+        /**
+         * Overwrite the string with a latin1 string, reusing its buffer if it is not shared
+         */
+        static void assignLatin1(QString &str, const char *pcLatin1);
+
+        /**
+         * Replace the properties by the udev properties of the event
+         */
+        void setProperties(const QUdevBackendEvent &ev);
+
+        /**
+         * Get the value of a property, 0 if the device does not have it
+         */
+        const char *findProperty(int iKey) const;
+
+        QString m_strSysfsPath;
+        QString m_strDevPath;
+
+        QString m_strSubsystem;
+        QString m_strDeviceType;
+
+        /**
+         * Source of the detail attributes (the device itself or the requested parent), may be null
+         */
+        QExplicitlySharedDataPointer<QUdevDeviceAttributes> m_pAttributes;
+
+        /**
+         * The udev properties ordered by key id, two ints per property instead of a map per device
+         */
+        QVector<QUdevDeviceProperty> m_vProperties;
+
+        /**
+         * The NUL terminated property values
+         */
+        QByteArray m_baPropertyValues;
+
+        /**
+         * The pool the data belongs to, 0 for data deleted on release
+         */
+        QUdevDeviceDataPool *m_pPool;
+
+    private:
+
+        Q_DISABLE_COPY(QUdevDeviceData);
+};
+
+/**
+ * Recycles the device data of the dispatch path
+ *
+ * The data objects are handed out by the monitoring thread, filled and published as QUdevDevice handles.
+ * Once the last handle is gone (in any thread) the object comes back with its string buffers and own
+ * attributes, so the next event can reuse them instead of allocating. The pool outlives its owner until
+ * all data handed out came back.
+ */
+class QUdevDeviceDataPool
+{
+    public:
+
+        /**
+         * Constructor
+         *
+         * @param iMaxFree Maximum number of idle objects kept, more are deleted
+         */
+        explicit QUdevDeviceDataPool(int iMaxFree = 256);
+
+        /**
+         * Get a data object without references, it may still hold the buffers and attributes of a previous device
+         */
+        QUdevDeviceData *acquire();
+
+        /**
+         * Take back an object whose last reference was dropped (any thread)
+         */
+        void recycle(QUdevDeviceData *pData);
+
+        /**
+         * Drop the owner, the pool deletes itself as soon as all objects handed out came back
+         */
+        void close();
+
+    private:
+
+        Q_DISABLE_COPY(QUdevDeviceDataPool);
+
+        /**
+         * Destructor, only called by close() or recycle()
+         */
+        ~QUdevDeviceDataPool();
+
+        /**
+         * Protects all members, objects come back from any thread
+         */
+        QMutex m_Mutex;
+
+        /**
+         * The idle objects
+         */
+        QVector<QUdevDeviceData*> m_vFree;
+
+        int m_iMaxFree;
+
+        /**
+         * Number of objects handed out and not yet recycled
+         */
+        int m_iOutstanding;
+
+        /**
+         * Set by close()
+         */
+        bool m_bClosed;
+};
+
+#endif // QUDEVDEVICE_PRIVATE_H
@@ -0,0 +1,312 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QUdevEventQueue_private.h"
+#include "QUdev_private.h"
+
+#include <QThread>
+
+/**
+ * The event type of QUdevQueueWakeupEvent
+ */
+static const QEvent::Type s_eWakeupEventType = static_cast<QEvent::Type>(QEvent::registerEventType());
+
+/**
+ * Difference of two positions, positions wrap around
+ */
+static int positionDiff(int iA, int iB)
+{
+    return static_cast<int>(static_cast<unsigned int>(iA) - static_cast<unsigned int>(iB));
+}
+
+/**
+ * Advance a position, positions wrap around
+ */
+static int positionAdd(int iPos, int iSteps)
+{
+    return static_cast<int>(static_cast<unsigned int>(iPos) + static_cast<unsigned int>(iSteps));
+}
+
+QUdevEventQueue::QUdevEventQueue(int iCapacity, QUdevOverflowPolicy ePolicy)
+  : m_pCells(0),
+    m_iMask(0),
+    m_ePolicy(ePolicy),
+    m_iEnqueuePos(0),
+    m_iDequeuePos(0),
+    m_iWakeupPending(0),
+    m_iProducerWaiting(0),
+    m_iClosed(0),
+    m_iStagedBase(0)
+{
+    //a power of two maps positions to cells with a mask
+    int iSize = 1;
+    while(iSize < qBound(1, iCapacity, 1 << 20)) iSize <<= 1;
+
+    m_pCells = new QUdevQueueCell[iSize];
+    m_iMask = iSize - 1;
+    for(int i = 0; i < iSize; ++i)
+    {
+        m_pCells[i].m_iSequence.fetchAndStoreRelaxed(i);
+    }
+}
+
+QUdevEventQueue::~QUdevEventQueue()
+{
+    delete[] m_pCells;
+}
+
+int QUdevEventQueue::getCapacity() const
+{
+    return m_iMask + 1;
+}
+
+QUdevOverflowPolicy QUdevEventQueue::getPolicy() const
+{
+    return m_ePolicy;
+}
+
+bool QUdevEventQueue::push(const QUdevEvent &e, QUdevStatistics &Statistics)
+{
+    if(0 != m_iClosed.fetchAndAddAcquire(0))
+    {
+        Statistics.add(eCntQueueDropped);
+        return false;
+    }
+
+    //held back events go first, so the events of the queue keep their order
+    bool bWakeup = flushStaged();
+    if(false == m_lStaged.isEmpty())
+    {
+        stage(e, Statistics);
+        return bWakeup;
+    }
+
+    if(false == tryEnqueue(e))
+    {
+        switch(m_ePolicy)
+        {
+            case eOverflowDropOldest:
+            {
+                QUdevEvent dropped;
+                while(false == tryEnqueue(e))
+                {
+                    //the consumer may just be releasing the oldest cell, then the queue is not full anymore
+                    if(dequeue(dropped)) Statistics.add(eCntQueueDropped);
+                    else QThread::yieldCurrentThread();
+                }
+                break;
+            }
+
+            case eOverflowDropNewest:
+                Statistics.add(eCntQueueDropped);
+                return bWakeup;
+
+            case eOverflowCoalesce:
+                stage(e, Statistics);
+                return bWakeup;
+
+            case eOverflowBlock:
+                Statistics.add(eCntQueueBlocked);
+                if(false == waitForRoom(e))
+                {
+                    Statistics.add(eCntQueueDropped);
+                    return bWakeup;
+                }
+                break;
+        }
+    }
+
+    return requestWakeup() || bWakeup;
+}
+
+bool QUdevEventQueue::flushStaged()
+{
+    bool bQueued = false;
+    while((false == m_lStaged.isEmpty()) && tryEnqueue(m_lStaged.first()))
+    {
+        m_hStagedIndex.remove(m_lStaged.first().m_udDev.getSysfsPath());
+        m_lStaged.removeFirst();
+        ++m_iStagedBase;
+        bQueued = true;
+    }
+
+    return bQueued && requestWakeup();
+}
+
+bool QUdevEventQueue::hasStaged() const
+{
+    return false == m_lStaged.isEmpty();
+}
+
+QList<QUdevEvent> QUdevEventQueue::takeStaged()
+{
+    QList<QUdevEvent> lStaged;
+    lStaged.swap(m_lStaged);
+    m_hStagedIndex.clear();
+    m_iStagedBase = 0;
+    return lStaged;
+}
+
+void QUdevEventQueue::beginDrain()
+{
+    m_iWakeupPending.fetchAndStoreOrdered(0);
+}
+
+bool QUdevEventQueue::pop(QUdevEvent &e)
+{
+    if(false == dequeue(e)) return false;
+
+    //a producer waiting for room is released, the mutex makes sure the wakeup is not lost
+    if(0 != m_iProducerWaiting.fetchAndAddAcquire(0))
+    {
+        QMutexLocker l(&m_WaitMutex);
+        m_RoomAvailable.wakeAll();
+        Q_UNUSED(l);
+    }
+    return true;
+}
+
+void QUdevEventQueue::close()
+{
+    m_iClosed.fetchAndStoreRelease(1);
+
+    QMutexLocker l(&m_WaitMutex);
+    m_RoomAvailable.wakeAll();
+    Q_UNUSED(l);
+}
+
+bool QUdevEventQueue::tryEnqueue(const QUdevEvent &e)
+{
+    QUdevQueueCell &cell = m_pCells[m_iEnqueuePos & m_iMask];
+
+    //the cell still holds an event of the previous round
+    if(0 != positionDiff(cell.m_iSequence.fetchAndAddAcquire(0), m_iEnqueuePos)) return false;
+
+    cell.m_Event = e;
+    cell.m_iSequence.fetchAndStoreRelease(positionAdd(m_iEnqueuePos, 1));
+    m_iEnqueuePos = positionAdd(m_iEnqueuePos, 1);
+    return true;
+}
+
+bool QUdevEventQueue::dequeue(QUdevEvent &e)
+{
+    int iPos = m_iDequeuePos.fetchAndAddAcquire(0);
+    for(;;)
+    {
+        QUdevQueueCell &cell = m_pCells[iPos & m_iMask];
+        int iDiff = positionDiff(cell.m_iSequence.fetchAndAddAcquire(0), positionAdd(iPos, 1));
+
+        //the cell is not filled yet, the queue is empty
+        if(iDiff < 0) return false;
+
+        //claim the cell, the consumer and a producer dropping the oldest event may compete for it
+        if((0 == iDiff) && m_iDequeuePos.testAndSetOrdered(iPos, positionAdd(iPos, 1)))
+        {
+            e = cell.m_Event;
+            cell.m_Event = QUdevEvent();
+            cell.m_iSequence.fetchAndStoreRelease(positionAdd(iPos, m_iMask + 1));
+            return true;
+        }
+
+        iPos = m_iDequeuePos.fetchAndAddAcquire(0);
+    }
+}
+
+void QUdevEventQueue::stage(const QUdevEvent &e, QUdevStatistics &Statistics)
+{
+    QString strSysfsPath = e.m_udDev.getSysfsPath();
+
+    //the latest event of a device replaces the held back one
+    QHash<QString, int>::const_iterator it = m_hStagedIndex.constFind(strSysfsPath);
+    if(it != m_hStagedIndex.constEnd())
+    {
+        QUdevEvent &staged = m_lStaged[it.value() - m_iStagedBase];
+        int iRawEvents = staged.m_iRawEvents + e.m_iRawEvents;
+        staged = e;
+        staged.m_iRawEvents = iRawEvents;
+        Statistics.add(eCntQueueCoalesced);
+        return;
+    }
+
+    //the staging area holds at most as many devices as the ring, further devices are dropped
+    if(m_lStaged.size() >= getCapacity())
+    {
+        Statistics.add(eCntQueueDropped);
+        return;
+    }
+
+    m_hStagedIndex.insert(strSysfsPath, m_iStagedBase + m_lStaged.size());
+    m_lStaged.append(e);
+}
+
+bool QUdevEventQueue::waitForRoom(const QUdevEvent &e)
+{
+    m_iProducerWaiting.fetchAndStoreRelease(1);
+
+    bool bQueued = false;
+    {
+        QMutexLocker l(&m_WaitMutex);
+        while(0 == m_iClosed.fetchAndAddAcquire(0))
+        {
+            if(tryEnqueue(e))
+            {
+                bQueued = true;
+                break;
+            }
+
+            //the timeout only guards against a consumer that went away without closing the queue
+            m_RoomAvailable.wait(&m_WaitMutex, 100);
+        }
+        Q_UNUSED(l);
+    }
+
+    m_iProducerWaiting.fetchAndStoreRelease(0);
+    return bQueued;
+}
+
+bool QUdevEventQueue::requestWakeup()
+{
+    return m_iWakeupPending.testAndSetOrdered(0, 1);
+}
+
+QUdevQueueWakeupEvent::QUdevQueueWakeupEvent(QUdevEventQueue *pQueue)
+  : QEvent(getType()),
+    m_pQueue(pQueue)
+{
+
+}
+
+QEvent::Type QUdevQueueWakeupEvent::getType()
+{
+    return s_eWakeupEventType;
+}
+
+QUdevQueueReceiver::QUdevQueueReceiver(QUdevPrivate *pOwner, QObject *pParent)
+  : QObject(pParent),
+    m_pOwner(pOwner)
+{
+
+}
+
+bool QUdevQueueReceiver::event(QEvent *pEvent)
+{
+    if(pEvent->type() != QUdevQueueWakeupEvent::getType()) return QObject::event(pEvent);
+
+    m_pOwner->drainSignalQueue(static_cast<QUdevQueueWakeupEvent*>(pEvent)->m_pQueue.data());
+    return true;
+}
@@ -0,0 +1,222 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVEVENTQUEUE_PRIVATE_H
+#define QUDEVEVENTQUEUE_PRIVATE_H
+
+#include <QSharedData>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QEvent>
+
+#include "QUdevDeclarations.h"
+#include "QUdevStatistics_private.h"
+
+class QUdevPrivate;
+
+/**
+ * Bounded lock-free queue handing the events of the monitoring thread to one consumer thread
+ *
+ * There is one producer (the monitoring thread) and one consumer. Every cell carries a sequence number telling
+ * whether it is free or filled, so the producer can also take the oldest event itself (eOverflowDropOldest)
+ * without any lock. Only a producer blocked by eOverflowBlock waits on a condition.
+ *
+ * The queue does not wake the consumer itself, push() and flushStaged() tell the owner when it has to.
+ */
+class QUdevEventQueue : public QSharedData
+{
+    public:
+
+        /**
+         * Constructor
+         *
+         * @param iCapacity The number of events, rounded up to a power of two
+         */
+        QUdevEventQueue(int iCapacity, QUdevOverflowPolicy ePolicy);
+
+        ~QUdevEventQueue();
+
+        int getCapacity() const;
+
+        QUdevOverflowPolicy getPolicy() const;
+
+        /**
+         * Add an event, applying the overflow policy if the queue is full (producer)
+         *
+         * @param Statistics Receives the dropped, coalesced and blocked counts
+         *
+         * @return True if the consumer has to be woken up
+         */
+        bool push(const QUdevEvent &e, QUdevStatistics &Statistics);
+
+        /**
+         * Move the events held back by eOverflowCoalesce into the queue as far as there is room (producer)
+         *
+         * @return True if the consumer has to be woken up
+         */
+        bool flushStaged();
+
+        /**
+         * Check for events held back by eOverflowCoalesce (producer)
+         */
+        bool hasStaged() const;
+
+        /**
+         * Take the events held back by eOverflowCoalesce, used when the queue is replaced (producer)
+         */
+        QList<QUdevEvent> takeStaged();
+
+        /**
+         * Called by the consumer before it pops the events of a wakeup, later events request a new wakeup
+         */
+        void beginDrain();
+
+        /**
+         * Take the oldest event (consumer)
+         *
+         * @return False if the queue is empty
+         */
+        bool pop(QUdevEvent &e);
+
+        /**
+         * Release a blocked producer for good, events pushed afterwards are dropped
+         */
+        void close();
+
+    private:
+
+        Q_DISABLE_COPY(QUdevEventQueue);
+
+        /**
+         * Put the event into the next cell if it is free (producer)
+         */
+        bool tryEnqueue(const QUdevEvent &e);
+
+        /**
+         * Take the event of the oldest filled cell (consumer, or producer dropping the oldest event)
+         */
+        bool dequeue(QUdevEvent &e);
+
+        /**
+         * Hold the event back, replacing a held back event of the same device (producer)
+         *
+         * Once the capacity of the queue is held back, events of further devices are dropped.
+         */
+        void stage(const QUdevEvent &e, QUdevStatistics &Statistics);
+
+        /**
+         * Wait until the consumer made room or the queue was closed (producer)
+         */
+        bool waitForRoom(const QUdevEvent &e);
+
+        /**
+         * Check if the consumer has to be woken up for a new event
+         */
+        bool requestWakeup();
+
+        struct QUdevQueueCell
+        {
+            /**
+             * Equal to the position of the cell if it is free, the position + 1 if it is filled
+             */
+            QAtomicInt m_iSequence;
+            QUdevEvent m_Event;
+        };
+
+        QUdevQueueCell *m_pCells;
+        int m_iMask;
+        QUdevOverflowPolicy m_ePolicy;
+
+        /**
+         * Next position to fill (only accessed by the producer)
+         */
+        int m_iEnqueuePos;
+
+        /**
+         * Next position to take, advanced by the consumer and by the producer dropping events
+         */
+        QAtomicInt m_iDequeuePos;
+
+        /**
+         * Non-zero while a wakeup of the consumer is on its way
+         */
+        QAtomicInt m_iWakeupPending;
+
+        /**
+         * Non-zero while the producer waits for room
+         */
+        QAtomicInt m_iProducerWaiting;
+
+        QAtomicInt m_iClosed;
+
+        QMutex m_WaitMutex;
+        QWaitCondition m_RoomAvailable;
+
+        /**
+         * Events held back by eOverflowCoalesce in arrival order, at most the capacity (only accessed by the producer)
+         */
+        QList<QUdevEvent> m_lStaged;
+
+        /**
+         * Arrival number of the held back event of each device, m_lStaged starts with m_iStagedBase
+         */
+        QHash<QString, int> m_hStagedIndex;
+        int m_iStagedBase;
+};
+
+/**
+ * Asks the consumer of the signal queue to drain it
+ */
+class QUdevQueueWakeupEvent : public QEvent
+{
+    public:
+
+        explicit QUdevQueueWakeupEvent(QUdevEventQueue *pQueue);
+
+        /**
+         * The event type registered for queue wakeups
+         */
+        static QEvent::Type getType();
+
+        /**
+         * The queue to drain, it may have been replaced meanwhile
+         */
+        QExplicitlySharedDataPointer<QUdevEventQueue> m_pQueue;
+};
+
+/**
+ * Lives in the thread of the QUdev object (as its child) and emits the queued events there
+ */
+class QUdevQueueReceiver : public QObject
+{
+    public:
+
+        QUdevQueueReceiver(QUdevPrivate *pOwner, QObject *pParent);
+
+        virtual bool event(QEvent *pEvent);
+
+    private:
+
+        QUdevPrivate *m_pOwner;
+};
+
+#endif // QUDEVEVENTQUEUE_PRIVATE_H
@@ -0,0 +1,211 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QUdevLibudevBackend_private.h"
+
+#include <QDebug>
+
+#include <errno.h>
+#include <string.h>
+
+const char *QUdevLibudevEvent::getAction() const
+{
+    return udev_device_get_action(m_pDev);
+}
+
+const char *QUdevLibudevEvent::getSysPath() const
+{
+    return udev_device_get_syspath(m_pDev);
+}
+
+const char *QUdevLibudevEvent::getDevPath() const
+{
+    return udev_device_get_devpath(m_pDev);
+}
+
+const char *QUdevLibudevEvent::getSubsystem() const
+{
+    return udev_device_get_subsystem(m_pDev);
+}
+
+const char *QUdevLibudevEvent::getDevType() const
+{
+    return udev_device_get_devtype(m_pDev);
+}
+
+const char *QUdevLibudevEvent::getDevNode() const
+{
+    return udev_device_get_devnode(m_pDev);
+}
+
+bool QUdevLibudevEvent::hasTag(const char *pcTag) const
+{
+    return (udev_device_has_tag(m_pDev, pcTag) > 0);
+}
+
+const char *QUdevLibudevEvent::getPropertyValue(const char *pcKey) const
+{
+    return udev_device_get_property_value(m_pDev, pcKey);
+}
+
+const char *QUdevLibudevEvent::getParentSysPath(const char *pcSubsystem, const char *pcDevType) const
+{
+    /*
+     * udev_device_get_parent_with_subsystem_devtype() will walk up the complete tree if needed
+     * to find any parent with the requested subsystem/devtype combination
+     */
+    struct udev_device* parent_dev = udev_device_get_parent_with_subsystem_devtype(m_pDev, pcSubsystem, pcDevType);
+    //NOTE: parent_dev needs NOT to be unreferenced, it is owned by the child
+    return parent_dev ? udev_device_get_syspath(parent_dev) : 0;
+}
+
+void QUdevLibudevEvent::visitProperties(QUdevBackendPropertyVisitor &visitor) const
+{
+    struct udev_list_entry *entry = 0;
+    udev_list_entry_foreach(entry, udev_device_get_properties_list_entry(m_pDev))
+    {
+        const char *pcKey = udev_list_entry_get_name(entry);
+        visitor.visitProperty(pcKey, static_cast<int>(strlen(pcKey)), udev_list_entry_get_value(entry));
+    }
+}
+
+QList<QPair<QByteArray, QByteArray> > QUdevLibudevEvent::getProperties() const
+{
+    QList<QPair<QByteArray, QByteArray> > lProperties;
+
+    struct udev_list_entry *entry = 0;
+    udev_list_entry_foreach(entry, udev_device_get_properties_list_entry(m_pDev))
+    {
+        lProperties.append(qMakePair(QByteArray(udev_list_entry_get_name(entry)), QByteArray(udev_list_entry_get_value(entry))));
+    }
+    return lProperties;
+}
+
+QList<QByteArray> QUdevLibudevEvent::getTags() const
+{
+    QList<QByteArray> lbaTags;
+
+    struct udev_list_entry *entry = 0;
+    udev_list_entry_foreach(entry, udev_device_get_tags_list_entry(m_pDev))
+    {
+        lbaTags.append(QByteArray(udev_list_entry_get_name(entry)));
+    }
+    return lbaTags;
+}
+
+QList<QUdevBackendAncestor> QUdevLibudevEvent::getAncestors() const
+{
+    QList<QUdevBackendAncestor> lAncestors;
+
+    //the parents are owned by their children, nothing to unreference
+    for(struct udev_device *parent_dev = udev_device_get_parent(m_pDev); parent_dev; parent_dev = udev_device_get_parent(parent_dev))
+    {
+        QUdevBackendAncestor ancestor;
+        ancestor.m_baSysPath = QByteArray(udev_device_get_syspath(parent_dev));
+        ancestor.m_baSubsystem = QByteArray(udev_device_get_subsystem(parent_dev));
+        ancestor.m_baDevType = QByteArray(udev_device_get_devtype(parent_dev));
+        lAncestors.append(ancestor);
+    }
+    return lAncestors;
+}
+
+QUdevLibudevBackend::QUdevLibudevBackend()
+  : m_pUdev(0),
+    m_pMon(0)
+{
+    //create the udev object
+    m_pUdev = udev_new();
+    //set up a udev monitor object
+    m_pMon = udev_monitor_new_from_netlink(m_pUdev, "udev");
+
+    Q_ASSERT(m_pUdev);
+    Q_ASSERT(m_pMon);
+
+    //events are queued by the kernel from now on, even before the monitoring thread runs
+    udev_monitor_enable_receiving(m_pMon);
+}
+
+QUdevLibudevBackend::~QUdevLibudevBackend()
+{
+    //release the udev objects
+    if(m_pMon) udev_monitor_unref(m_pMon);
+    if(m_pUdev) udev_unref(m_pUdev);
+}
+
+int QUdevLibudevBackend::start()
+{
+    //libudev provides us with a non blocking file descriptor usable with poll()
+    return udev_monitor_get_fd(m_pMon);
+}
+
+bool QUdevLibudevBackend::receiveEvents(QUdevBackendReceiver *pReceiver)
+{
+    bool bOverflow = false;
+
+    //drain everything pending on the socket, the monitor returns 0 once it would block
+    forever
+    {
+        errno = 0;
+        struct udev_device* dev = udev_monitor_receive_device(m_pMon);
+        if(dev)
+        {
+            pReceiver->processEvent(QUdevLibudevEvent(dev));
+            udev_device_unref(dev);
+        }
+        //the kernel dropped messages because our receive buffer was full, keep on draining
+        else if(ENOBUFS == errno)
+        {
+            bOverflow = true;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return bOverflow;
+}
+
+void QUdevLibudevBackend::applyFilter(const QUdevBackendFilter &filter)
+{
+    //clear all filter from the monitor interface
+    udev_monitor_filter_remove(m_pMon);
+
+    for(int i = 0; i < filter.m_lMatches.size(); ++i)
+    {
+        const QByteArray &baDeviceType = filter.m_lMatches.at(i).second;
+        udev_monitor_filter_add_match_subsystem_devtype(m_pMon, filter.m_lMatches.at(i).first.constData(), baDeviceType.isEmpty() ? 0 : baDeviceType.constData());
+    }
+
+    foreach(const QByteArray &baTag, filter.m_lbaTags)
+    {
+        udev_monitor_filter_add_match_tag(m_pMon, baTag.constData());
+    }
+
+    //compile the matches into the BPF program of the monitor socket
+    if(udev_monitor_filter_update(m_pMon) < 0)
+    {
+        qWarning() << QString("QUdevLibudevBackend::applyFilter() could not update the socket filter");
+    }
+}
+
+bool QUdevLibudevBackend::setReceiveBufferSize(int iBytes)
+{
+    if(iBytes <= 0) return false;
+    return (0 == udev_monitor_set_receive_buffer_size(m_pMon, iBytes));
+}
@@ -0,0 +1,95 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVLIBUDEVBACKEND_PRIVATE_H
+#define QUDEVLIBUDEVBACKEND_PRIVATE_H
+
+#include <libudev.h>
+
+#include "QUdevBackend_private.h"
+
+/**
+ * QUdevBackendEvent view on a libudev device
+ */
+class QUdevLibudevEvent : public QUdevBackendEvent
+{
+    public:
+
+        /**
+         * Constructor, the device is not referenced and has to outlive the event
+         */
+        explicit QUdevLibudevEvent(struct udev_device *dev)
+          : m_pDev(dev)
+        {
+
+        }
+
+        virtual const char *getAction() const;
+        virtual const char *getSysPath() const;
+        virtual const char *getDevPath() const;
+        virtual const char *getSubsystem() const;
+        virtual const char *getDevType() const;
+        virtual const char *getDevNode() const;
+        virtual bool hasTag(const char *pcTag) const;
+        virtual const char *getPropertyValue(const char *pcKey) const;
+        virtual const char *getParentSysPath(const char *pcSubsystem, const char *pcDevType) const;
+        virtual void visitProperties(QUdevBackendPropertyVisitor &visitor) const;
+        virtual QList<QPair<QByteArray, QByteArray> > getProperties() const;
+        virtual QList<QByteArray> getTags() const;
+        virtual QList<QUdevBackendAncestor> getAncestors() const;
+
+    private:
+
+        struct udev_device *m_pDev;
+};
+
+/**
+ * The default backend reading the udev netlink socket through a libudev monitor
+ */
+class QUdevLibudevBackend : public QUdevBackend
+{
+    public:
+
+        /**
+         * Constructor, creates the udev monitor and starts receiving right away
+         */
+        QUdevLibudevBackend();
+
+        ~QUdevLibudevBackend();
+
+        virtual int start();
+        virtual bool receiveEvents(QUdevBackendReceiver *pReceiver);
+        virtual void applyFilter(const QUdevBackendFilter &filter);
+        virtual bool setReceiveBufferSize(int iBytes);
+
+    private:
+
+        Q_DISABLE_COPY(QUdevLibudevBackend);
+
+        /**
+         * Handle to the udev library
+         */
+        struct udev *m_pUdev;
+
+        /**
+         * Handle to the udev monitor interface
+         */
+        struct udev_monitor* m_pMon;
+};
+
+#endif // QUDEVLIBUDEVBACKEND_PRIVATE_H
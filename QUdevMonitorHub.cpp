@@ -0,0 +1,378 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QUdevMonitorHub_private.h"
+#include "QUdevLibudevBackend_private.h"
+#include "QUdev_private.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/**
+ * Protects s_hHubs and the reference counts of all hubs
+ */
+static QMutex s_HubsMutex;
+
+/**
+ * All hubs by their monitor group
+ */
+static QHash<QString, QUdevMonitorHub*> s_hHubs;
+
+/**
+ * Backends installed for groups without a hub (protected by s_HubsMutex)
+ */
+static QHash<QString, QUdevBackend*> s_hInstalledBackends;
+
+QUdevMonitorHub *QUdevMonitorHub::acquire(const QString &strGroup)
+{
+    QMutexLocker l(&s_HubsMutex);
+
+    QUdevMonitorHub *pHub = s_hHubs.value(strGroup);
+    if(0 == pHub)
+    {
+        QUdevBackend *pBackend = s_hInstalledBackends.take(strGroup);
+        if(0 == pBackend) pBackend = new QUdevLibudevBackend;
+
+        pHub = new QUdevMonitorHub(strGroup, pBackend);
+        s_hHubs.insert(strGroup, pHub);
+    }
+    ++pHub->m_iRefCount;
+
+    Q_UNUSED(l);
+    return pHub;
+}
+
+void QUdevMonitorHub::release(QUdevMonitorHub *pHub)
+{
+    if(0 == pHub) return;
+
+    {
+        QMutexLocker l(&s_HubsMutex);
+        if(--pHub->m_iRefCount > 0) return;
+        s_hHubs.remove(pHub->m_strGroup);
+        Q_UNUSED(l);
+    }
+
+    //nobody can find the hub anymore, stop it outside of the lock
+    delete pHub;
+}
+
+bool QUdevMonitorHub::installBackend(const QString &strGroup, QUdevBackend *pBackend)
+{
+    QMutexLocker l(&s_HubsMutex);
+    Q_UNUSED(l);
+
+    if(0 == pBackend || s_hHubs.contains(strGroup) || s_hInstalledBackends.contains(strGroup)) return false;
+
+    s_hInstalledBackends.insert(strGroup, pBackend);
+    return true;
+}
+
+QUdevMonitorHub::QUdevMonitorHub(const QString &strGroup, QUdevBackend *pBackend)
+  : m_strGroup(strGroup),
+    m_iRefCount(0),
+    m_pBackend(pBackend),
+    m_iWakeupFd(-1),
+    m_pActiveClient(0),
+    m_bClientsChanged(false),
+    m_iStop(0)
+{
+    //the monitoring thread sleeps in poll() and is woken up through this descriptor
+    m_iWakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    Q_ASSERT(m_iWakeupFd >= 0);
+}
+
+QUdevMonitorHub::~QUdevMonitorHub()
+{
+    //stop the monitoring thread and wait for it
+    m_iStop.fetchAndStoreOrdered(1);
+    if(m_iWakeupFd >= 0) eventfd_write(m_iWakeupFd, 1);
+    wait();
+
+    if(m_iWakeupFd >= 0) close(m_iWakeupFd);
+
+    delete m_pBackend;
+}
+
+void QUdevMonitorHub::attach(QUdevPrivate *pClient)
+{
+    QMutexLocker l(&m_ClientsMutex);
+    m_lClients.append(pClient);
+    m_bClientsChanged = true;
+    Q_UNUSED(l);
+}
+
+void QUdevMonitorHub::detach(QUdevPrivate *pClient)
+{
+    {
+        QMutexLocker l(&m_ClientsMutex);
+        if(false == m_lClients.removeOne(pClient)) return;
+        m_bClientsChanged = true;
+
+        //a slot connected directly would free the instance (or, being the last one, this hub) while the monitoring thread still uses it
+        if(QThread::currentThread() == this)
+        {
+            qFatal("QUdevMonitorHub::detach() QUdev instance destroyed by the monitoring thread, use deleteLater() in slots connected directly");
+        }
+
+        //the monitoring thread does not start new calls on the instance anymore, wait for the current one
+        while(m_pActiveClient == pClient) m_ClientIdle.wait(&m_ClientsMutex);
+        Q_UNUSED(l);
+    }
+
+    //rebuild the backend filter without the rules of the instance
+    wakeup(false);
+}
+
+void QUdevMonitorHub::wakeup(bool bStart)
+{
+    if(m_iWakeupFd >= 0) eventfd_write(m_iWakeupFd, 1);
+
+    if(bStart)
+    {
+        QMutexLocker l(&m_StartMutex);
+        if(false == isRunning()) start();
+        Q_UNUSED(l);
+    }
+}
+
+bool QUdevMonitorHub::setReceiveBufferSize(int iBytes)
+{
+    return m_pBackend->setReceiveBufferSize(iBytes);
+}
+
+void QUdevMonitorHub::run()
+{
+    qDebug() << QString("QUdevMonitorHub::run() monitoring thread of group '%1' started").arg(m_strGroup);
+
+    struct pollfd fds[2];
+
+    //the backend provides us with a non blocking file descriptor usable with poll()
+    fds[0].fd = m_pBackend->start();
+    fds[0].events = POLLIN;
+    //used to interrupt the poll() call on configuration changes and shutdown
+    fds[1].fd = m_iWakeupFd;
+    fds[1].events = POLLIN;
+
+    //take over the configurations published before the thread was started
+    {
+        QMutexLocker l(&m_ClientsMutex);
+        adoptClientConfigs();
+        Q_UNUSED(l);
+    }
+
+    while(0 == m_iStop.fetchAndAddAcquire(0))
+    {
+        fds[0].revents = 0;
+        fds[1].revents = 0;
+
+        int iTimeout;
+        {
+            QMutexLocker l(&m_ClientsMutex);
+            iTimeout = getPollTimeout();
+            Q_UNUSED(l);
+        }
+
+        //sleep until the kernel has something for us, a pending batch is due or we are woken up
+        int ret = poll(fds, 2, iTimeout);
+
+        if(ret < 0)
+        {
+            if(EINTR == errno) continue;
+            qWarning() << QString("QUdevMonitorHub::run() poll() failed: %1").arg(QString::fromLatin1(strerror(errno)));
+            break;
+        }
+
+        if(fds[1].revents & POLLIN)
+        {
+            //reset the eventfd counter
+            eventfd_t value;
+            eventfd_read(m_iWakeupFd, &value);
+
+            //rules or settings changed, instances came or went (or we are asked to stop)
+            if(0 != m_iStop.fetchAndAddAcquire(0)) break;
+
+            QMutexLocker l(&m_ClientsMutex);
+            adoptClientConfigs();
+            Q_UNUSED(l);
+        }
+
+        //the instances are called without the lock, each call checks that the instance is still attached
+        QList<QUdevPrivate*> lClients;
+        {
+            QMutexLocker l(&m_ClientsMutex);
+            lClients = m_lClients;
+            Q_UNUSED(l);
+        }
+
+        if(fds[0].revents & (POLLIN | POLLERR))
+        {
+            //drain everything pending, the events are handed over through processEvent()
+            m_lDispatchClients = lClients;
+            bool bOverflow = m_pBackend->receiveEvents(this);
+            m_lDispatchClients.clear();
+
+            if(bOverflow)
+            {
+                foreach(QUdevPrivate *pClient, lClients)
+                {
+                    if(false == beginClientCall(pClient)) continue;
+                    pClient->handleOverflow();
+                    endClientCall();
+                }
+            }
+        }
+
+        //deliver the coalesced events and pending batches whose window is exhausted
+        foreach(QUdevPrivate *pClient, lClients)
+        {
+            if(false == beginClientCall(pClient)) continue;
+            pClient->processDueEvents();
+            endClientCall();
+        }
+    }
+
+    //do not lose events still waiting for their batch window
+    QList<QUdevPrivate*> lClients;
+    {
+        QMutexLocker l(&m_ClientsMutex);
+        lClients = m_lClients;
+        Q_UNUSED(l);
+    }
+
+    foreach(QUdevPrivate *pClient, lClients)
+    {
+        if(false == beginClientCall(pClient)) continue;
+        pClient->flushAllEvents();
+        endClientCall();
+    }
+
+    qDebug() << QString("QUdevMonitorHub::run() monitoring thread of group '%1' stopped").arg(m_strGroup);
+}
+
+void QUdevMonitorHub::processEvent(const QUdevBackendEvent &ev)
+{
+    //each instance drops the event cheaply if none of its rules can match
+    foreach(QUdevPrivate *pClient, m_lDispatchClients)
+    {
+        if(false == beginClientCall(pClient)) continue;
+        pClient->processUdevDevice(ev);
+        endClientCall();
+    }
+}
+
+bool QUdevMonitorHub::beginClientCall(QUdevPrivate *pClient)
+{
+    QMutexLocker l(&m_ClientsMutex);
+    if(false == m_lClients.contains(pClient)) return false;
+    m_pActiveClient = pClient;
+    Q_UNUSED(l);
+    return true;
+}
+
+void QUdevMonitorHub::endClientCall()
+{
+    QMutexLocker l(&m_ClientsMutex);
+    m_pActiveClient = 0;
+    m_ClientIdle.wakeAll();
+    Q_UNUSED(l);
+}
+
+void QUdevMonitorHub::adoptClientConfigs()
+{
+    bool bFilterChanged = m_bClientsChanged;
+    m_bClientsChanged = false;
+
+    foreach(QUdevPrivate *pClient, m_lClients)
+    {
+        bFilterChanged |= pClient->adoptPendingConfig();
+    }
+
+    //the backend filter only has to be rebuilt if the rules changed
+    if(false == bFilterChanged) return;
+
+    applyMonitorFilter();
+
+    //registry seeds may be waiting for the filter
+    foreach(QUdevPrivate *pClient, m_lClients)
+    {
+        pClient->notifyFilterApplied();
+    }
+}
+
+void QUdevMonitorHub::applyMonitorFilter()
+{
+    QUdevBackendFilter filter;
+
+    /*
+     * The backend filter requires one of the subsystem/devtype matches AND one of the tag matches,
+     * so tags can only be pushed into the backend if every rule of every instance requires at least one tag.
+     * Any single tag of a rule is sufficient as its other tags are checked again in userspace.
+     */
+    bool bTagFilter = true;
+    bool bAnyMatch = false;
+
+    foreach(const QUdevPrivate *pClient, m_lClients)
+    {
+        const QUdevPrivate::QUdevMonitorConfig *pConfig = pClient->m_pActiveConfig;
+
+        foreach(const QUdevPrivate::QUdevInternalWatcherEntry &iwe, pConfig->m_lRules)
+        {
+            filter.m_lMatches.append(qMakePair(iwe.m_strSubsystem.toLatin1(), iwe.m_strDeviceType.toLatin1()));
+
+            bTagFilter &= (false == iwe.m_lbaTags.isEmpty());
+            bAnyMatch = true;
+        }
+
+        //the registry needs all devices of its subsystems
+        foreach(const QString &strSubsystem, pConfig->m_lRegistrySubsystems)
+        {
+            filter.m_lMatches.append(qMakePair(strSubsystem.toLatin1(), QByteArray()));
+            bTagFilter = false;
+            bAnyMatch = true;
+        }
+    }
+
+    if(bTagFilter && bAnyMatch)
+    {
+        foreach(const QUdevPrivate *pClient, m_lClients)
+        {
+            foreach(const QUdevPrivate::QUdevInternalWatcherEntry &iwe, pClient->m_pActiveConfig->m_lRules)
+            {
+                filter.m_lbaTags.append(iwe.m_lbaTags.first());
+            }
+        }
+    }
+
+    m_pBackend->applyFilter(filter);
+}
+
+int QUdevMonitorHub::getPollTimeout()
+{
+    //the first due event or batch of any instance determines the timeout, -1 waits forever
+    int iTimeout = -1;
+    foreach(QUdevPrivate *pClient, m_lClients)
+    {
+        int iClientTimeout = pClient->getNextTimeout();
+        if(iClientTimeout >= 0 && (iTimeout < 0 || iClientTimeout < iTimeout)) iTimeout = iClientTimeout;
+    }
+    return iTimeout;
+}
@@ -0,0 +1,203 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVMONITORHUB_PRIVATE_H
+#define QUDEVMONITORHUB_PRIVATE_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "QUdevBackend_private.h"
+
+class QUdevPrivate;
+
+/**
+ * One event backend and monitoring thread shared by several QUdev instances
+ *
+ * All QUdev instances of the same monitor group share one hub. The backend filter of the hub holds the union
+ * of the rules of all attached instances, every received event is handed to the attached instances and
+ * only the instances with a matching rule emit it.
+ *
+ * Hubs are reference counted, the last release() stops the monitoring thread and deletes the backend.
+ */
+class QUdevMonitorHub : public QThread, private QUdevBackendReceiver
+{
+    public:
+
+        /**
+         * Get the hub of the given monitor group, creating it if needed
+         */
+        static QUdevMonitorHub *acquire(const QString &strGroup);
+
+        /**
+         * Drop a reference taken with acquire(), the last one deletes the hub
+         */
+        static void release(QUdevMonitorHub *pHub);
+
+        /**
+         * Use the given backend instead of libudev for the monitor group
+         *
+         * Has to be called before the group is used by any QUdev instance, the hub created next for the group takes ownership
+         * of the backend.
+         *
+         * @return False if the group is already in use or another backend is installed for it, the caller keeps the ownership then
+         */
+        static bool installBackend(const QString &strGroup, QUdevBackend *pBackend);
+
+        /**
+         * Start handing events to the given instance
+         */
+        void attach(QUdevPrivate *pClient);
+
+        /**
+         * Stop handing events to the given instance, it is not called by the monitoring thread anymore afterwards
+         *
+         * Waits for a call the monitoring thread is making on the instance right now, the event queues of the instance
+         * have to be closed before so a blocked delivery returns. Events still waiting for their coalescing window or batch
+         * are discarded. Must not be called by the monitoring thread, i.e. instances must not be destroyed by slots connected directly.
+         */
+        void detach(QUdevPrivate *pClient);
+
+        /**
+         * Tell the monitoring thread that an instance published a new configuration
+         *
+         * @param bStart Start the monitoring thread if it is not running yet
+         */
+        void wakeup(bool bStart);
+
+        /**
+         * Set the size of the receive buffer of the backend
+         */
+        bool setReceiveBufferSize(int iBytes);
+
+    private:
+
+        Q_DISABLE_COPY(QUdevMonitorHub);
+
+        /**
+         * Constructor, takes ownership of the backend
+         */
+        QUdevMonitorHub(const QString &strGroup, QUdevBackend *pBackend);
+
+        /**
+         * Destructor, stops the monitoring thread and deletes the backend
+         */
+        ~QUdevMonitorHub();
+
+        virtual void run();
+
+        /**
+         * Hand an event received by the backend to the attached instances (monitoring thread only)
+         */
+        virtual void processEvent(const QUdevBackendEvent &ev);
+
+        /**
+         * Let all attached instances take over their latest configuration and rebuild the backend filter if needed
+         * (monitoring thread only, m_ClientsMutex must be held)
+         */
+        void adoptClientConfigs();
+
+        /**
+         * Rebuild the backend filter from the rules of all attached instances (monitoring thread only, m_ClientsMutex must be held)
+         */
+        void applyMonitorFilter();
+
+        /**
+         * Get the poll() timeout until the first coalesced event or pending batch of an instance is due (m_ClientsMutex must be held)
+         */
+        int getPollTimeout();
+
+        /**
+         * Mark the instance as being called by the monitoring thread (monitoring thread only)
+         *
+         * @return False if the instance was detached meanwhile, it must not be called then
+         */
+        bool beginClientCall(QUdevPrivate *pClient);
+
+        /**
+         * Finish a call started with beginClientCall() and wake up a detach() waiting for it (monitoring thread only)
+         */
+        void endClientCall();
+
+        /**
+         * Name of the monitor group
+         */
+        QString m_strGroup;
+
+        /**
+         * Number of acquire() calls not yet released (protected by the global hub mutex)
+         */
+        int m_iRefCount;
+
+        /**
+         * Source of the events
+         */
+        QUdevBackend *m_pBackend;
+
+        /**
+         * eventfd used to wake up the monitoring thread
+         */
+        int m_iWakeupFd;
+
+        /**
+         * Protects the list of attached instances
+         *
+         * Never held while the instances are called, a delivery blocked by a full event queue must not stall attach() and detach().
+         */
+        QMutex m_ClientsMutex;
+
+        /**
+         * The instance the monitoring thread is calling right now or 0 (protected by m_ClientsMutex)
+         */
+        QUdevPrivate *m_pActiveClient;
+
+        /**
+         * Signaled when the monitoring thread finished a call on an instance
+         */
+        QWaitCondition m_ClientIdle;
+
+        /**
+         * The attached instances (protected by m_ClientsMutex)
+         */
+        QList<QUdevPrivate*> m_lClients;
+
+        /**
+         * Snapshot of m_lClients the events of the current receiveEvents() call are handed to (monitoring thread only)
+         *
+         * Instances may be attached or detached while we iterate.
+         */
+        QList<QUdevPrivate*> m_lDispatchClients;
+
+        /**
+         * Instances were attached or detached, the backend filter has to be rebuilt (protected by m_ClientsMutex)
+         */
+        bool m_bClientsChanged;
+
+        /**
+         * Serializes starting the monitoring thread
+         */
+        QMutex m_StartMutex;
+
+        /**
+         * Set to ask the monitoring thread to stop
+         */
+        QAtomicInt m_iStop;
+};
+
+#endif // QUDEVMONITORHUB_PRIVATE_H
@@ -0,0 +1,446 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QUdevNetlinkBackend_private.h"
+
+#include <QDebug>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * The kernel multicast group of NETLINK_KOBJECT_UEVENT (libudev uses group 2 for the events processed by udevd)
+ */
+static const unsigned int s_iKernelGroup = 1;
+
+/**
+ * Read the subsystem of a sysfs device directory from its subsystem link
+ *
+ * @return False if the directory has no subsystem
+ */
+static bool readSysfsSubsystem(const char *pcDir, char *pcSubsystem, int iSize)
+{
+    char acPath[PATH_MAX];
+    char acTarget[PATH_MAX];
+    if(qsnprintf(acPath, sizeof(acPath), "%s/subsystem", pcDir) >= static_cast<int>(sizeof(acPath))) return false;
+
+    ssize_t iLength = readlink(acPath, acTarget, sizeof(acTarget) - 1);
+    if(iLength <= 0) return false;
+    acTarget[iLength] = '\0';
+
+    //the subsystem is the last component of the link target
+    const char *pcName = strrchr(acTarget, '/');
+    qstrncpy(pcSubsystem, pcName ? pcName + 1 : acTarget, iSize);
+    return true;
+}
+
+/**
+ * Read the devicetype of a sysfs device directory from its uevent file, empty if it has none
+ */
+static void readSysfsDevType(const char *pcDir, char *pcDevType, int iSize)
+{
+    pcDevType[0] = '\0';
+
+    char acPath[PATH_MAX];
+    if(qsnprintf(acPath, sizeof(acPath), "%s/uevent", pcDir) >= static_cast<int>(sizeof(acPath))) return;
+
+    int iFd = open(acPath, O_RDONLY | O_CLOEXEC);
+    if(iFd < 0) return;
+
+    char acUevent[4096];
+    ssize_t iLength = read(iFd, acUevent, sizeof(acUevent) - 1);
+    close(iFd);
+    if(iLength <= 0) return;
+    acUevent[iLength] = '\0';
+
+    //one KEY=VALUE per line
+    for(char *pcLine = acUevent; pcLine && *pcLine; )
+    {
+        char *pcNext = strchr(pcLine, '\n');
+        if(pcNext) *pcNext++ = '\0';
+
+        if(0 == strncmp(pcLine, "DEVTYPE=", 8))
+        {
+            qstrncpy(pcDevType, pcLine + 8, iSize);
+            return;
+        }
+        pcLine = pcNext;
+    }
+}
+
+/**
+ * Cut the last component off a sysfs path, false once the path left the device tree
+ */
+static bool cutToParent(char *pcPath)
+{
+    char *pcSlash = strrchr(pcPath, '/');
+    if(0 == pcSlash) return false;
+    *pcSlash = '\0';
+
+    //"/sys/devices" itself is no device
+    return (qstrlen(pcPath) > qstrlen("/sys/devices")) && (0 == strncmp(pcPath, "/sys/devices/", 13));
+}
+
+QUdevNetlinkBackend::QUdevNetlinkEvent::QUdevNetlinkEvent()
+  : m_pcAction(0),
+    m_pcDevPath(0),
+    m_pcSubsystem(0),
+    m_pcDevType(0)
+{
+    m_acSysPath[0] = '\0';
+    m_acDevNode[0] = '\0';
+    m_acParentPath[0] = '\0';
+}
+
+bool QUdevNetlinkBackend::QUdevNetlinkEvent::parse(const char *pcPayload, const char *pcEnd)
+{
+    m_pcAction = 0;
+    m_pcDevPath = 0;
+    m_pcSubsystem = 0;
+    m_pcDevType = 0;
+    m_vProperties.clear();
+
+    const char *pcDevName = 0;
+
+    //the buffer is NUL terminated behind the payload, so qstrlen() cannot run past it
+    for(const char *pcString = pcPayload; pcString < pcEnd; pcString += qstrlen(pcString) + 1)
+    {
+        const char *pcValue = strchr(pcString, '=');
+        if(0 == pcValue) continue;
+        ++pcValue;
+
+        m_vProperties.append(pcString);
+
+        //the fields needed for every message are picked up on the way
+        if(0 == strncmp(pcString, "ACTION=", 7)) m_pcAction = pcValue;
+        else if(0 == strncmp(pcString, "DEVPATH=", 8)) m_pcDevPath = pcValue;
+        else if(0 == strncmp(pcString, "SUBSYSTEM=", 10)) m_pcSubsystem = pcValue;
+        else if(0 == strncmp(pcString, "DEVTYPE=", 8)) m_pcDevType = pcValue;
+        else if(0 == strncmp(pcString, "DEVNAME=", 8)) pcDevName = pcValue;
+    }
+
+    if((0 == m_pcAction) || (0 == m_pcDevPath) || (0 == m_pcSubsystem)) return false;
+
+    if(qsnprintf(m_acSysPath, sizeof(m_acSysPath), "/sys%s", m_pcDevPath) >= static_cast<int>(sizeof(m_acSysPath))) return false;
+
+    //the kernel names the node relative to /dev
+    m_acDevNode[0] = '\0';
+    if(pcDevName) qsnprintf(m_acDevNode, sizeof(m_acDevNode), ('/' == pcDevName[0]) ? "%s" : "/dev/%s", pcDevName);
+
+    return true;
+}
+
+const char *QUdevNetlinkBackend::QUdevNetlinkEvent::getAction() const
+{
+    return m_pcAction;
+}
+
+const char *QUdevNetlinkBackend::QUdevNetlinkEvent::getSysPath() const
+{
+    return m_acSysPath;
+}
+
+const char *QUdevNetlinkBackend::QUdevNetlinkEvent::getDevPath() const
+{
+    return m_pcDevPath;
+}
+
+const char *QUdevNetlinkBackend::QUdevNetlinkEvent::getSubsystem() const
+{
+    return m_pcSubsystem;
+}
+
+const char *QUdevNetlinkBackend::QUdevNetlinkEvent::getDevType() const
+{
+    return m_pcDevType;
+}
+
+const char *QUdevNetlinkBackend::QUdevNetlinkEvent::getDevNode() const
+{
+    return ('\0' == m_acDevNode[0]) ? 0 : m_acDevNode;
+}
+
+bool QUdevNetlinkBackend::QUdevNetlinkEvent::hasTag(const char *pcTag) const
+{
+    //tags are assigned by udevd
+    Q_UNUSED(pcTag);
+    return false;
+}
+
+const char *QUdevNetlinkBackend::QUdevNetlinkEvent::getPropertyValue(const char *pcKey) const
+{
+    int iKeyLength = qstrlen(pcKey);
+    for(int i = 0; i < m_vProperties.size(); ++i)
+    {
+        const char *pcProperty = m_vProperties.at(i);
+        if((0 == strncmp(pcProperty, pcKey, iKeyLength)) && ('=' == pcProperty[iKeyLength])) return pcProperty + iKeyLength + 1;
+    }
+    return 0;
+}
+
+const char *QUdevNetlinkBackend::QUdevNetlinkEvent::getParentSysPath(const char *pcSubsystem, const char *pcDevType) const
+{
+    char acSubsystem[NAME_MAX + 1];
+    char acDevType[NAME_MAX + 1];
+
+    //walk up the device tree like libudev does
+    qstrncpy(m_acParentPath, m_acSysPath, sizeof(m_acParentPath));
+    while(cutToParent(m_acParentPath))
+    {
+        if(false == readSysfsSubsystem(m_acParentPath, acSubsystem, sizeof(acSubsystem))) continue;
+        if(0 != qstrcmp(acSubsystem, pcSubsystem)) continue;
+
+        if(pcDevType)
+        {
+            readSysfsDevType(m_acParentPath, acDevType, sizeof(acDevType));
+            if(0 != qstrcmp(acDevType, pcDevType)) continue;
+        }
+
+        return m_acParentPath;
+    }
+    return 0;
+}
+
+void QUdevNetlinkBackend::QUdevNetlinkEvent::visitProperties(QUdevBackendPropertyVisitor &visitor) const
+{
+    //the properties are KEY=value strings inside the receive buffer
+    for(int i = 0; i < m_vProperties.size(); ++i)
+    {
+        const char *pcProperty = m_vProperties.at(i);
+        const char *pcValue = strchr(pcProperty, '=');
+        visitor.visitProperty(pcProperty, static_cast<int>(pcValue - pcProperty), pcValue + 1);
+    }
+}
+
+QList<QPair<QByteArray, QByteArray> > QUdevNetlinkBackend::QUdevNetlinkEvent::getProperties() const
+{
+    QList<QPair<QByteArray, QByteArray> > lProperties;
+    for(int i = 0; i < m_vProperties.size(); ++i)
+    {
+        const char *pcProperty = m_vProperties.at(i);
+        const char *pcValue = strchr(pcProperty, '=');
+        lProperties.append(qMakePair(QByteArray(pcProperty, pcValue - pcProperty), QByteArray(pcValue + 1)));
+    }
+    return lProperties;
+}
+
+QList<QByteArray> QUdevNetlinkBackend::QUdevNetlinkEvent::getTags() const
+{
+    return QList<QByteArray>();
+}
+
+QList<QUdevBackendAncestor> QUdevNetlinkBackend::QUdevNetlinkEvent::getAncestors() const
+{
+    QList<QUdevBackendAncestor> lAncestors;
+
+    char acPath[PATH_MAX];
+    char acSubsystem[NAME_MAX + 1];
+    char acDevType[NAME_MAX + 1];
+
+    qstrncpy(acPath, m_acSysPath, sizeof(acPath));
+    while(cutToParent(acPath))
+    {
+        //only directories with a uevent file are devices
+        char acUevent[PATH_MAX];
+        if(qsnprintf(acUevent, sizeof(acUevent), "%s/uevent", acPath) >= static_cast<int>(sizeof(acUevent))) continue;
+        if(0 != access(acUevent, F_OK)) continue;
+
+        if(false == readSysfsSubsystem(acPath, acSubsystem, sizeof(acSubsystem))) acSubsystem[0] = '\0';
+        readSysfsDevType(acPath, acDevType, sizeof(acDevType));
+
+        QUdevBackendAncestor ancestor;
+        ancestor.m_baSysPath = QByteArray(acPath);
+        ancestor.m_baSubsystem = QByteArray(acSubsystem);
+        ancestor.m_baDevType = QByteArray(acDevType);
+        lAncestors.append(ancestor);
+    }
+    return lAncestors;
+}
+
+QUdevNetlinkBackend::QUdevNetlinkBackend()
+  : m_iSocket(-1),
+    m_iLastSeqnum(0),
+    m_bSeqnumGap(false),
+    m_bSeqnumComplete(false)
+{
+    m_iSocket = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if(m_iSocket < 0)
+    {
+        qWarning() << QString("QUdevNetlinkBackend::QUdevNetlinkBackend() could not open the uevent socket: %1").arg(QString::fromLatin1(strerror(errno)));
+        return;
+    }
+
+    //the credentials are needed to drop messages not sent by the kernel
+    int iPassCred = 1;
+    setsockopt(m_iSocket, SOL_SOCKET, SO_PASSCRED, &iPassCred, sizeof(iPassCred));
+
+    struct sockaddr_nl address;
+    memset(&address, 0, sizeof(address));
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = s_iKernelGroup;
+
+    //events are queued by the kernel from now on, even before the monitoring thread runs
+    if(bind(m_iSocket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) < 0)
+    {
+        qWarning() << QString("QUdevNetlinkBackend::QUdevNetlinkBackend() could not join the kernel uevent group: %1").arg(QString::fromLatin1(strerror(errno)));
+        close(m_iSocket);
+        m_iSocket = -1;
+        return;
+    }
+
+    //the buffers are allocated once and reused for every batch
+    m_baBuffers.resize(eBatchSize * (eMessageSize + 1));
+
+    memset(m_aMessages, 0, sizeof(m_aMessages));
+    for(int i = 0; i < eBatchSize; ++i)
+    {
+        m_aIov[i].iov_base = m_baBuffers.data() + i * (eMessageSize + 1);
+        m_aIov[i].iov_len = eMessageSize;
+
+        m_aMessages[i].msg_hdr.msg_iov = &m_aIov[i];
+        m_aMessages[i].msg_hdr.msg_iovlen = 1;
+        m_aMessages[i].msg_hdr.msg_name = &m_aSenders[i];
+        m_aMessages[i].msg_hdr.msg_control = m_aacControl[i];
+    }
+}
+
+QUdevNetlinkBackend::~QUdevNetlinkBackend()
+{
+    if(m_iSocket >= 0) close(m_iSocket);
+}
+
+int QUdevNetlinkBackend::start()
+{
+    return m_iSocket;
+}
+
+bool QUdevNetlinkBackend::receiveEvents(QUdevBackendReceiver *pReceiver)
+{
+    if(m_iSocket < 0) return false;
+
+    bool bOverflow = false;
+
+    //drain everything pending on the socket
+    forever
+    {
+        //recvmmsg() overwrites the lengths of the previous batch
+        for(int i = 0; i < eBatchSize; ++i)
+        {
+            m_aMessages[i].msg_hdr.msg_namelen = sizeof(m_aSenders[i]);
+            m_aMessages[i].msg_hdr.msg_controllen = sizeof(m_aacControl[i]);
+            m_aMessages[i].msg_hdr.msg_flags = 0;
+        }
+
+        int iReceived = recvmmsg(m_iSocket, m_aMessages, eBatchSize, MSG_DONTWAIT, 0);
+        if(iReceived < 0)
+        {
+            if(EINTR == errno) continue;
+            //the kernel dropped messages because our receive buffer was full, keep on draining
+            if(ENOBUFS == errno)
+            {
+                bOverflow = true;
+                continue;
+            }
+            break;
+        }
+
+        for(int i = 0; i < iReceived; ++i)
+        {
+            processMessage(i, pReceiver);
+        }
+
+        if(iReceived < eBatchSize) break;
+    }
+
+    //messages lost without ENOBUFS show up as skipped sequence numbers
+    if(m_bSeqnumGap)
+    {
+        bOverflow = true;
+        m_bSeqnumGap = false;
+    }
+
+    return bOverflow;
+}
+
+void QUdevNetlinkBackend::processMessage(int iMessage, QUdevBackendReceiver *pReceiver)
+{
+    const struct msghdr &header = m_aMessages[iMessage].msg_hdr;
+    unsigned int iLength = m_aMessages[iMessage].msg_len;
+
+    if(header.msg_flags & MSG_TRUNC) return;
+
+    //only the kernel itself may send uevents, anything else could be forged
+    if(m_aSenders[iMessage].nl_pid != 0) return;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    if((0 == cmsg) || (SCM_CREDENTIALS != cmsg->cmsg_type)) return;
+    const struct ucred *pCredentials = reinterpret_cast<const struct ucred*>(CMSG_DATA(cmsg));
+    if(0 != pCredentials->uid) return;
+
+    char *pcBuffer = static_cast<char*>(m_aIov[iMessage].iov_base);
+    pcBuffer[iLength] = '\0';
+
+    //the payload follows the "action@devpath" summary
+    int iSummary = qstrlen(pcBuffer);
+    if((0 == strchr(pcBuffer, '@')) || (static_cast<unsigned int>(iSummary) >= iLength)) return;
+
+    if(false == m_Event.parse(pcBuffer + iSummary + 1, pcBuffer + iLength)) return;
+
+    //network devices and their queues are the only uevents sent into other network namespaces as well
+    if((0 != qstrcmp(m_Event.getSubsystem(), "net")) && (0 != qstrcmp(m_Event.getSubsystem(), "queues"))) m_bSeqnumComplete = true;
+
+    //every uevent passes here before the filter, so each one has to follow its predecessor
+    const char *pcSeqnum = m_Event.getPropertyValue("SEQNUM");
+    if(pcSeqnum)
+    {
+        quint64 iSeqnum = strtoull(pcSeqnum, 0, 10);
+        if(m_bSeqnumComplete && (0 != m_iLastSeqnum) && (iSeqnum > m_iLastSeqnum + 1)) m_bSeqnumGap = true;
+        if(iSeqnum > m_iLastSeqnum) m_iLastSeqnum = iSeqnum;
+    }
+
+    //the filter is checked on the views, messages of other subsystems are dropped without any allocation
+    bool bPasses = m_Filter.m_lMatches.isEmpty();
+    for(int i = 0; (false == bPasses) && (i < m_Filter.m_lMatches.size()); ++i)
+    {
+        const QPair<QByteArray, QByteArray> &match = m_Filter.m_lMatches.at(i);
+        bPasses = (0 == qstrcmp(match.first.constData(), m_Event.getSubsystem())) &&
+                  (match.second.isEmpty() || (0 == qstrcmp(match.second.constData(), m_Event.getDevType())));
+    }
+
+    //kernel events carry no tags
+    if(false == m_Filter.m_lbaTags.isEmpty()) bPasses = false;
+
+    if(bPasses) pReceiver->processEvent(m_Event);
+}
+
+void QUdevNetlinkBackend::applyFilter(const QUdevBackendFilter &filter)
+{
+    m_Filter = filter;
+}
+
+bool QUdevNetlinkBackend::setReceiveBufferSize(int iBytes)
+{
+    if((iBytes <= 0) || (m_iSocket < 0)) return false;
+
+    //the forced variant ignores rmem_max but needs CAP_NET_ADMIN
+    if(0 == setsockopt(m_iSocket, SOL_SOCKET, SO_RCVBUFFORCE, &iBytes, sizeof(iBytes))) return true;
+    return (0 == setsockopt(m_iSocket, SOL_SOCKET, SO_RCVBUF, &iBytes, sizeof(iBytes)));
+}
@@ -0,0 +1,181 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVNETLINKBACKEND_PRIVATE_H
+#define QUDEVNETLINKBACKEND_PRIVATE_H
+
+#include <QVarLengthArray>
+
+#include <limits.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "QUdevBackend_private.h"
+
+/**
+ * Backend receiving the uevents of the kernel directly, without udevd and libudev
+ *
+ * The socket joins the kernel multicast group of NETLINK_KOBJECT_UEVENT, so it works in containers without udevd.
+ * Messages are received in batches with recvmmsg() into buffers allocated once, the KEY=VALUE payload is parsed
+ * in place and the backend filter is checked against these views, so messages not matching any rule never cause
+ * a heap allocation.
+ *
+ * Kernel events are sent before udev processed them: they carry no udev properties (ID_*, ...) and no tags,
+ * and the device node may not exist yet. Parent lookups read the subsystem links and uevent files of sysfs.
+ *
+ * The socket has no filter, every uevent reaches the backend, so a gap in the SEQNUM sequence means messages were lost
+ * and is reported as overflow like ENOBUFS. Inside a network namespace other than the initial one the kernel only sends
+ * the uevents of its network devices, so gaps are only trusted once a uevent of another subsystem proved that we see
+ * the complete sequence.
+ */
+class QUdevNetlinkBackend : public QUdevBackend
+{
+    public:
+
+        /**
+         * Constructor, opens the socket and starts receiving right away
+         */
+        QUdevNetlinkBackend();
+
+        ~QUdevNetlinkBackend();
+
+        virtual int start();
+        virtual bool receiveEvents(QUdevBackendReceiver *pReceiver);
+        virtual void applyFilter(const QUdevBackendFilter &filter);
+        virtual bool setReceiveBufferSize(int iBytes);
+
+    private:
+
+        Q_DISABLE_COPY(QUdevNetlinkBackend);
+
+        enum
+        {
+            /**
+             * Number of messages received by one recvmmsg() call
+             */
+            eBatchSize = 32,
+
+            /**
+             * Size of one receive buffer, the kernel limits uevents to 2048 bytes
+             */
+            eMessageSize = 8192
+        };
+
+        /**
+         * View on a received kernel message, all strings point into the receive buffer
+         */
+        class QUdevNetlinkEvent : public QUdevBackendEvent
+        {
+            public:
+
+                QUdevNetlinkEvent();
+
+                /**
+                 * Index the KEY=VALUE strings of a NUL terminated payload
+                 *
+                 * @return False if the message lacks ACTION, DEVPATH or SUBSYSTEM
+                 */
+                bool parse(const char *pcPayload, const char *pcEnd);
+
+                virtual const char *getAction() const;
+                virtual const char *getSysPath() const;
+                virtual const char *getDevPath() const;
+                virtual const char *getSubsystem() const;
+                virtual const char *getDevType() const;
+                virtual const char *getDevNode() const;
+                virtual bool hasTag(const char *pcTag) const;
+                virtual const char *getPropertyValue(const char *pcKey) const;
+                virtual const char *getParentSysPath(const char *pcSubsystem, const char *pcDevType) const;
+                virtual void visitProperties(QUdevBackendPropertyVisitor &visitor) const;
+                virtual QList<QPair<QByteArray, QByteArray> > getProperties() const;
+                virtual QList<QByteArray> getTags() const;
+                virtual QList<QUdevBackendAncestor> getAncestors() const;
+
+            private:
+
+                const char *m_pcAction;
+                const char *m_pcDevPath;
+                const char *m_pcSubsystem;
+                const char *m_pcDevType;
+
+                /**
+                 * All KEY=VALUE strings of the message
+                 */
+                QVarLengthArray<const char*, 64> m_vProperties;
+
+                /**
+                 * The sysfs path composed from DEVPATH
+                 */
+                char m_acSysPath[PATH_MAX];
+
+                /**
+                 * The device node composed from DEVNAME, empty without one
+                 */
+                char m_acDevNode[PATH_MAX];
+
+                /**
+                 * Result of the last getParentSysPath() call
+                 */
+                mutable char m_acParentPath[PATH_MAX];
+        };
+
+        /**
+         * Check the sender and the payload of a received message and hand it to the receiver if it passes the filter
+         */
+        void processMessage(int iMessage, QUdevBackendReceiver *pReceiver);
+
+        /**
+         * The netlink socket, -1 if it could not be opened
+         */
+        int m_iSocket;
+
+        /**
+         * SEQNUM of the last uevent received, 0 before the first one
+         */
+        quint64 m_iLastSeqnum;
+
+        /**
+         * Uevents were skipped since the last receiveEvents() call
+         */
+        bool m_bSeqnumGap;
+
+        /**
+         * A uevent not bound to a network namespace was received, so the socket sees all uevents
+         */
+        bool m_bSeqnumComplete;
+
+        QUdevBackendFilter m_Filter;
+
+        /**
+         * eBatchSize receive buffers of eMessageSize bytes plus a terminating NUL each
+         */
+        QByteArray m_baBuffers;
+
+        struct mmsghdr m_aMessages[eBatchSize];
+        struct iovec m_aIov[eBatchSize];
+        struct sockaddr_nl m_aSenders[eBatchSize];
+
+        /**
+         * Ancillary data holding the credentials of the senders
+         */
+        char m_aacControl[eBatchSize][CMSG_SPACE(sizeof(struct ucred))];
+
+        QUdevNetlinkEvent m_Event;
+};
+
+#endif // QUDEVNETLINKBACKEND_PRIVATE_H
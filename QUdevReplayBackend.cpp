@@ -0,0 +1,385 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QUdevReplayBackend_private.h"
+
+#include <QDebug>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+bool QUdevReplayBackend::QUdevReplayEvent::parse(const QUdevTraceRecordHeader *pHeader)
+{
+    m_pHeader = pHeader;
+    m_vStrings.clear();
+
+    if(pHeader->m_iFlags & eTraceOverflow) return true;
+
+    int iCount = s_iTraceFixedFields + pHeader->m_iTagCount + 2 * pHeader->m_iPropertyCount + 3 * pHeader->m_iAncestorCount;
+    const char *pcString = reinterpret_cast<const char*>(pHeader + 1);
+    const char *pcEnd = reinterpret_cast<const char*>(pHeader) + pHeader->m_iSize;
+
+    for(int i = 0; i < iCount; ++i)
+    {
+        //every string has to end inside the record
+        const char *pcNul = static_cast<const char*>(memchr(pcString, '\0', pcEnd - pcString));
+        if(0 == pcNul) return false;
+
+        m_vStrings.append(pcString);
+        pcString = pcNul + 1;
+    }
+
+    return true;
+}
+
+const char *QUdevReplayBackend::QUdevReplayEvent::getField(int iField) const
+{
+    const char *pcField = m_vStrings.at(iField);
+    return ('\0' == pcField[0]) ? 0 : pcField;
+}
+
+const char *QUdevReplayBackend::QUdevReplayEvent::getAction() const
+{
+    return getField(0);
+}
+
+const char *QUdevReplayBackend::QUdevReplayEvent::getSysPath() const
+{
+    return getField(1);
+}
+
+const char *QUdevReplayBackend::QUdevReplayEvent::getDevPath() const
+{
+    return getField(2);
+}
+
+const char *QUdevReplayBackend::QUdevReplayEvent::getSubsystem() const
+{
+    return getField(3);
+}
+
+const char *QUdevReplayBackend::QUdevReplayEvent::getDevType() const
+{
+    return getField(4);
+}
+
+const char *QUdevReplayBackend::QUdevReplayEvent::getDevNode() const
+{
+    return getField(5);
+}
+
+bool QUdevReplayBackend::QUdevReplayEvent::hasTag(const char *pcTag) const
+{
+    for(int i = 0; i < m_pHeader->m_iTagCount; ++i)
+    {
+        if(0 == qstrcmp(m_vStrings.at(s_iTraceFixedFields + i), pcTag)) return true;
+    }
+    return false;
+}
+
+const char *QUdevReplayBackend::QUdevReplayEvent::getPropertyValue(const char *pcKey) const
+{
+    int iBase = s_iTraceFixedFields + m_pHeader->m_iTagCount;
+    for(int i = 0; i < m_pHeader->m_iPropertyCount; ++i)
+    {
+        if(0 == qstrcmp(m_vStrings.at(iBase + 2 * i), pcKey)) return m_vStrings.at(iBase + 2 * i + 1);
+    }
+    return 0;
+}
+
+const char *QUdevReplayBackend::QUdevReplayEvent::getParentSysPath(const char *pcSubsystem, const char *pcDevType) const
+{
+    //the ancestors are recorded from the direct parent up to the root, like libudev walks them
+    int iBase = s_iTraceFixedFields + m_pHeader->m_iTagCount + 2 * m_pHeader->m_iPropertyCount;
+    for(int i = 0; i < m_pHeader->m_iAncestorCount; ++i)
+    {
+        const char *pcAncestorSysPath = m_vStrings.at(iBase + 3 * i);
+        if(0 != qstrcmp(m_vStrings.at(iBase + 3 * i + 1), pcSubsystem)) continue;
+        if(pcDevType && (0 != qstrcmp(m_vStrings.at(iBase + 3 * i + 2), pcDevType))) continue;
+        return pcAncestorSysPath;
+    }
+    return 0;
+}
+
+void QUdevReplayBackend::QUdevReplayEvent::visitProperties(QUdevBackendPropertyVisitor &visitor) const
+{
+    int iBase = s_iTraceFixedFields + m_pHeader->m_iTagCount;
+    for(int i = 0; i < m_pHeader->m_iPropertyCount; ++i)
+    {
+        const char *pcKey = m_vStrings.at(iBase + 2 * i);
+        visitor.visitProperty(pcKey, static_cast<int>(strlen(pcKey)), m_vStrings.at(iBase + 2 * i + 1));
+    }
+}
+
+QList<QPair<QByteArray, QByteArray> > QUdevReplayBackend::QUdevReplayEvent::getProperties() const
+{
+    QList<QPair<QByteArray, QByteArray> > lProperties;
+
+    int iBase = s_iTraceFixedFields + m_pHeader->m_iTagCount;
+    for(int i = 0; i < m_pHeader->m_iPropertyCount; ++i)
+    {
+        lProperties.append(qMakePair(QByteArray(m_vStrings.at(iBase + 2 * i)), QByteArray(m_vStrings.at(iBase + 2 * i + 1))));
+    }
+    return lProperties;
+}
+
+QList<QByteArray> QUdevReplayBackend::QUdevReplayEvent::getTags() const
+{
+    QList<QByteArray> lbaTags;
+    for(int i = 0; i < m_pHeader->m_iTagCount; ++i)
+    {
+        lbaTags.append(QByteArray(m_vStrings.at(s_iTraceFixedFields + i)));
+    }
+    return lbaTags;
+}
+
+QList<QUdevBackendAncestor> QUdevReplayBackend::QUdevReplayEvent::getAncestors() const
+{
+    QList<QUdevBackendAncestor> lAncestors;
+
+    int iBase = s_iTraceFixedFields + m_pHeader->m_iTagCount + 2 * m_pHeader->m_iPropertyCount;
+    for(int i = 0; i < m_pHeader->m_iAncestorCount; ++i)
+    {
+        QUdevBackendAncestor ancestor;
+        ancestor.m_baSysPath = QByteArray(m_vStrings.at(iBase + 3 * i));
+        ancestor.m_baSubsystem = QByteArray(m_vStrings.at(iBase + 3 * i + 1));
+        ancestor.m_baDevType = QByteArray(m_vStrings.at(iBase + 3 * i + 2));
+        lAncestors.append(ancestor);
+    }
+    return lAncestors;
+}
+
+QUdevReplayBackend::QUdevReplayBackend(const QString &strFile, bool bOriginalTiming, int iBurstSize /*= 256*/)
+  : m_File(strFile),
+    m_bOriginalTiming(bOriginalTiming),
+    m_iBurstSize(qMax(1, iBurstSize)),
+    m_pTrace(0),
+    m_iTraceSize(0),
+    m_iOffset(sizeof(QUdevTraceFileHeader)),
+    m_iFirstTimestamp(0),
+    m_iFd(-1),
+    m_iReplayed(0),
+    m_iReplayedCount(0),
+    m_iFinished(0)
+{
+    if(false == m_File.open(QIODevice::ReadOnly))
+    {
+        qWarning() << QString("QUdevReplayBackend::QUdevReplayBackend() could not open the trace file '%1': %2").arg(strFile).arg(m_File.errorString());
+        return;
+    }
+
+    m_iTraceSize = m_File.size();
+    if(m_iTraceSize >= static_cast<qint64>(sizeof(QUdevTraceFileHeader))) m_pTrace = m_File.map(0, m_iTraceSize);
+
+    const QUdevTraceFileHeader *pHeader = reinterpret_cast<const QUdevTraceFileHeader*>(m_pTrace);
+    if((0 == pHeader) || (0 != memcmp(pHeader->m_acMagic, s_acTraceMagic, sizeof(s_acTraceMagic))) ||
+       (s_iTraceVersion != pHeader->m_iVersion) || (0x01020304 != pHeader->m_iByteOrder))
+    {
+        qWarning() << QString("QUdevReplayBackend::QUdevReplayBackend() '%1' is no trace of this version and byte order").arg(strFile);
+        if(m_pTrace) m_File.unmap(const_cast<uchar*>(m_pTrace));
+        m_pTrace = 0;
+        return;
+    }
+
+    //the original timing is relative to the first record
+    if(m_iTraceSize >= m_iOffset + static_cast<qint64>(sizeof(QUdevTraceRecordHeader)))
+    {
+        m_iFirstTimestamp = reinterpret_cast<const QUdevTraceRecordHeader*>(m_pTrace + m_iOffset)->m_iTimestamp;
+    }
+}
+
+QUdevReplayBackend::~QUdevReplayBackend()
+{
+    if(m_iFd >= 0) close(m_iFd);
+    if(m_pTrace) m_File.unmap(const_cast<uchar*>(m_pTrace));
+}
+
+int QUdevReplayBackend::start()
+{
+    if(m_bOriginalTiming)
+    {
+        //armed for one record after the other
+        m_iFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    }
+    else
+    {
+        //the counter is never reset, so poll() returns right away until we are finished
+        m_iFd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    if(m_iFd < 0) qWarning() << QString("QUdevReplayBackend::start() could not create the descriptor: %1").arg(QString::fromLatin1(strerror(errno)));
+
+    m_tClock.start();
+
+    if((0 == m_pTrace) || (m_iOffset >= m_iTraceSize)) finish();
+    else if(m_bOriginalTiming) armTimer();
+
+    return m_iFd;
+}
+
+bool QUdevReplayBackend::receiveEvents(QUdevBackendReceiver *pReceiver)
+{
+    if(0 != m_iFinished.fetchAndAddRelaxed(0)) return false;
+
+    bool bOverflow = false;
+    qint64 iNow = 0;
+    int iBudget = m_iBurstSize;
+
+    if(m_bOriginalTiming)
+    {
+        //reset the expiration of the timer
+        uint64_t iExpirations;
+        ssize_t iRead = read(m_iFd, &iExpirations, sizeof(iExpirations));
+        Q_UNUSED(iRead);
+
+        //everything that is due is replayed
+        iNow = m_tClock.nsecsElapsed() / 1000;
+        iBudget = INT_MAX;
+    }
+
+    while((iBudget-- > 0) && (m_iOffset < m_iTraceSize))
+    {
+        const QUdevTraceRecordHeader *pHeader = reinterpret_cast<const QUdevTraceRecordHeader*>(m_pTrace + m_iOffset);
+
+        //a truncated trace (e.g. of a crashed recording) ends with the last complete record
+        qint64 iRemaining = m_iTraceSize - m_iOffset;
+        if((iRemaining < static_cast<qint64>(sizeof(QUdevTraceRecordHeader))) || (pHeader->m_iSize < sizeof(QUdevTraceRecordHeader)) ||
+           (pHeader->m_iSize > iRemaining) || (pHeader->m_iSize % 8))
+        {
+            m_iOffset = m_iTraceSize;
+            break;
+        }
+
+        if(m_bOriginalTiming && (pHeader->m_iTimestamp - m_iFirstTimestamp > iNow)) break;
+
+        m_iOffset += pHeader->m_iSize;
+        ++m_iReplayed;
+
+        if(pHeader->m_iFlags & eTraceOverflow)
+        {
+            bOverflow = true;
+            continue;
+        }
+
+        if(false == m_Event.parse(pHeader))
+        {
+            qWarning() << QString("QUdevReplayBackend::receiveEvents() malformed record, stopping the replay");
+            m_iOffset = m_iTraceSize;
+            break;
+        }
+
+        if(passesFilter(m_Event)) pReceiver->processEvent(m_Event);
+    }
+
+    m_iReplayedCount.fetchAndStoreRelease(m_iReplayed);
+
+    if(m_iOffset >= m_iTraceSize) finish();
+    else if(m_bOriginalTiming) armTimer();
+
+    return bOverflow;
+}
+
+void QUdevReplayBackend::applyFilter(const QUdevBackendFilter &filter)
+{
+    m_Filter = filter;
+}
+
+int QUdevReplayBackend::getGeneratedCount() const
+{
+    return m_iReplayedCount.fetchAndAddAcquire(0);
+}
+
+bool QUdevReplayBackend::isFinished() const
+{
+    return (0 != m_iFinished.fetchAndAddAcquire(0));
+}
+
+bool QUdevReplayBackend::passesFilter(const QUdevReplayEvent &ev) const
+{
+    //an empty filter passes everything, like the socket filter of libudev
+    bool bPasses = m_Filter.m_lMatches.isEmpty();
+    for(int i = 0; (false == bPasses) && (i < m_Filter.m_lMatches.size()); ++i)
+    {
+        const QPair<QByteArray, QByteArray> &match = m_Filter.m_lMatches.at(i);
+        bPasses = (0 == qstrcmp(match.first.constData(), ev.getSubsystem())) &&
+                  (match.second.isEmpty() || (0 == qstrcmp(match.second.constData(), ev.getDevType())));
+    }
+
+    if(bPasses && (false == m_Filter.m_lbaTags.isEmpty()))
+    {
+        bPasses = false;
+        foreach(const QByteArray &baTag, m_Filter.m_lbaTags)
+        {
+            bPasses |= ev.hasTag(baTag.constData());
+        }
+    }
+
+    return bPasses;
+}
+
+void QUdevReplayBackend::armTimer()
+{
+    const QUdevTraceRecordHeader *pHeader = reinterpret_cast<const QUdevTraceRecordHeader*>(m_pTrace + m_iOffset);
+
+    //a truncated header is dropped by the next receiveEvents() call
+    qint64 iDelay = 0;
+    if(m_iTraceSize - m_iOffset >= static_cast<qint64>(sizeof(QUdevTraceRecordHeader)))
+    {
+        iDelay = pHeader->m_iTimestamp - m_iFirstTimestamp - m_tClock.nsecsElapsed() / 1000;
+    }
+
+    //a zero value would disarm the timer
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if(iDelay > 0)
+    {
+        spec.it_value.tv_sec = iDelay / 1000000;
+        spec.it_value.tv_nsec = (iDelay % 1000000) * 1000;
+    }
+    else
+    {
+        spec.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(m_iFd, 0, &spec, 0);
+}
+
+void QUdevReplayBackend::finish()
+{
+    if(m_iFd >= 0)
+    {
+        if(m_bOriginalTiming)
+        {
+            //disarm the timer
+            struct itimerspec spec;
+            memset(&spec, 0, sizeof(spec));
+            timerfd_settime(m_iFd, 0, &spec, 0);
+        }
+
+        //reset a pending timer expiration or the eventfd counter
+        uint64_t iValue;
+        ssize_t iRead = read(m_iFd, &iValue, sizeof(iValue));
+        Q_UNUSED(iRead);
+    }
+
+    m_iFinished.fetchAndStoreRelease(1);
+}
@@ -0,0 +1,189 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVREPLAYBACKEND_PRIVATE_H
+#define QUDEVREPLAYBACKEND_PRIVATE_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QVarLengthArray>
+
+#include "QUdevBackend_private.h"
+#include "QUdevTrace_private.h"
+
+/**
+ * Backend replaying a trace recorded with QUdev::startRecording()
+ *
+ * The trace is mapped into memory and its records are handed to the normal matching and dispatch pipeline
+ * without copying. The backend filter is applied like the socket filter of libudev, recorded overflows are
+ * reported as lost events. Replayed devices read their attributes from the sysfs of this machine.
+ */
+class QUdevReplayBackend : public QUdevBackend
+{
+    public:
+
+        /**
+         * Constructor
+         *
+         * @param strFile The trace file
+         * @param bOriginalTiming True to replay the events with their recorded timing, false to replay them as fast as they are processed
+         * @param iBurstSize Maximum number of records replayed by one receiveEvents() call without original timing
+         */
+        QUdevReplayBackend(const QString &strFile, bool bOriginalTiming, int iBurstSize = 256);
+
+        ~QUdevReplayBackend();
+
+        virtual int start();
+        virtual bool receiveEvents(QUdevBackendReceiver *pReceiver);
+        virtual void applyFilter(const QUdevBackendFilter &filter);
+
+        /**
+         * Get the number of records replayed so far (including the ones dropped by the filter), usable from any thread
+         */
+        int getGeneratedCount() const;
+
+        /**
+         * Check if the complete trace was replayed (or it could not be read), usable from any thread
+         */
+        bool isFinished() const;
+
+    private:
+
+        Q_DISABLE_COPY(QUdevReplayBackend);
+
+        /**
+         * View on one record of the mapped trace
+         */
+        class QUdevReplayEvent : public QUdevBackendEvent
+        {
+            public:
+
+                QUdevReplayEvent()
+                  : m_pHeader(0)
+                {
+
+                }
+
+                /**
+                 * Index the strings of the record
+                 *
+                 * @return False if the record is malformed
+                 */
+                bool parse(const QUdevTraceRecordHeader *pHeader);
+
+                virtual const char *getAction() const;
+                virtual const char *getSysPath() const;
+                virtual const char *getDevPath() const;
+                virtual const char *getSubsystem() const;
+                virtual const char *getDevType() const;
+                virtual const char *getDevNode() const;
+                virtual bool hasTag(const char *pcTag) const;
+                virtual const char *getPropertyValue(const char *pcKey) const;
+                virtual const char *getParentSysPath(const char *pcSubsystem, const char *pcDevType) const;
+                virtual void visitProperties(QUdevBackendPropertyVisitor &visitor) const;
+                virtual QList<QPair<QByteArray, QByteArray> > getProperties() const;
+                virtual QList<QByteArray> getTags() const;
+                virtual QList<QUdevBackendAncestor> getAncestors() const;
+
+            private:
+
+                /**
+                 * Get one of the leading strings, 0 if it is empty
+                 */
+                const char *getField(int iField) const;
+
+                const QUdevTraceRecordHeader *m_pHeader;
+
+                /**
+                 * All strings of the record in their recorded order, pointing into the mapped trace
+                 */
+                QVarLengthArray<const char*, 128> m_vStrings;
+        };
+
+        /**
+         * Check if the event passes the current filter
+         */
+        bool passesFilter(const QUdevReplayEvent &ev) const;
+
+        /**
+         * Arm the timer for the next record (original timing only)
+         */
+        void armTimer();
+
+        /**
+         * Stop the descriptor from becoming readable again
+         */
+        void finish();
+
+        /**
+         * The trace file, mapped as long as the backend exists
+         */
+        QFile m_File;
+
+        bool m_bOriginalTiming;
+
+        int m_iBurstSize;
+
+        /**
+         * The mapped trace, 0 if it could not be mapped
+         */
+        const uchar *m_pTrace;
+
+        qint64 m_iTraceSize;
+
+        /**
+         * Offset of the next record
+         */
+        qint64 m_iOffset;
+
+        /**
+         * Timestamp of the first record, the replay starts with it
+         */
+        qint64 m_iFirstTimestamp;
+
+        QUdevBackendFilter m_Filter;
+
+        /**
+         * timerfd armed for the next record with original timing, an eventfd that stays readable otherwise
+         */
+        int m_iFd;
+
+        /**
+         * Time base of the original timing
+         */
+        QElapsedTimer m_tClock;
+
+        /**
+         * Number of replayed records (monitoring thread only)
+         */
+        int m_iReplayed;
+
+        /**
+         * m_iReplayed published for other threads
+         */
+        mutable QAtomicInt m_iReplayedCount;
+
+        /**
+         * Set once the complete trace was replayed
+         */
+        mutable QAtomicInt m_iFinished;
+
+        QUdevReplayEvent m_Event;
+};
+
+#endif // QUDEVREPLAYBACKEND_PRIVATE_H
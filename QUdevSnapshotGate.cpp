@@ -0,0 +1,117 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QUdevSnapshotGate_private.h"
+
+QUdevSnapshotGate::QUdevSnapshotGate()
+  : m_iState(eGateWaiting),
+    m_iSnapshotSeqnum(0),
+    m_bOverflow(false)
+{
+
+}
+
+QUdevSnapshotGate::QUdevGateState QUdevSnapshotGate::getState() const
+{
+    return static_cast<QUdevGateState>(m_iState.fetchAndAddAcquire(0));
+}
+
+bool QUdevSnapshotGate::isOpen() const
+{
+    return eGateOpen == getState();
+}
+
+void QUdevSnapshotGate::beginSnapshot()
+{
+    QMutexLocker l(&m_Mutex);
+    if(eGateWaiting == getState()) m_iState.fetchAndStoreRelease(eGateHolding);
+    Q_UNUSED(l);
+}
+
+bool QUdevSnapshotGate::release(const QHash<QString, QUdevDevice> &hSnapshot, quint64 iSnapshotSeqnum)
+{
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    if(eGateOpen == getState()) return false;
+
+    m_hSnapshot = hSnapshot;
+    m_iSnapshotSeqnum = iSnapshotSeqnum;
+    m_iState.fetchAndStoreRelease(eGateReleased);
+    return true;
+}
+
+bool QUdevSnapshotGate::hold(const QUdevEvent &e, qint64 iReceived, quint64 iSeqnum)
+{
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    QUdevGateState eState = getState();
+    if((eGateWaiting != eState) && (eGateHolding != eState)) return false;
+
+    QUdevHeldEvent held;
+    held.m_Event = e;
+    held.m_iReceived = iReceived;
+    held.m_iSeqnum = iSeqnum;
+    held.m_bDuringSnapshot = (eGateHolding == eState);
+    m_lHeld.append(held);
+    return true;
+}
+
+void QUdevSnapshotGate::markOverflow()
+{
+    QMutexLocker l(&m_Mutex);
+    if(eGateOpen != getState()) m_bOverflow = true;
+    Q_UNUSED(l);
+}
+
+bool QUdevSnapshotGate::open(QHash<QString, QUdevDevice> &hSnapshot, QList<QUdevEvent> &lHeld, QList<qint64> &lReceived, bool &bOverflow)
+{
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    if(eGateReleased != getState()) return false;
+
+    hSnapshot.swap(m_hSnapshot);
+    foreach(const QUdevHeldEvent &held, m_lHeld)
+    {
+        //the snapshot reflects every uevent up to its sequence number, only newer ones are replayed
+        bool bNewer = ((0 != m_iSnapshotSeqnum) && (0 != held.m_iSeqnum)) ? (held.m_iSeqnum > m_iSnapshotSeqnum) : held.m_bDuringSnapshot;
+        if(false == bNewer) continue;
+
+        lHeld.append(held.m_Event);
+        lReceived.append(held.m_iReceived);
+    }
+    m_lHeld.clear();
+    bOverflow = m_bOverflow;
+    m_iState.fetchAndStoreRelease(eGateOpen);
+    return true;
+}
+
+bool QUdevSnapshotGate::discard()
+{
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    bool bReleased = (eGateReleased == getState());
+
+    m_hSnapshot.clear();
+    m_lHeld.clear();
+    m_iState.fetchAndStoreRelease(eGateOpen);
+    return bReleased;
+}
@@ -0,0 +1,159 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVSNAPSHOTGATE_PRIVATE_H
+#define QUDEVSNAPSHOTGATE_PRIVATE_H
+
+#include <QSharedData>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QHash>
+#include <QList>
+
+#include "QUdevDeclarations.h"
+
+/**
+ * Holds back the events of a rule added with a snapshot until its caller got the enumerated devices
+ *
+ * The rule is active before the enumeration starts, its events are held from then on. Once the snapshot is handed over
+ * the monitoring thread replays the held events newer than the snapshot and opens the gate. An event is newer if its
+ * SEQNUM is above the kernel sequence number read before the enumeration, events without sequence number are newer if
+ * they were received after the enumeration started.
+ */
+class QUdevSnapshotGate : public QSharedData
+{
+    public:
+
+        enum QUdevGateState
+        {
+            /**
+             * The enumeration has not started yet, events are held
+             */
+            eGateWaiting,
+            /**
+             * The enumeration is running, events are held
+             */
+            eGateHolding,
+            /**
+             * The snapshot was handed over, the held events wait for the monitoring thread
+             */
+            eGateReleased,
+            /**
+             * All events pass
+             */
+            eGateOpen
+        };
+
+        QUdevSnapshotGate();
+
+        QUdevGateState getState() const;
+
+        bool isOpen() const;
+
+        /**
+         * Called right before the enumeration
+         */
+        void beginSnapshot();
+
+        /**
+         * Hand the enumerated devices over
+         *
+         * @param iSnapshotSeqnum The kernel sequence number read before the enumeration, 0 if unknown
+         *
+         * @return False if the gate was discarded meanwhile
+         */
+        bool release(const QHash<QString, QUdevDevice> &hSnapshot, quint64 iSnapshotSeqnum);
+
+        /**
+         * Hold an event received before the snapshot was handed over (monitoring thread)
+         *
+         * @param iSeqnum The SEQNUM of the event, 0 if unknown
+         *
+         * @return False if the snapshot was released meanwhile, the gate has to be opened first
+         */
+        bool hold(const QUdevEvent &e, qint64 iReceived, quint64 iSeqnum);
+
+        /**
+         * Remember that events may have been lost while the gate was not open (monitoring thread)
+         */
+        void markOverflow();
+
+        /**
+         * Open a released gate and take the snapshot and the held events newer than it (monitoring thread)
+         *
+         * @param bOverflow Set if events may have been lost while the gate was not open
+         *
+         * @return False if the gate was not released
+         */
+        bool open(QHash<QString, QUdevDevice> &hSnapshot, QList<QUdevEvent> &lHeld, QList<qint64> &lReceived, bool &bOverflow);
+
+        /**
+         * Open the gate without replaying anything, called when the rule is removed
+         *
+         * @return True if the gate was released but not opened yet
+         */
+        bool discard();
+
+    private:
+
+        Q_DISABLE_COPY(QUdevSnapshotGate);
+
+        /**
+         * An event held by the gate
+         */
+        struct QUdevHeldEvent
+        {
+            QUdevEvent m_Event;
+            qint64 m_iReceived;
+            quint64 m_iSeqnum;
+
+            /**
+             * Received after beginSnapshot(), decides for events without sequence number
+             */
+            bool m_bDuringSnapshot;
+        };
+
+        /**
+         * Changed with m_Mutex held, read without it
+         */
+        mutable QAtomicInt m_iState;
+
+        mutable QMutex m_Mutex;
+
+        /**
+         * Events received before the snapshot was handed over (protected by m_Mutex)
+         */
+        QList<QUdevHeldEvent> m_lHeld;
+
+        /**
+         * The enumerated devices keyed by sysfs path (protected by m_Mutex)
+         */
+        QHash<QString, QUdevDevice> m_hSnapshot;
+
+        /**
+         * The kernel sequence number read before the enumeration, 0 if unknown (protected by m_Mutex)
+         */
+        quint64 m_iSnapshotSeqnum;
+
+        /**
+         * Set if events may have been lost before the gate opened (protected by m_Mutex)
+         */
+        bool m_bOverflow;
+};
+
+#endif // QUDEVSNAPSHOTGATE_PRIVATE_H
@@ -0,0 +1,94 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QUdevStatistics_private.h"
+
+/**
+ * Names of the counters in the statistics map, indexed by QUdevCounter
+ */
+static const char * const s_apcCounterNames[eCntCount] =
+{
+    "received",
+    "matched",
+    "dropped",
+    "emitted",
+    "coalesced",
+    "ruleEvaluations",
+    "parentWalks",
+    "parentCacheHits",
+    "queueDropped",
+    "queueCoalesced",
+    "queueBlocked"
+};
+
+/**
+ * Names of the histograms in the statistics map, indexed by QUdevHistogram
+ */
+static const char * const s_apcHistogramNames[eHistCount] =
+{
+    "latencyUs",
+    "processingUs"
+};
+
+QUdevStatistics::QUdevStatistics()
+  : m_iQueueDepth(0)
+{
+
+}
+
+void QUdevStatistics::record(QUdevHistogram eHistogram, qint64 iMicroseconds)
+{
+    //find the first power of two above the value
+    int iBucket = 0;
+    while((iBucket < eBucketCount - 1) && (iMicroseconds >= (Q_INT64_C(1) << iBucket))) ++iBucket;
+
+    m_aiBuckets[eHistogram][iBucket].fetchAndAddRelaxed(1);
+}
+
+QVariantMap QUdevStatistics::toVariantMap() const
+{
+    QVariantMap mStatistics;
+
+    for(int i = 0; i < eCntCount; ++i)
+    {
+        mStatistics.insert(QString::fromLatin1(s_apcCounterNames[i]), m_aiCounters[i].fetchAndAddRelaxed(0));
+    }
+    mStatistics.insert(QString("queueDepth"), m_iQueueDepth.fetchAndAddRelaxed(0));
+
+    QVariantList lBounds;
+    for(int iBucket = 0; iBucket < eBucketCount; ++iBucket)
+    {
+        lBounds.append((iBucket < eBucketCount - 1) ? (Q_INT64_C(1) << iBucket) : Q_INT64_C(-1));
+    }
+
+    for(int i = 0; i < eHistCount; ++i)
+    {
+        QVariantList lCounts;
+        for(int iBucket = 0; iBucket < eBucketCount; ++iBucket)
+        {
+            lCounts.append(m_aiBuckets[i][iBucket].fetchAndAddRelaxed(0));
+        }
+
+        QVariantMap mHistogram;
+        mHistogram.insert(QString("boundsUs"), lBounds);
+        mHistogram.insert(QString("counts"), lCounts);
+        mStatistics.insert(QString::fromLatin1(s_apcHistogramNames[i]), mHistogram);
+    }
+
+    return mStatistics;
+}
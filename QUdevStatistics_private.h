@@ -0,0 +1,122 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVSTATISTICS_PRIVATE_H
+#define QUDEVSTATISTICS_PRIVATE_H
+
+#include <QAtomicInt>
+#include <QVariantMap>
+
+/**
+ * The event counters of QUdevStatistics
+ */
+enum QUdevCounter
+{
+    eCntReceived,
+    eCntMatched,
+    eCntDropped,
+    eCntEmitted,
+    eCntCoalesced,
+    eCntRuleEvaluations,
+    eCntParentWalks,
+    eCntParentCacheHits,
+    eCntQueueDropped,
+    eCntQueueCoalesced,
+    eCntQueueBlocked,
+
+    eCntCount
+};
+
+/**
+ * The histograms of QUdevStatistics, all values are in microseconds
+ */
+enum QUdevHistogram
+{
+    eHistLatency,
+    eHistProcessing,
+
+    eHistCount
+};
+
+/**
+ * Runtime statistics of one QUdev instance
+ *
+ * Written by the monitoring thread and read by any thread, all values are atomic.
+ * Histograms use power of two buckets: bucket i counts the values below 2^i microseconds, the last bucket all larger values.
+ */
+class QUdevStatistics
+{
+    public:
+
+        /**
+         * Number of buckets per histogram
+         */
+        enum { eBucketCount = 22 };
+
+        QUdevStatistics();
+
+        /**
+         * Increase a counter
+         */
+        void add(QUdevCounter eCounter, int iValue = 1)
+        {
+            m_aiCounters[eCounter].fetchAndAddRelaxed(iValue);
+        }
+
+        /**
+         * Get the current value of a counter
+         */
+        int get(QUdevCounter eCounter) const
+        {
+            return m_aiCounters[eCounter].fetchAndAddRelaxed(0);
+        }
+
+        /**
+         * Set the current queue depth
+         */
+        void setQueueDepth(int iDepth)
+        {
+            m_iQueueDepth.fetchAndStoreRelaxed(iDepth);
+        }
+
+        /**
+         * Add a value to a histogram
+         */
+        void record(QUdevHistogram eHistogram, qint64 iMicroseconds);
+
+        /**
+         * Get all counters and histograms
+         *
+         * Counters are stored with their name, the histograms as maps with the upper bucket bounds ("boundsUs", the last one is -1)
+         * and the number of values per bucket ("counts").
+         */
+        QVariantMap toVariantMap() const;
+
+    private:
+
+        Q_DISABLE_COPY(QUdevStatistics);
+
+        /**
+         * Mutable as reading an atomic value is done with fetchAndAddRelaxed(0)
+         */
+        mutable QAtomicInt m_aiCounters[eCntCount];
+        mutable QAtomicInt m_iQueueDepth;
+        mutable QAtomicInt m_aiBuckets[eHistCount][eBucketCount];
+};
+
+#endif // QUDEVSTATISTICS_PRIVATE_H
@@ -0,0 +1,207 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QUdevSubscription_private.h"
+#include "QUdev_private.h"
+
+#include <QCoreApplication>
+#include <QThread>
+
+/**
+ * The event type of QUdevSubscriptionEvent
+ */
+static const QEvent::Type s_eSubscriptionEventType = static_cast<QEvent::Type>(QEvent::registerEventType());
+
+bool QUdevSubscriptionReceiver::event(QEvent *pEvent)
+{
+    if(pEvent->type() != QUdevSubscriptionEvent::getType()) return QObject::event(pEvent);
+
+    QUdevSubscriptionEvent *pSubscriptionEvent = static_cast<QUdevSubscriptionEvent*>(pEvent);
+    if(pSubscriptionEvent->m_bDrainQueue) pSubscriptionEvent->m_pSubscription->drainQueue();
+    else pSubscriptionEvent->m_pSubscription->deliverNow(pSubscriptionEvent->m_Event);
+    return true;
+}
+
+QUdevSubscriptionEvent::QUdevSubscriptionEvent(QUdevSubscriptionData *pSubscription, const QUdevEvent &e)
+  : QEvent(getType()),
+    m_pSubscription(pSubscription),
+    m_Event(e),
+    m_bDrainQueue(false)
+{
+
+}
+
+QUdevSubscriptionEvent::QUdevSubscriptionEvent(QUdevSubscriptionData *pSubscription)
+  : QEvent(getType()),
+    m_pSubscription(pSubscription),
+    m_bDrainQueue(true)
+{
+
+}
+
+QEvent::Type QUdevSubscriptionEvent::getType()
+{
+    return s_eSubscriptionEventType;
+}
+
+QUdevSubscriptionData::QUdevSubscriptionData(QUdevPrivate *pOwner, QUdevSubscriber *pSubscriber, QUdevDeliveryMode eMode, QThread *pTargetThread,
+                                             QUdevEventQueue *pQueue)
+  : m_Mutex(QMutex::Recursive),
+    m_pSubscriber(pSubscriber),
+    m_pOwner(pOwner),
+    m_eMode(eMode),
+    m_pReceiver(0),
+    m_pQueue(pQueue)
+{
+    if(eDeliverQueued == m_eMode)
+    {
+        m_pReceiver = new QUdevSubscriptionReceiver;
+        if(pTargetThread) m_pReceiver->moveToThread(pTargetThread);
+    }
+}
+
+QUdevSubscriptionData::~QUdevSubscriptionData()
+{
+    //the receiver belongs to the target thread
+    if(m_pReceiver) m_pReceiver->deleteLater();
+}
+
+bool QUdevSubscriptionData::deliver(const QUdevEvent &e, QUdevStatistics &Statistics)
+{
+    if(eDeliverDirect == m_eMode)
+    {
+        deliverNow(e);
+        return false;
+    }
+
+    //ended subscriptions are checked again by the receiver, this only saves posting the event
+    if(false == isActive()) return false;
+
+    if(0 == m_pQueue.data())
+    {
+        QCoreApplication::postEvent(m_pReceiver, new QUdevSubscriptionEvent(this, e));
+        return false;
+    }
+
+    if(m_pQueue->push(e, Statistics)) QCoreApplication::postEvent(m_pReceiver, new QUdevSubscriptionEvent(this));
+    return m_pQueue->hasStaged();
+}
+
+bool QUdevSubscriptionData::flushQueue()
+{
+    if(0 == m_pQueue.data()) return false;
+
+    if(m_pQueue->flushStaged()) QCoreApplication::postEvent(m_pReceiver, new QUdevSubscriptionEvent(this));
+    return m_pQueue->hasStaged();
+}
+
+void QUdevSubscriptionData::drainQueue()
+{
+    m_pQueue->beginDrain();
+
+    //events queued after beginDrain() post a new wakeup, so one round is enough and other events are not starved
+    QUdevEvent e;
+    for(int i = m_pQueue->getCapacity(); (i > 0) && m_pQueue->pop(e); --i)
+    {
+        deliverNow(e);
+    }
+}
+
+void QUdevSubscriptionData::deliverNow(const QUdevEvent &e)
+{
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    if(m_pSubscriber) m_pSubscriber->onUdevEvent(e);
+}
+
+bool QUdevSubscriptionData::isActive() const
+{
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    return 0 != m_pSubscriber;
+}
+
+void QUdevSubscriptionData::cancel()
+{
+    //a monitoring thread blocked on the full queue must not wait for us anymore
+    if(m_pQueue) m_pQueue->close();
+
+    //waits for a running delivery, afterwards the subscriber is not called anymore.
+    //The owner is used under the lock, so a concurrent detach() by the destructor of the owner waits for us.
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    m_pSubscriber = 0;
+    if(m_pOwner) m_pOwner->removeSubscription(this);
+    m_pOwner = 0;
+}
+
+void QUdevSubscriptionData::detach()
+{
+    if(m_pQueue) m_pQueue->close();
+
+    QMutexLocker l(&m_Mutex);
+    m_pSubscriber = 0;
+    m_pOwner = 0;
+    Q_UNUSED(l);
+}
+
+QUdevSubscription::QUdevSubscription()
+{
+
+}
+
+QUdevSubscription::QUdevSubscription(QUdevSubscriptionData *pData)
+  : d(pData)
+{
+
+}
+
+QUdevSubscription::QUdevSubscription(const QUdevSubscription &Other)
+  : d(Other.d)
+{
+
+}
+
+QUdevSubscription::~QUdevSubscription()
+{
+
+}
+
+QUdevSubscription &QUdevSubscription::operator=(const QUdevSubscription &Other)
+{
+    d = Other.d;
+    return *this;
+}
+
+bool QUdevSubscription::isValid() const
+{
+    return 0 != d.data();
+}
+
+bool QUdevSubscription::isActive() const
+{
+    return d && d->isActive();
+}
+
+void QUdevSubscription::cancel()
+{
+    if(d) d->cancel();
+}
@@ -0,0 +1,169 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVSUBSCRIPTION_PRIVATE_H
+#define QUDEVSUBSCRIPTION_PRIVATE_H
+
+#include <QSharedData>
+#include <QMutex>
+#include <QObject>
+#include <QEvent>
+
+#include "QUdevDeclarations.h"
+#include "QUdevEventQueue_private.h"
+
+class QUdevPrivate;
+class QThread;
+
+/**
+ * Lives in the target thread of a queued subscription and calls the subscriber from its event loop
+ */
+class QUdevSubscriptionReceiver : public QObject
+{
+    public:
+
+        virtual bool event(QEvent *pEvent);
+};
+
+/**
+ * Shared state of a subscription, referenced by the handles and by the rule of the subscription
+ */
+class QUdevSubscriptionData : public QSharedData
+{
+    public:
+
+        /**
+         * Constructor
+         *
+         * @param pOwner The instance holding the rule
+         * @param pTargetThread The thread receiving queued events, 0 for the calling thread
+         * @param pQueue The queue of a queued subscription, 0 to post every event on its own
+         */
+        QUdevSubscriptionData(QUdevPrivate *pOwner, QUdevSubscriber *pSubscriber, QUdevDeliveryMode eMode, QThread *pTargetThread,
+                              QUdevEventQueue *pQueue);
+
+        ~QUdevSubscriptionData();
+
+        /**
+         * Hand a matched event to the subscriber, called by the monitoring thread
+         *
+         * @param Statistics Receives the overflows of the queue
+         *
+         * @return True if the queue holds back events
+         */
+        bool deliver(const QUdevEvent &e, QUdevStatistics &Statistics);
+
+        /**
+         * Move the events held back by the queue into it, called by the monitoring thread
+         *
+         * @return True if the queue still holds back events
+         */
+        bool flushQueue();
+
+        /**
+         * Call the subscriber for the queued events, called in the target thread
+         */
+        void drainQueue();
+
+        /**
+         * Call the subscriber unless the subscription ended meanwhile
+         */
+        void deliverNow(const QUdevEvent &e);
+
+        bool isActive() const;
+
+        /**
+         * End the subscription and remove the rule from the owner
+         *
+         * Thread safe, the rule is removed while m_Mutex is held so the owner cannot be destroyed meanwhile.
+         */
+        void cancel();
+
+        /**
+         * End the subscription without touching the owner, called when the owner is destroyed
+         *
+         * Waits for a concurrent cancel() still removing its rule from the owner.
+         */
+        void detach();
+
+    private:
+
+        Q_DISABLE_COPY(QUdevSubscriptionData);
+
+        /**
+         * Held while the subscriber is called, so ending the subscription waits for a running delivery
+         * (recursive, the subscriber may end its own subscription)
+         */
+        mutable QMutex m_Mutex;
+
+        /**
+         * The subscriber, 0 once the subscription ended (protected by m_Mutex)
+         */
+        QUdevSubscriber *m_pSubscriber;
+
+        /**
+         * The instance holding the rule, 0 once the subscription ended (protected by m_Mutex)
+         */
+        QUdevPrivate *m_pOwner;
+
+        QUdevDeliveryMode m_eMode;
+
+        /**
+         * Receives the posted events in the target thread (only for eDeliverQueued)
+         */
+        QUdevSubscriptionReceiver *m_pReceiver;
+
+        /**
+         * Bounded queue to the target thread, null if every event is posted on its own
+         */
+        QExplicitlySharedDataPointer<QUdevEventQueue> m_pQueue;
+};
+
+/**
+ * A matched event or a queue wakeup posted to the target thread of a queued subscription
+ */
+class QUdevSubscriptionEvent : public QEvent
+{
+    public:
+
+        QUdevSubscriptionEvent(QUdevSubscriptionData *pSubscription, const QUdevEvent &e);
+
+        /**
+         * Constructor for the wakeup of the queue
+         */
+        explicit QUdevSubscriptionEvent(QUdevSubscriptionData *pSubscription);
+
+        /**
+         * The event type registered for subscription events
+         */
+        static QEvent::Type getType();
+
+        /**
+         * Keeps the subscription alive until the event was handled
+         */
+        QExplicitlySharedDataPointer<QUdevSubscriptionData> m_pSubscription;
+
+        QUdevEvent m_Event;
+
+        /**
+         * Drain the queue instead of delivering m_Event
+         */
+        bool m_bDrainQueue;
+};
+
+#endif // QUDEVSUBSCRIPTION_PRIVATE_H
@@ -0,0 +1,330 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QUdevSyntheticBackend_private.h"
+
+#include <QDebug>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+/**
+ * Number of ancestor chains the devices are spread over
+ */
+static const int s_iAncestorChains = 4;
+
+/**
+ * The actions every device runs through
+ */
+static const char * const s_apcActions[] = { "add", "change", "change", "remove" };
+
+const char *QUdevSyntheticBackend::QUdevSyntheticEvent::getAction() const
+{
+    return m_pcAction;
+}
+
+const char *QUdevSyntheticBackend::QUdevSyntheticEvent::getSysPath() const
+{
+    return m_pDevice->m_baSysPath.constData();
+}
+
+const char *QUdevSyntheticBackend::QUdevSyntheticEvent::getDevPath() const
+{
+    //the devpath starts behind the sysfs mount point
+    return m_pDevice->m_baSysPath.constData() + 4;
+}
+
+const char *QUdevSyntheticBackend::QUdevSyntheticEvent::getSubsystem() const
+{
+    return m_pBackend->m_Config.m_lDeviceTypes.at(m_pDevice->m_iType).m_baSubsystem.constData();
+}
+
+const char *QUdevSyntheticBackend::QUdevSyntheticEvent::getDevType() const
+{
+    const QByteArray &baDevType = m_pBackend->m_Config.m_lDeviceTypes.at(m_pDevice->m_iType).m_baDevType;
+    return baDevType.isEmpty() ? 0 : baDevType.constData();
+}
+
+const char *QUdevSyntheticBackend::QUdevSyntheticEvent::getDevNode() const
+{
+    return m_pDevice->m_baDevNode.constData();
+}
+
+bool QUdevSyntheticBackend::QUdevSyntheticEvent::hasTag(const char *pcTag) const
+{
+    foreach(const QByteArray &baTag, m_pBackend->m_Config.m_lDeviceTypes.at(m_pDevice->m_iType).m_lbaTags)
+    {
+        if(baTag == pcTag) return true;
+    }
+    return false;
+}
+
+const char *QUdevSyntheticBackend::QUdevSyntheticEvent::getPropertyValue(const char *pcKey) const
+{
+    if(0 == qstrcmp(pcKey, "ACTION")) return getAction();
+    if(0 == qstrcmp(pcKey, "DEVPATH")) return getDevPath();
+    if(0 == qstrcmp(pcKey, "SUBSYSTEM")) return getSubsystem();
+    if(0 == qstrcmp(pcKey, "DEVTYPE")) return getDevType();
+    if(0 == qstrcmp(pcKey, "DEVNAME")) return getDevNode();
+    if(0 == qstrcmp(pcKey, "SEQNUM")) return m_acSeqNum;
+    return 0;
+}
+
+const char *QUdevSyntheticBackend::QUdevSyntheticEvent::getParentSysPath(const char *pcSubsystem, const char *pcDevType) const
+{
+    if(0 != qstrcmp(pcSubsystem, "synthetic")) return 0;
+
+    //walk up the chain like libudev does
+    for(int i = m_pDevice->m_iParent; i >= 0; i = m_pBackend->m_vAncestors.at(i).m_iParent)
+    {
+        const QUdevSyntheticAncestor &ancestor = m_pBackend->m_vAncestors.at(i);
+        if((0 == pcDevType) || (ancestor.m_baDevType == pcDevType)) return ancestor.m_baSysPath.constData();
+    }
+    return 0;
+}
+
+/**
+ * The properties every synthetic event has (if the value is set)
+ */
+static const char * const s_apcSyntheticKeys[] = { "ACTION", "DEVPATH", "SUBSYSTEM", "DEVTYPE", "DEVNAME", "SEQNUM" };
+
+void QUdevSyntheticBackend::QUdevSyntheticEvent::visitProperties(QUdevBackendPropertyVisitor &visitor) const
+{
+    for(unsigned int i = 0; i < sizeof(s_apcSyntheticKeys) / sizeof(s_apcSyntheticKeys[0]); ++i)
+    {
+        const char *pcValue = getPropertyValue(s_apcSyntheticKeys[i]);
+        if(pcValue) visitor.visitProperty(s_apcSyntheticKeys[i], static_cast<int>(strlen(s_apcSyntheticKeys[i])), pcValue);
+    }
+}
+
+QList<QPair<QByteArray, QByteArray> > QUdevSyntheticBackend::QUdevSyntheticEvent::getProperties() const
+{
+    QList<QPair<QByteArray, QByteArray> > lProperties;
+    for(unsigned int i = 0; i < sizeof(s_apcSyntheticKeys) / sizeof(s_apcSyntheticKeys[0]); ++i)
+    {
+        const char *pcValue = getPropertyValue(s_apcSyntheticKeys[i]);
+        if(pcValue) lProperties.append(qMakePair(QByteArray(s_apcSyntheticKeys[i]), QByteArray(pcValue)));
+    }
+    return lProperties;
+}
+
+QList<QByteArray> QUdevSyntheticBackend::QUdevSyntheticEvent::getTags() const
+{
+    return m_pBackend->m_Config.m_lDeviceTypes.at(m_pDevice->m_iType).m_lbaTags;
+}
+
+QList<QUdevBackendAncestor> QUdevSyntheticBackend::QUdevSyntheticEvent::getAncestors() const
+{
+    QList<QUdevBackendAncestor> lAncestors;
+    for(int i = m_pDevice->m_iParent; i >= 0; i = m_pBackend->m_vAncestors.at(i).m_iParent)
+    {
+        QUdevBackendAncestor ancestor;
+        ancestor.m_baSysPath = m_pBackend->m_vAncestors.at(i).m_baSysPath;
+        ancestor.m_baSubsystem = QByteArray("synthetic");
+        ancestor.m_baDevType = m_pBackend->m_vAncestors.at(i).m_baDevType;
+        lAncestors.append(ancestor);
+    }
+    return lAncestors;
+}
+
+QUdevSyntheticBackend::QUdevSyntheticBackend(const QUdevSyntheticConfig &config)
+  : m_Config(config),
+    m_iFd(-1),
+    m_iGenerated(0),
+    m_iGeneratedCount(0),
+    m_iFinished(0),
+    m_Event(this)
+{
+    if(m_Config.m_lDeviceTypes.isEmpty()) m_Config.m_lDeviceTypes.append(QUdevSyntheticDeviceType());
+    m_Config.m_iDeviceCount = qMax(1, m_Config.m_iDeviceCount);
+    m_Config.m_iParentDepth = qMax(0, m_Config.m_iParentDepth);
+    m_Config.m_iBurstSize = qMax(1, m_Config.m_iBurstSize);
+
+    //the ancestor chains
+    QVector<int> vDirectParents;
+    for(int c = 0; c < s_iAncestorChains; ++c)
+    {
+        int iParent = -1;
+        QByteArray baSysPath = QByteArray("/sys/devices/synthetic") + QByteArray::number(c);
+        for(int iLevel = 0; iLevel < m_Config.m_iParentDepth; ++iLevel)
+        {
+            if(iLevel > 0) baSysPath += QByteArray("/level") + QByteArray::number(iLevel);
+
+            QUdevSyntheticAncestor ancestor;
+            ancestor.m_baSysPath = baSysPath;
+            ancestor.m_baDevType = QByteArray("level") + QByteArray::number(iLevel);
+            ancestor.m_iParent = iParent;
+
+            iParent = m_vAncestors.size();
+            m_vAncestors.append(ancestor);
+        }
+        vDirectParents.append(iParent);
+    }
+
+    //every kind gets as many slots as its weight, the devices are assigned to the slots round robin
+    QVector<int> vTypeSlots;
+    for(int t = 0; t < m_Config.m_lDeviceTypes.size(); ++t)
+    {
+        for(int w = 0; w < qMax(1, m_Config.m_lDeviceTypes.at(t).m_iWeight); ++w) vTypeSlots.append(t);
+    }
+
+    for(int i = 0; i < m_Config.m_iDeviceCount; ++i)
+    {
+        QUdevSyntheticDevice device;
+        device.m_iType = vTypeSlots.at(i % vTypeSlots.size());
+        device.m_iParent = vDirectParents.at(i % s_iAncestorChains);
+        device.m_iEvents = 0;
+
+        QByteArray baName = m_Config.m_lDeviceTypes.at(device.m_iType).m_baSubsystem + QByteArray::number(i);
+        QByteArray baParentPath = (device.m_iParent >= 0) ? m_vAncestors.at(device.m_iParent).m_baSysPath : QByteArray("/sys/devices/virtual/synthetic");
+        device.m_baSysPath = baParentPath + '/' + baName;
+        device.m_baDevNode = QByteArray("/dev/") + baName;
+
+        m_vDevices.append(device);
+    }
+
+    m_vTypePasses.fill(true, m_Config.m_lDeviceTypes.size());
+}
+
+QUdevSyntheticBackend::~QUdevSyntheticBackend()
+{
+    if(m_iFd >= 0) close(m_iFd);
+}
+
+int QUdevSyntheticBackend::start()
+{
+    if(m_Config.m_iRate > 0)
+    {
+        //tick every millisecond, each tick generates the events owed since the start
+        m_iFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+        struct itimerspec spec;
+        spec.it_interval.tv_sec = 0;
+        spec.it_interval.tv_nsec = 1000000;
+        spec.it_value = spec.it_interval;
+        if(m_iFd >= 0) timerfd_settime(m_iFd, 0, &spec, 0);
+    }
+    else
+    {
+        //the counter is never reset, so poll() returns right away until we are finished
+        m_iFd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    if(m_iFd < 0) qWarning() << QString("QUdevSyntheticBackend::start() could not create the descriptor: %1").arg(QString::fromLatin1(strerror(errno)));
+
+    m_tClock.start();
+    return m_iFd;
+}
+
+bool QUdevSyntheticBackend::receiveEvents(QUdevBackendReceiver *pReceiver)
+{
+    if(0 != m_iFinished.fetchAndAddRelaxed(0)) return false;
+
+    qint64 iDue = m_Config.m_iBurstSize;
+    if(m_Config.m_iRate > 0)
+    {
+        //reset the expirations of the timer
+        uint64_t iExpirations;
+        ssize_t iRead = read(m_iFd, &iExpirations, sizeof(iExpirations));
+        Q_UNUSED(iRead);
+
+        iDue = (m_tClock.nsecsElapsed() / 1000) * m_Config.m_iRate / 1000000 - m_iGenerated;
+    }
+    if(m_Config.m_iMaxEvents > 0) iDue = qMin(iDue, m_Config.m_iMaxEvents - m_iGenerated);
+
+    for(qint64 i = 0; i < iDue; ++i)
+    {
+        generateEvent(pReceiver);
+    }
+    m_iGeneratedCount.fetchAndStoreRelease(static_cast<int>(m_iGenerated));
+
+    if((m_Config.m_iMaxEvents > 0) && (m_iGenerated >= m_Config.m_iMaxEvents)) finish();
+
+    return false;
+}
+
+void QUdevSyntheticBackend::applyFilter(const QUdevBackendFilter &filter)
+{
+    for(int t = 0; t < m_Config.m_lDeviceTypes.size(); ++t)
+    {
+        const QUdevSyntheticDeviceType &type = m_Config.m_lDeviceTypes.at(t);
+
+        //an empty filter passes everything, like the socket filter of libudev
+        bool bPasses = filter.m_lMatches.isEmpty();
+        for(int i = 0; (false == bPasses) && (i < filter.m_lMatches.size()); ++i)
+        {
+            const QPair<QByteArray, QByteArray> &match = filter.m_lMatches.at(i);
+            bPasses = (match.first == type.m_baSubsystem) && (match.second.isEmpty() || (match.second == type.m_baDevType));
+        }
+
+        if(bPasses && (false == filter.m_lbaTags.isEmpty()))
+        {
+            bPasses = false;
+            foreach(const QByteArray &baTag, filter.m_lbaTags)
+            {
+                bPasses |= type.m_lbaTags.contains(baTag);
+            }
+        }
+
+        m_vTypePasses[t] = bPasses;
+    }
+}
+
+int QUdevSyntheticBackend::getGeneratedCount() const
+{
+    return m_iGeneratedCount.fetchAndAddAcquire(0);
+}
+
+bool QUdevSyntheticBackend::isFinished() const
+{
+    return (0 != m_iFinished.fetchAndAddAcquire(0));
+}
+
+void QUdevSyntheticBackend::generateEvent(QUdevBackendReceiver *pReceiver)
+{
+    QUdevSyntheticDevice &device = m_vDevices[static_cast<int>(m_iGenerated % m_vDevices.size())];
+    ++m_iGenerated;
+
+    m_Event.m_pDevice = &device;
+    m_Event.m_pcAction = s_apcActions[device.m_iEvents++ % 4];
+    qsnprintf(m_Event.m_acSeqNum, sizeof(m_Event.m_acSeqNum), "%lld", static_cast<long long>(m_iGenerated));
+
+    if(m_vTypePasses.at(device.m_iType)) pReceiver->processEvent(m_Event);
+}
+
+void QUdevSyntheticBackend::finish()
+{
+    if(m_Config.m_iRate > 0)
+    {
+        //disarm the timer
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        timerfd_settime(m_iFd, 0, &spec, 0);
+    }
+
+    //reset a pending timer expiration or the eventfd counter
+    uint64_t iValue;
+    ssize_t iRead = read(m_iFd, &iValue, sizeof(iValue));
+    Q_UNUSED(iRead);
+
+    m_iFinished.fetchAndStoreRelease(1);
+}
@@ -0,0 +1,265 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVSYNTHETICBACKEND_PRIVATE_H
+#define QUDEVSYNTHETICBACKEND_PRIVATE_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include "QUdevBackend_private.h"
+
+/**
+ * Backend generating uevents for benchmarks and for machines without hot-pluggable hardware
+ *
+ * The backend cycles through a fixed set of devices, every device runs through add, change, change, remove.
+ * The devices are spread over four ancestor chains of m_iParentDepth levels each, the ancestors have the
+ * subsystem "synthetic" and the devicetypes "level0" (the root) to "level<depth - 1>" (the direct parent),
+ * so rules with parent constraint walk up to m_iParentDepth levels. The devices do not exist in sysfs,
+ * their attributes are empty.
+ *
+ * The events are generated on the monitoring thread while it calls receiveEvents(), so the measured latencies
+ * include the complete dispatch path but no kernel or socket overhead.
+ */
+class QUdevSyntheticBackend : public QUdevBackend
+{
+    public:
+
+        /**
+         * One kind of generated devices
+         */
+        struct QUdevSyntheticDeviceType
+        {
+            QUdevSyntheticDeviceType(const QByteArray &baSubsystem = QByteArray("synthetic"), const QByteArray &baDevType = QByteArray(), int iWeight = 1)
+              : m_baSubsystem(baSubsystem),
+                m_baDevType(baDevType),
+                m_iWeight(iWeight)
+            {
+
+            }
+
+            QByteArray m_baSubsystem;
+
+            /**
+             * The devicetype, empty for devices without one
+             */
+            QByteArray m_baDevType;
+
+            /**
+             * Share of the devices of this kind relative to the other kinds
+             */
+            int m_iWeight;
+
+            /**
+             * The udev tags of the devices
+             */
+            QList<QByteArray> m_lbaTags;
+        };
+
+        /**
+         * Settings of the generator
+         */
+        struct QUdevSyntheticConfig
+        {
+            QUdevSyntheticConfig()
+              : m_iRate(0),
+                m_iMaxEvents(0),
+                m_iDeviceCount(64),
+                m_iParentDepth(2),
+                m_iBurstSize(256)
+            {
+
+            }
+
+            /**
+             * Events per second, 0 to generate them as fast as they are processed
+             */
+            int m_iRate;
+
+            /**
+             * Stop after this number of events, 0 to never stop
+             */
+            int m_iMaxEvents;
+
+            /**
+             * Number of distinct devices
+             */
+            int m_iDeviceCount;
+
+            /**
+             * Number of ancestors of every device
+             */
+            int m_iParentDepth;
+
+            /**
+             * Maximum number of events generated by one receiveEvents() call if m_iRate is 0
+             */
+            int m_iBurstSize;
+
+            /**
+             * The device mix, a single untyped kind with the subsystem "synthetic" if empty
+             */
+            QList<QUdevSyntheticDeviceType> m_lDeviceTypes;
+        };
+
+        explicit QUdevSyntheticBackend(const QUdevSyntheticConfig &config);
+
+        ~QUdevSyntheticBackend();
+
+        virtual int start();
+        virtual bool receiveEvents(QUdevBackendReceiver *pReceiver);
+        virtual void applyFilter(const QUdevBackendFilter &filter);
+
+        /**
+         * Get the number of events generated so far (including the ones dropped by the filter), usable from any thread
+         */
+        int getGeneratedCount() const;
+
+        /**
+         * Check if m_iMaxEvents were generated and handed to the receiver, usable from any thread
+         */
+        bool isFinished() const;
+
+    private:
+
+        Q_DISABLE_COPY(QUdevSyntheticBackend);
+
+        /**
+         * An ancestor of the generated devices
+         */
+        struct QUdevSyntheticAncestor
+        {
+            QByteArray m_baSysPath;
+            QByteArray m_baDevType;
+
+            /**
+             * Index of the parent in m_vAncestors, -1 for a root
+             */
+            int m_iParent;
+        };
+
+        /**
+         * A generated device
+         */
+        struct QUdevSyntheticDevice
+        {
+            QByteArray m_baSysPath;
+            QByteArray m_baDevNode;
+
+            /**
+             * Index of the kind in m_Config.m_lDeviceTypes
+             */
+            int m_iType;
+
+            /**
+             * Index of the direct parent in m_vAncestors, -1 without ancestors
+             */
+            int m_iParent;
+
+            /**
+             * Number of events generated for the device, determines the next action
+             */
+            int m_iEvents;
+        };
+
+        /**
+         * The view handed to the receiver, reused for all events
+         */
+        class QUdevSyntheticEvent : public QUdevBackendEvent
+        {
+            public:
+
+                explicit QUdevSyntheticEvent(const QUdevSyntheticBackend *pBackend)
+                  : m_pBackend(pBackend),
+                    m_pDevice(0),
+                    m_pcAction(0)
+                {
+                    m_acSeqNum[0] = '\0';
+                }
+
+                virtual const char *getAction() const;
+                virtual const char *getSysPath() const;
+                virtual const char *getDevPath() const;
+                virtual const char *getSubsystem() const;
+                virtual const char *getDevType() const;
+                virtual const char *getDevNode() const;
+                virtual bool hasTag(const char *pcTag) const;
+                virtual const char *getPropertyValue(const char *pcKey) const;
+                virtual const char *getParentSysPath(const char *pcSubsystem, const char *pcDevType) const;
+                virtual void visitProperties(QUdevBackendPropertyVisitor &visitor) const;
+                virtual QList<QPair<QByteArray, QByteArray> > getProperties() const;
+                virtual QList<QByteArray> getTags() const;
+                virtual QList<QUdevBackendAncestor> getAncestors() const;
+
+                const QUdevSyntheticBackend *m_pBackend;
+                const QUdevSyntheticDevice *m_pDevice;
+                const char *m_pcAction;
+                char m_acSeqNum[24];
+        };
+
+        /**
+         * Generate the next event and hand it to the receiver if it passes the filter
+         */
+        void generateEvent(QUdevBackendReceiver *pReceiver);
+
+        /**
+         * Stop the descriptor from becoming readable again
+         */
+        void finish();
+
+        QUdevSyntheticConfig m_Config;
+
+        QVector<QUdevSyntheticAncestor> m_vAncestors;
+
+        QVector<QUdevSyntheticDevice> m_vDevices;
+
+        /**
+         * Whether the kinds of m_Config.m_lDeviceTypes pass the current filter
+         */
+        QVector<bool> m_vTypePasses;
+
+        /**
+         * timerfd ticking every millisecond if a rate is set, an eventfd that stays readable otherwise
+         */
+        int m_iFd;
+
+        /**
+         * Time base of the rate
+         */
+        QElapsedTimer m_tClock;
+
+        /**
+         * Number of generated events (monitoring thread only)
+         */
+        qint64 m_iGenerated;
+
+        /**
+         * m_iGenerated published for other threads
+         */
+        mutable QAtomicInt m_iGeneratedCount;
+
+        /**
+         * Set once m_iMaxEvents were handed to the receiver
+         */
+        mutable QAtomicInt m_iFinished;
+
+        QUdevSyntheticEvent m_Event;
+};
+
+#endif // QUDEVSYNTHETICBACKEND_PRIVATE_H
@@ -0,0 +1,139 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QUdevTrace_private.h"
+
+#include <QDebug>
+
+#include <string.h>
+
+QUdevTraceWriter::QUdevTraceWriter()
+{
+
+}
+
+QUdevTraceWriter::~QUdevTraceWriter()
+{
+    close();
+}
+
+bool QUdevTraceWriter::open(const QString &strFile)
+{
+    close();
+
+    m_File.setFileName(strFile);
+    if(false == m_File.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << QString("QUdevTraceWriter::open() could not create the trace file '%1': %2").arg(strFile).arg(m_File.errorString());
+        return false;
+    }
+
+    QUdevTraceFileHeader header;
+    memcpy(header.m_acMagic, s_acTraceMagic, sizeof(header.m_acMagic));
+    header.m_iVersion = s_iTraceVersion;
+    header.m_iByteOrder = 0x01020304;
+
+    if(m_File.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header))
+    {
+        m_File.close();
+        return false;
+    }
+
+    m_tClock.start();
+    return true;
+}
+
+void QUdevTraceWriter::close()
+{
+    if(m_File.isOpen()) m_File.close();
+}
+
+bool QUdevTraceWriter::writeEvent(const QUdevBackendEvent &ev)
+{
+    QUdevTraceRecordHeader header;
+    memset(&header, 0, sizeof(header));
+
+    //the strings follow the header
+    m_baRecord.resize(sizeof(header));
+
+    appendString(ev.getAction());
+    appendString(ev.getSysPath());
+    appendString(ev.getDevPath());
+    appendString(ev.getSubsystem());
+    appendString(ev.getDevType());
+    appendString(ev.getDevNode());
+
+    QList<QByteArray> lbaTags = ev.getTags();
+    foreach(const QByteArray &baTag, lbaTags)
+    {
+        appendString(baTag.constData());
+    }
+
+    QList<QPair<QByteArray, QByteArray> > lProperties = ev.getProperties();
+    for(int i = 0; i < lProperties.size(); ++i)
+    {
+        appendString(lProperties.at(i).first.constData());
+        appendString(lProperties.at(i).second.constData());
+    }
+
+    QList<QUdevBackendAncestor> lAncestors = ev.getAncestors();
+    foreach(const QUdevBackendAncestor &ancestor, lAncestors)
+    {
+        appendString(ancestor.m_baSysPath.constData());
+        appendString(ancestor.m_baSubsystem.constData());
+        appendString(ancestor.m_baDevType.constData());
+    }
+
+    header.m_iTagCount = static_cast<quint16>(qMin(lbaTags.size(), 0xffff));
+    header.m_iPropertyCount = static_cast<quint16>(qMin(lProperties.size(), 0xffff));
+    header.m_iAncestorCount = static_cast<quint16>(qMin(lAncestors.size(), 0xffff));
+    header.m_iSeqNum = QByteArray(ev.getPropertyValue("SEQNUM")).toULongLong();
+
+    return writeRecord(header);
+}
+
+bool QUdevTraceWriter::writeOverflow()
+{
+    QUdevTraceRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.m_iFlags = eTraceOverflow;
+
+    m_baRecord.resize(sizeof(header));
+    return writeRecord(header);
+}
+
+void QUdevTraceWriter::appendString(const char *pcString)
+{
+    //missing values are stored as empty strings
+    if(pcString) m_baRecord.append(pcString);
+    m_baRecord.append('\0');
+}
+
+bool QUdevTraceWriter::writeRecord(QUdevTraceRecordHeader &header)
+{
+    if(false == m_File.isOpen()) return false;
+
+    //keep the next record 8 byte aligned
+    while(m_baRecord.size() % 8) m_baRecord.append('\0');
+
+    header.m_iSize = m_baRecord.size();
+    header.m_iTimestamp = m_tClock.nsecsElapsed() / 1000;
+    memcpy(m_baRecord.data(), &header, sizeof(header));
+
+    return (m_File.write(m_baRecord) == m_baRecord.size());
+}
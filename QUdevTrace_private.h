@@ -0,0 +1,160 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVTRACE_PRIVATE_H
+#define QUDEVTRACE_PRIVATE_H
+
+#include <QFile>
+#include <QElapsedTimer>
+
+#include "QUdevBackend_private.h"
+
+/*
+ * Trace file format (native byte order, all records 8 byte aligned so the file can be used in place with mmap):
+ *
+ *   QUdevTraceFileHeader
+ *   record*
+ *
+ * record:
+ *   QUdevTraceRecordHeader
+ *   action, syspath, devpath, subsystem, devtype, devnode          (NUL terminated, empty if missing)
+ *   tag * m_iTagCount                                               (NUL terminated)
+ *   key, value * m_iPropertyCount                                   (NUL terminated)
+ *   syspath, subsystem, devtype * m_iAncestorCount                  (NUL terminated, direct parent first)
+ *   padding up to m_iSize
+ */
+
+/**
+ * Identifies a trace file, also used to reject traces of a different byte order
+ */
+static const char s_acTraceMagic[8] = { 'Q', 'U', 'D', 'E', 'V', 'T', 'R', 'C' };
+
+/**
+ * Current version of the trace format
+ */
+static const quint32 s_iTraceVersion = 1;
+
+/**
+ * Number of strings every record starts with
+ */
+static const int s_iTraceFixedFields = 6;
+
+struct QUdevTraceFileHeader
+{
+    char m_acMagic[8];
+    quint32 m_iVersion;
+    /**
+     * 0x01020304 written in native byte order
+     */
+    quint32 m_iByteOrder;
+};
+
+/**
+ * Flags of a trace record
+ */
+enum QUdevTraceRecordFlag
+{
+    /**
+     * Events were lost before this point, the record carries no strings
+     */
+    eTraceOverflow = 0x0001
+};
+
+struct QUdevTraceRecordHeader
+{
+    /**
+     * Size of the record including this header and the padding
+     */
+    quint32 m_iSize;
+    quint16 m_iFlags;
+    quint16 m_iTagCount;
+    quint16 m_iPropertyCount;
+    quint16 m_iAncestorCount;
+    quint32 m_iReserved;
+    /**
+     * The kernel sequence number, 0 if unknown
+     */
+    quint64 m_iSeqNum;
+    /**
+     * Microseconds since the start of the recording
+     */
+    qint64 m_iTimestamp;
+};
+
+/**
+ * Writes received uevents into a trace file
+ */
+class QUdevTraceWriter
+{
+    public:
+
+        QUdevTraceWriter();
+
+        /**
+         * Destructor, closes the trace
+         */
+        ~QUdevTraceWriter();
+
+        /**
+         * Create the trace file (truncating an existing one) and write the file header
+         */
+        bool open(const QString &strFile);
+
+        /**
+         * Flush and close the trace file
+         */
+        void close();
+
+        /**
+         * Append a record for the event, timestamped with the time since open()
+         */
+        bool writeEvent(const QUdevBackendEvent &ev);
+
+        /**
+         * Append a record marking lost events
+         */
+        bool writeOverflow();
+
+    private:
+
+        Q_DISABLE_COPY(QUdevTraceWriter);
+
+        /**
+         * Append a string including its terminating NUL to m_baRecord
+         */
+        void appendString(const char *pcString);
+
+        /**
+         * Pad m_baRecord, fill in the header and write it
+         */
+        bool writeRecord(QUdevTraceRecordHeader &header);
+
+        QFile m_File;
+
+        /**
+         * Time base of the timestamps
+         */
+        QElapsedTimer m_tClock;
+
+        /**
+         * Buffer of the record being written, reused for all records
+         */
+        QByteArray m_baRecord;
+};
+
+#endif // QUDEVTRACE_PRIVATE_H
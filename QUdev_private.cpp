@@ -18,14 +18,70 @@
 
 #include "QUdev_private.h"
 #include "QUdev.h"
+#include "QUdevMonitorHub_private.h"
+#include "QUdevLibudevBackend_private.h"
 
-QUdevPrivate::QUdevPrivate(QUdev *parent)
+#include <QCoreApplication>
+#include <QFile>
+
+#include <fnmatch.h>
+#include <limits.h>
+#include <string.h>
+
+/**
+ * Minimum time in milliseconds between two eventQueueOverflow() signals
+ */
+static const int s_iQueueReportInterval = 100;
+
+/**
+ * Time in milliseconds after which held back events are offered to their queue again
+ */
+static const int s_iStagedRetryInterval = 10;
+
+/**
+ * Time in milliseconds a snapshot or registry seed waits for the monitoring thread to apply its filter
+ */
+static const int s_iFilterTimeout = 5000;
+
+/**
+ * Read the sequence number of the last uevent sent by the kernel, 0 if unavailable
+ */
+static quint64 readKernelSeqnum()
+{
+    QFile file(QString("/sys/kernel/uevent_seqnum"));
+    if(false == file.open(QIODevice::ReadOnly)) return 0;
+    return file.readAll().trimmed().toULongLong();
+}
+
+QUdevPrivate::QUdevPrivate(QUdev *parent, const QString &strMonitorGroup)
   : m_pUdev(0),
+    m_pHub(0),
     q_ptr(parent),
-    m_bMonitoringActive(false)
+    m_iNextRuleId(0),
+    m_pPendingConfig(0),
+    m_pActiveConfig(new QUdevMonitorConfig),
+    m_iAppliedRulesGeneration(0),
+    m_iAppliedSeedGeneration(0),
+    m_iCoalesceSequence(0),
+    m_iNextStatistics(0),
+    m_pQueueReceiver(new QUdevQueueReceiver(this, parent)),
+    m_bEventsStaged(false),
+    m_iReportedQueueDrops(0),
+    m_iReportedQueueCoalesced(0),
+    m_iNextQueueReport(0),
+    m_pDataPool(new QUdevDeviceDataPool),
+    m_pTraceWriter(0),
+    m_iRecording(0),
+    m_iOverflowCount(0),
+    m_iSnapshotsPending(0),
+    m_cParentCache(512),
+    m_pRegistry(0),
+    m_iFilterGeneration(0)
 {
+    m_tClock.start();
 
     qRegisterMetaType<QUdevEvent>("QUdevEvent");
+    qRegisterMetaType<QVector<QUdevEvent> >("QVector<QUdevEvent>");
 
     //fill the action map
     m_mUdevActions[QString("add")] = eDeviceAdd;
@@ -36,28 +92,57 @@ QUdevPrivate::QUdevPrivate(QUdev *parent)
 
     //create the udev object
     m_pUdev = udev_new();
-    //set up a udev monitor object
-    m_pMon = udev_monitor_new_from_netlink(m_pUdev, "udev");
-
     Q_ASSERT(m_pUdev);
-    Q_ASSERT(m_pMon);
 
-    udev_monitor_enable_receiving(m_pMon);
+    m_pRegistry = new QUdevDeviceRegistry;
+
+    //the monitor socket and thread are shared by all instances of the group
+    m_pHub = QUdevMonitorHub::acquire(strMonitorGroup);
+    m_pHub->attach(this);
 }
 
 QUdevPrivate::~QUdevPrivate()
 {
+    //asynchronous enumerations still running use this instance
+    m_EnumerationPool.waitForDone();
+
+    QList<QUdevInternalWatcherEntry> lRules;
+    QList<QExplicitlySharedDataPointer<QUdevEventQueue> > lQueues;
     {
         QMutexLocker l(&m_Mutex);
-        //stop the monitoring thread and wait for it
-        m_bMonitoringActive = false;
+        lRules = m_Config.m_lRules;
+        lQueues = m_lEventQueues;
         Q_UNUSED(l);
     }
-    wait();
 
-    //release the udev objects
+    //the handles outlive us, their subscriptions end here. This also closes their queues, like the signal queues
+    //a monitoring thread blocked on a full queue (eOverflowBlock) is released and finishes the call the detach below waits for.
+    foreach(const QUdevInternalWatcherEntry &iwe, lRules)
+    {
+        if(iwe.m_pSubscription) iwe.m_pSubscription->detach();
+    }
+    foreach(const QExplicitlySharedDataPointer<QUdevEventQueue> &pQueue, lQueues)
+    {
+        pQueue->close();
+    }
+
+    //the monitoring thread does not call us anymore afterwards
+    m_pHub->detach(this);
+    QUdevMonitorHub::release(m_pHub);
+
+    //release the configurations
+    delete m_pPendingConfig.fetchAndStoreOrdered(0);
+    delete m_pActiveConfig;
+
+    delete m_pRegistry;
+
+    delete m_pTraceWriter;
+
+    //devices still held by the application return to the pool later, it deletes itself then
+    m_pDataPool->close();
+
+    //release the udev object
     if(m_pUdev) udev_unref(m_pUdev);
-    if(m_pMon) udev_monitor_unref(m_pMon);
 }
 
 QUdevPrivate &QUdevPrivate::operator=(const QUdevPrivate& Other)
@@ -66,229 +151,1971 @@ QUdevPrivate &QUdevPrivate::operator=(const QUdevPrivate& Other)
     {
         if(m_pUdev) udev_unref(m_pUdev);
         m_pUdev = Other.m_pUdev;
-        m_lMonitorEntries = Other.m_lMonitorEntries;
+
+        QMutexLocker l(&m_Mutex);
+        m_Config.m_lRules = Other.m_Config.m_lRules;
+        rebuildRuleIndex();
+        publishConfig();
+        Q_UNUSED(l);
     }
     return *this;
 }
 
 QUdevDeviceList QUdevPrivate::getUDevDevicesForSubsystem(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType)
 {
-    struct udev_enumerate *enumerate = udev_enumerate_new(m_pUdev);
+    bool bRegistryEnabled;
+    {
+        QMutexLocker l(&m_Mutex);
+        bRegistryEnabled = m_Config.m_bRegistryEnabled;
+        Q_UNUSED(l);
+    }
+
+    if(bRegistryEnabled)
+    {
+        //the first query of a subsystem enumerates it, all further queries are answered from memory
+        seedRegistry(strSubSystem);
+        if(m_pRegistry->isTracking(strSubSystem)) return m_pRegistry->findDevices(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType);
+    }
+
+    return enumerateDevices(QUdevInternalWatcherEntry(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType));
+}
+
+struct udev_enumerate *QUdevPrivate::createEnumerate(struct udev *pUdev, const QUdevInternalWatcherEntry &iwe)
+{
+    struct udev_enumerate *enumerate = udev_enumerate_new(pUdev);
+    if(0 == enumerate) return 0;
+
+    //get subsystem enumerator
+    udev_enumerate_add_match_subsystem(enumerate, iwe.m_strSubsystem.toLatin1().constData());
+
+    //libudev requires all tags but any of the properties, the properties are checked again after the scan
+    foreach(const QByteArray &baTag, iwe.m_lbaTags)
+    {
+        udev_enumerate_add_match_tag(enumerate, baTag.constData());
+    }
+    for(int i = 0; i < iwe.m_lbaProperties.size(); ++i)
+    {
+        udev_enumerate_add_match_property(enumerate, iwe.m_lbaProperties.at(i).first.constData(), iwe.m_lbaProperties.at(i).second.constData());
+    }
+
+    //the devicetype is a property as well, it would only widen the match of the properties above
+    if(iwe.m_lbaProperties.isEmpty() && (false == iwe.m_strDeviceType.isEmpty()))
+    {
+        udev_enumerate_add_match_property(enumerate, "DEVTYPE", iwe.m_strDeviceType.toLatin1().constData());
+    }
+
+    return enumerate;
+}
+
+/**
+ * Hands the enumerated devices in chunks to a QUdevDeviceVisitor
+ */
+class QUdevEnumerationChunker
+{
+    public:
+
+        QUdevEnumerationChunker(QUdevDeviceVisitor *pVisitor, int iChunkSize)
+          : m_pVisitor(pVisitor),
+            m_iChunkSize(qMax(1, iChunkSize)),
+            m_iDelivered(0),
+            m_bStopped(false)
+        {
+
+        }
+
+        /**
+         * Add a device to the current chunk, delivering it if it is full
+         *
+         * @return False if the visitor asked to stop
+         */
+        bool append(const QUdevDevice &udDev)
+        {
+            m_lChunk.append(udDev);
+            if(m_lChunk.size() >= m_iChunkSize) flush();
+            return false == m_bStopped;
+        }
+
+        /**
+         * Deliver the current chunk
+         */
+        void flush()
+        {
+            if(m_bStopped || m_lChunk.isEmpty()) return;
+
+            QUdevDeviceList lChunk;
+            lChunk.swap(m_lChunk);
+            m_iDelivered += lChunk.size();
+            if(false == m_pVisitor->visitDevices(lChunk)) m_bStopped = true;
+        }
+
+        bool isStopped() const
+        {
+            return m_bStopped;
+        }
+
+        int getDelivered() const
+        {
+            return m_iDelivered;
+        }
+
+    private:
+
+        QUdevDeviceVisitor *m_pVisitor;
+        int m_iChunkSize;
+        int m_iDelivered;
+        bool m_bStopped;
+        QUdevDeviceList m_lChunk;
+};
+
+/**
+ * Collects all visited devices into one list
+ */
+class QUdevDeviceCollector : public QUdevDeviceVisitor
+{
+    public:
+
+        virtual bool visitDevices(const QUdevDeviceList &lDevices)
+        {
+            m_lDevices += lDevices;
+            return true;
+        }
+
+        QUdevDeviceList m_lDevices;
+};
+
+/**
+ * Collects the devices of an asynchronous enumeration, stops if the future was canceled
+ */
+class QUdevFutureCollector : public QUdevDeviceVisitor
+{
+    public:
+
+        explicit QUdevFutureCollector(const QFutureInterface<QUdevDeviceList> &fi)
+          : m_Future(fi)
+        {
+
+        }
+
+        virtual bool visitDevices(const QUdevDeviceList &lDevices)
+        {
+            m_lDevices += lDevices;
+            return false == m_Future.isCanceled();
+        }
+
+        QUdevDeviceList m_lDevices;
+
+    private:
+
+        QFutureInterface<QUdevDeviceList> m_Future;
+};
+
+/**
+ * Runs one asynchronous enumeration on the enumeration thread pool
+ */
+class QUdevEnumerationJob : public QRunnable
+{
+    public:
+
+        QUdevEnumerationJob(QUdevPrivate *pPrivate, const QUdevPrivate::QUdevInternalWatcherEntry &iwe, const QFutureInterface<QUdevDeviceList> &fi)
+          : m_pPrivate(pPrivate),
+            m_Entry(iwe),
+            m_Future(fi)
+        {
+
+        }
+
+        virtual void run()
+        {
+            m_pPrivate->runEnumerationJob(m_Entry, m_Future);
+        }
+
+    private:
+
+        QUdevPrivate *m_pPrivate;
+        QUdevPrivate::QUdevInternalWatcherEntry m_Entry;
+        QFutureInterface<QUdevDeviceList> m_Future;
+};
+
+/**
+ * The attributes of one asynchronous enumeration, shared by all threads reading them
+ */
+class QUdevAttributeLoad
+{
+    public:
+
+        QUdevAttributeLoad(const QVector<QExplicitlySharedDataPointer<QUdevDeviceAttributes> > &vAttributes, const QFutureInterface<QUdevDeviceList> &fi)
+          : m_vAttributes(vAttributes),
+            m_Future(fi),
+            m_iNext(0),
+            m_iPending(vAttributes.size())
+        {
+
+        }
+
+        /**
+         * Read attributes until every one of them was claimed by some thread
+         */
+        void process(struct udev *pUdev)
+        {
+            forever
+            {
+                int i = m_iNext.fetchAndAddRelaxed(1);
+                if(i >= m_vAttributes.size()) break;
+
+                //a canceled enumeration only has to account for the claimed entry
+                if(false == m_Future.isCanceled()) m_vAttributes.at(i)->preload(pUdev);
+
+                if(false == m_iPending.deref())
+                {
+                    QMutexLocker l(&m_Mutex);
+                    m_Done.wakeAll();
+                    Q_UNUSED(l);
+                }
+            }
+        }
+
+        /**
+         * Wait until all claimed attributes were read
+         */
+        void waitForDone()
+        {
+            QMutexLocker l(&m_Mutex);
+            while(0 != m_iPending.fetchAndAddAcquire(0)) m_Done.wait(&m_Mutex);
+            Q_UNUSED(l);
+        }
+
+    private:
+
+        QVector<QExplicitlySharedDataPointer<QUdevDeviceAttributes> > m_vAttributes;
+        QFutureInterface<QUdevDeviceList> m_Future;
+        QAtomicInt m_iNext;
+        QAtomicInt m_iPending;
+        QMutex m_Mutex;
+        QWaitCondition m_Done;
+};
+
+/**
+ * Helps reading the attributes of an asynchronous enumeration
+ */
+class QUdevAttributeLoadJob : public QRunnable
+{
+    public:
+
+        explicit QUdevAttributeLoadJob(const QSharedPointer<QUdevAttributeLoad> &pLoad)
+          : m_pLoad(pLoad)
+        {
+
+        }
+
+        virtual void run()
+        {
+            //libudev contexts must not be shared between threads, every helper uses its own one
+            struct udev *pUdev = udev_new();
+            if(0 == pUdev) return;
+
+            m_pLoad->process(pUdev);
+            udev_unref(pUdev);
+        }
+
+    private:
+
+        QSharedPointer<QUdevAttributeLoad> m_pLoad;
+};
+
+QUdevDeviceList QUdevPrivate::enumerateDevices(const QUdevInternalWatcherEntry &iwe)
+{
+    //one single chunk, the list is handed over without copying
+    QUdevDeviceCollector collector;
+    enumerateDevices(m_pUdev, iwe, &collector, INT_MAX);
+    return collector.m_lDevices;
+}
+
+int QUdevPrivate::visitUDevDevicesForSubsystem(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                               QUdevDeviceVisitor *pVisitor, int iChunkSize)
+{
+    if(0 == pVisitor) return 0;
+    return enumerateDevices(m_pUdev, QUdevInternalWatcherEntry(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType), pVisitor, iChunkSize);
+}
+
+QList<QUdevDeviceList> QUdevPrivate::getUDevDevicesForQueries(const QList<QUdevDeviceQuery> &lQueries)
+{
     struct udev_list_entry *devices = 0;
     struct udev_list_entry *dev_list_entry = 0;
-    struct udev_device *dev = 0;
 
-    QList<QUdevDevice> lDevices;
+    QList<QUdevDeviceList> lResults;
+    QList<QUdevInternalWatcherEntry> lEntries;
 
-    if(strSubSystem.isEmpty()) return lDevices;
+    //queries indexed by their subsystem
+    QHash<QString, QList<int> > hQueriesBySubsystem;
+    QSet<QString> sDeviceTypes;
+    bool bAllTyped = true;
+    bool bSameSysAttrs = true;
+    const QUdevPropertyMap *pSysAttrs = 0;
+
+    for(int i = 0; i < lQueries.size(); ++i)
+    {
+        const QUdevDeviceQuery &query = lQueries.at(i);
+        lEntries.append(QUdevInternalWatcherEntry(query.m_strSubsystem, query.m_strDeviceType, query.m_strParentSubSystem, query.m_strParentDeviceType));
+        lResults.append(QUdevDeviceList());
+
+        if(query.m_strSubsystem.isEmpty()) continue;
+
+        hQueriesBySubsystem[query.m_strSubsystem].append(i);
+        sDeviceTypes.insert(query.m_strDeviceType);
+        bAllTyped &= (false == query.m_strDeviceType.isEmpty());
+
+        if(0 == pSysAttrs) pSysAttrs = &query.m_mSysAttrs;
+        else bSameSysAttrs &= (*pSysAttrs == query.m_mSysAttrs);
+    }
+
+    if(hQueriesBySubsystem.isEmpty()) return lResults;
+
+    struct udev_enumerate *enumerate = udev_enumerate_new(m_pUdev);
+    if(0 == enumerate) return lResults;
+
+    //libudev ORs the subsystem matches, so one scan covers the union of all queries
+    foreach(const QString &strSubSystem, hQueriesBySubsystem.keys())
+    {
+        udev_enumerate_add_match_subsystem(enumerate, strSubSystem.toLatin1().constData());
+    }
+
+    //the devicetypes can only be pruned by libudev if every query has one, the property matches are ORed as well
+    if(bAllTyped)
+    {
+        foreach(const QString &strDeviceType, sDeviceTypes)
+        {
+            udev_enumerate_add_match_property(enumerate, "DEVTYPE", strDeviceType.toLatin1().constData());
+        }
+    }
+
+    //libudev requires all sysattr matches, so they can only be pushed if every query requires the same ones
+    bool bSysAttrsPushed = bSameSysAttrs;
+    if(bSysAttrsPushed)
+    {
+        for(QUdevPropertyMap::const_iterator it = pSysAttrs->constBegin(); it != pSysAttrs->constEnd(); ++it)
+        {
+            udev_enumerate_add_match_sysattr(enumerate, it.key().toLatin1().constData(), it.value().toLatin1().constData());
+        }
+    }
 
-    //get subsystem enumerator
-    udev_enumerate_add_match_subsystem(enumerate, strSubSystem.toLatin1().constData());
     //perform sysfs scanning
     udev_enumerate_scan_devices(enumerate);
     devices = udev_enumerate_get_list_entry(enumerate);
 
-    //iterate over all devices in the enumeration list
+    //siblings share the attributes of their parent
+    QHash<QString, QExplicitlySharedDataPointer<QUdevDeviceAttributes> > hAttributes;
+
     udev_list_entry_foreach(dev_list_entry, devices)
     {
-        QUdevDevice udDev;
+        //every device is read once for all queries
+        struct udev_device *dev = udev_device_new_from_syspath(m_pUdev, udev_list_entry_get_name(dev_list_entry));
+        if(0 == dev) continue;
+
+        QString strSubsystem = QString::fromLatin1(udev_device_get_subsystem(dev));
+        const char *pcDevType = udev_device_get_devtype(dev);
 
-        //create udev device for the sysfs path returned
-        udDev.m_strSysfsPath = QString::fromLatin1(udev_list_entry_get_name(dev_list_entry));        
-        dev = udev_device_new_from_syspath(m_pUdev, udDev.m_strSysfsPath.toLatin1().constData());
+        //the devices created for this sysfs entry keyed by the sysfs path providing the details
+        QHash<QString, QUdevDevice> hDevices;
 
-        //filter the correct device types, ignored if empty device type is specified
-        if(strDeviceType.isEmpty() || (QString::fromLatin1(udev_device_get_devtype(dev)) == strDeviceType))
+        foreach(int iQuery, hQueriesBySubsystem.value(strSubsystem))
         {
-            //get the path inside /dev
-            udDev.m_strDevPath = QString::fromLatin1(udev_device_get_devnode(dev));
-            udDev.m_strSubsystem = strSubSystem;
-            udDev.m_strDeviceType = strDeviceType;
+            const QUdevInternalWatcherEntry &iwe = lEntries.at(iQuery);
+            if((false == iwe.m_strDeviceType.isEmpty()) && (0 != qstrcmp(pcDevType, iwe.m_strDeviceType.toLatin1().constData()))) continue;
+            if((false == bSysAttrsPushed) && (false == matchesSysAttrs(dev, lQueries.at(iQuery).m_mSysAttrs))) continue;
 
-            //if the caller wants a specific parent subsystem/devtype query the sysfs tree here
-            if(!strParentSubSystem.isEmpty() && !strParentDeviceType.isEmpty())
+            //detailed information comes from the parent (if specified)
+            QString strDetailPath = QString::fromLatin1(udev_device_get_syspath(dev));
+            if(iwe.hasParentConstraint())
             {
-                /*
-                 * retrieve the parent device with the subsystem/devtype pair of m_strParentSubSystem/m_strParentDeviceType.
-                 *
-                 * udev_device_get_parent_with_subsystem_devtype() will walk up the complete tree if needed
-                 */
-                dev = udev_device_get_parent_with_subsystem_devtype(dev, strParentSubSystem.toLatin1().constData(), strParentDeviceType.toLatin1().constData());
+                struct udev_device *parent_dev = udev_device_get_parent_with_subsystem_devtype(dev, iwe.m_baParentSubSystem.constData(), iwe.m_baParentDeviceType.constData());
+                //NOTE: parent_dev needs NOT to be unreferenced, it is owned by dev
+                if(0 == parent_dev) continue;
+                strDetailPath = QString::fromLatin1(udev_device_get_syspath(parent_dev));
             }
 
-            if(dev)
+            //queries with the same detail device share the same QUdevDevice
+            QHash<QString, QUdevDevice>::const_iterator it = hDevices.constFind(strDetailPath);
+            if(it == hDevices.constEnd())
             {
-                //fill the device information
-                udDev.m_strVendorID = QString::fromLatin1(udev_device_get_sysattr_value(dev,"idVendor"));
-                udDev.m_strProductID = QString::fromLatin1(udev_device_get_sysattr_value(dev, "idProduct"));
-                udDev.m_strManufacturer = QString::fromLatin1(udev_device_get_sysattr_value(dev,"manufacturer"));
-                udDev.m_strProduct = QString::fromLatin1(udev_device_get_sysattr_value(dev,"product"));
-                udDev.m_strSerial = QString::fromLatin1(udev_device_get_sysattr_value(dev, "serial"));
-                lDevices.append(udDev);
+                QExplicitlySharedDataPointer<QUdevDeviceAttributes> &pAttributes = hAttributes[strDetailPath];
+                //the attributes are read on first access
+                if(!pAttributes) pAttributes = new QUdevDeviceAttributes(strDetailPath);
+
+                QUdevDeviceData *pData = new QUdevDeviceData;
+                pData->m_strSysfsPath = QString::fromLatin1(udev_device_get_syspath(dev));
+                //get the path inside /dev
+                pData->m_strDevPath = QString::fromLatin1(udev_device_get_devnode(dev));
+                pData->m_strSubsystem = strSubsystem;
+                pData->m_strDeviceType = QString::fromLatin1(pcDevType);
+                pData->m_pAttributes = pAttributes;
+                pData->setProperties(QUdevLibudevEvent(dev));
+
+                it = hDevices.insert(strDetailPath, QUdevDevice(pData));
             }
 
-            udev_device_unref(dev);
+            lResults[iQuery].append(it.value());
         }
+
+        udev_device_unref(dev);
     }
     //drop our reference to the enumeration interface
     udev_enumerate_unref(enumerate);
 
-    return lDevices;
+    return lResults;
 }
 
-bool QUdevPrivate::addNewMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType)
+bool QUdevPrivate::matchesSysAttrs(struct udev_device *dev, const QUdevPropertyMap &mSysAttrs)
 {
-    QUdevInternalWatcherEntry iwe(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType);
-    QMutexLocker l(&m_Mutex);
+    //same semantics as udev_enumerate_add_match_sysattr()
+    for(QUdevPropertyMap::const_iterator it = mSysAttrs.constBegin(); it != mSysAttrs.constEnd(); ++it)
+    {
+        const char *pcValue = udev_device_get_sysattr_value(dev, it.key().toLatin1().constData());
+        if(0 == pcValue) return false;
+        if(0 != fnmatch(it.value().toLatin1().constData(), pcValue, 0)) return false;
+    }
+    return true;
+}
 
-    //filter duplicated rules
-    if(m_lMonitorEntries.contains(iwe)) return false;
+QFuture<QUdevDeviceList> QUdevPrivate::getUDevDevicesForSubsystemAsync(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType)
+{
+    QFutureInterface<QUdevDeviceList> fi;
+    fi.reportStarted();
+    QFuture<QUdevDeviceList> future = fi.future();
 
-    m_lMonitorEntries.append(iwe);
+    m_EnumerationPool.start(new QUdevEnumerationJob(this, QUdevInternalWatcherEntry(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType), fi));
+    return future;
+}
 
-    //clear all filter from the monitor interface
-    udev_monitor_filter_remove(m_pMon);
+void QUdevPrivate::setEnumerationParallelism(int iThreads)
+{
+    m_EnumerationPool.setMaxThreadCount(qMax(1, iThreads));
+}
 
-    if(false == m_lMonitorEntries.empty())
+void QUdevPrivate::runEnumerationJob(const QUdevInternalWatcherEntry &iwe, QFutureInterface<QUdevDeviceList> &fi)
+{
+    //libudev contexts must not be shared between threads, the scan gets its own one
+    struct udev *pUdev = fi.isCanceled() ? 0 : udev_new();
+    if(pUdev)
     {
-        foreach(QUdevInternalWatcherEntry iwe, m_lMonitorEntries)
+        //small chunks let a cancel request stop the scan early
+        QUdevFutureCollector collector(fi);
+        enumerateDevices(pUdev, iwe, &collector, 64);
+
+        //siblings share the attributes of their parent, each of them is read only once
+        QVector<QExplicitlySharedDataPointer<QUdevDeviceAttributes> > vAttributes;
+        QSet<const QUdevDeviceAttributes*> sSeen;
+        foreach(const QUdevDevice &udDev, collector.m_lDevices)
+        {
+            const QExplicitlySharedDataPointer<QUdevDeviceAttributes> &pAttributes = udDev.d->m_pAttributes;
+            if(!pAttributes || sSeen.contains(pAttributes.data())) continue;
+
+            sSeen.insert(pAttributes.data());
+            vAttributes.append(pAttributes);
+        }
+
+        if((false == fi.isCanceled()) && (false == vAttributes.isEmpty()))
         {
-            udev_monitor_filter_add_match_subsystem_devtype(m_pMon, iwe.m_strSubsystem.toLatin1().constData(), iwe.m_strDeviceType.toLatin1().constData());
+            QSharedPointer<QUdevAttributeLoad> pLoad(new QUdevAttributeLoad(vAttributes, fi));
+
+            //this thread reads as well, so the load never depends on a free pool thread
+            int iHelpers = qMin(m_EnumerationPool.maxThreadCount() - 1, vAttributes.size() - 1);
+            for(int i = 0; i < iHelpers; ++i)
+            {
+                m_EnumerationPool.start(new QUdevAttributeLoadJob(pLoad));
+            }
+
+            pLoad->process(pUdev);
+            pLoad->waitForDone();
         }
 
-        m_bMonitoringActive = true;
-        if(false==this->isRunning()) this->start();
+        if(false == fi.isCanceled()) fi.reportResult(collector.m_lDevices);
+        udev_unref(pUdev);
     }
 
-    Q_UNUSED(l);
-    return true;
+    fi.reportFinished();
 }
 
-bool QUdevPrivate::removeMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType)
+int QUdevPrivate::enumerateDevices(struct udev *pUdev, const QUdevInternalWatcherEntry &iwe, QUdevDeviceVisitor *pVisitor, int iChunkSize)
 {
-    QUdevInternalWatcherEntry iwe(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType);
-    QMutexLocker l(&m_Mutex);
+    struct udev_list_entry *devices = 0;
+    struct udev_list_entry *dev_list_entry = 0;
 
-    //rule must be present
-    if(false == m_lMonitorEntries.contains(iwe)) return false;
+    if(iwe.m_strSubsystem.isEmpty()) return 0;
 
-    //remove the first instance of the given monitoring rule
-    m_lMonitorEntries.removeOne(iwe);
+    QUdevEnumerationChunker chunker(pVisitor, iChunkSize);
 
-    //clear all filter from the monitor interface
-    udev_monitor_filter_remove(m_pMon);
+    //siblings share the attributes of their parent
+    QHash<QString, QExplicitlySharedDataPointer<QUdevDeviceAttributes> > hAttributes;
 
-    if(false == m_lMonitorEntries.empty())
+    if(false == iwe.hasParentConstraint())
+    {
+        struct udev_enumerate *enumerate = createEnumerate(pUdev, iwe);
+        if(0 == enumerate) return 0;
+
+        //perform sysfs scanning
+        udev_enumerate_scan_devices(enumerate);
+        devices = udev_enumerate_get_list_entry(enumerate);
+
+        //every device is handed out as soon as it passed the filters
+        udev_list_entry_foreach(dev_list_entry, devices)
+        {
+            QString strSysfsPath = QString::fromLatin1(udev_list_entry_get_name(dev_list_entry));
+            if(false == visitEnumeratedDevice(pUdev, strSysfsPath, strSysfsPath, iwe, hAttributes, chunker)) break;
+        }
+        //drop our reference to the enumeration interface
+        udev_enumerate_unref(enumerate);
+    }
+    else
     {
-        foreach(QUdevInternalWatcherEntry iwe, m_lMonitorEntries)
+        /*
+         * Look up all possible parents first, then scan the devices once. The parent of a device is found
+         * by its sysfs path, so devices without such a parent are never read.
+         */
+        struct udev_enumerate *parents = udev_enumerate_new(pUdev);
+        if(0 == parents) return 0;
+
+        udev_enumerate_add_match_subsystem(parents, iwe.m_baParentSubSystem.constData());
+        udev_enumerate_add_match_property(parents, "DEVTYPE", iwe.m_baParentDeviceType.constData());
+        udev_enumerate_scan_devices(parents);
+        devices = udev_enumerate_get_list_entry(parents);
+
+        QStringList lParentPaths;
+        udev_list_entry_foreach(dev_list_entry, devices)
         {
-            udev_monitor_filter_add_match_subsystem_devtype(m_pMon, iwe.m_strSubsystem.toLatin1().constData(), iwe.m_strDeviceType.toLatin1().constData());
+            lParentPaths.append(QString::fromLatin1(udev_list_entry_get_name(dev_list_entry)));
         }
+        udev_enumerate_unref(parents);
+
+        if(lParentPaths.isEmpty()) return 0;
+        QSet<QString> sParentPaths = lParentPaths.toSet();
+
+        struct udev_enumerate *enumerate = createEnumerate(pUdev, iwe);
+        if(0 == enumerate) return 0;
+
+        udev_enumerate_scan_devices(enumerate);
 
-        m_bMonitoringActive = true;
-        if(false==this->isRunning()) this->start();
+        udev_list_entry_foreach(dev_list_entry, udev_enumerate_get_list_entry(enumerate))
+        {
+            QString strSysfsPath = QString::fromLatin1(udev_list_entry_get_name(dev_list_entry));
+
+            //the nearest parent wins like with udev_device_get_parent_with_subsystem_devtype(), e.g. with nested usb hubs
+            QString strParentPath = findNearestParent(strSysfsPath, sParentPaths);
+            if(strParentPath.isEmpty()) continue;
+            if(false == visitEnumeratedDevice(pUdev, strSysfsPath, strParentPath, iwe, hAttributes, chunker)) break;
+        }
+        udev_enumerate_unref(enumerate);
     }
 
-    Q_UNUSED(l);
-    return true;
+    //deliver the last partial chunk
+    chunker.flush();
+    return chunker.getDelivered();
 }
 
-void QUdevPrivate::run()
+bool QUdevPrivate::visitEnumeratedDevice(struct udev *pUdev, const QString &strSysfsPath, const QString &strDetailPath, const QUdevInternalWatcherEntry &iwe,
+                                         QHash<QString, QExplicitlySharedDataPointer<QUdevDeviceAttributes> > &hAttributes, QUdevEnumerationChunker &chunker)
 {
-    qDebug() << QString("QUdevPrivate::run() monitoring thread started");
+    //create udev device for the sysfs path returned
+    struct udev_device *dev = udev_device_new_from_syspath(pUdev, strSysfsPath.toLatin1().constData());
+    if(0 == dev) return true;
 
-    //libudev can provide us with a file descriptor usable with select()
-    int fd = udev_monitor_get_fd(m_pMon);
+    bool bContinue = true;
 
-    while(m_bMonitoringActive)
+    //the devicetype was only pruned by libudev if no properties were given, the properties are ORed by libudev
+    const char *pcDevType = udev_device_get_devtype(dev);
+    if((iwe.m_strDeviceType.isEmpty() || (0 == qstrcmp(pcDevType, iwe.m_strDeviceType.toLatin1().constData()))) && matchesTagsAndProperties(QUdevLibudevEvent(dev), iwe))
     {
-        fd_set fds;
-        struct timeval tv;
-        int ret;
+        QExplicitlySharedDataPointer<QUdevDeviceAttributes> &pAttributes = hAttributes[strDetailPath];
+        //the attributes are read on first access
+        if(!pAttributes) pAttributes = new QUdevDeviceAttributes(strDetailPath);
 
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-        tv.tv_sec = 0;
-        tv.tv_usec = 0;
+        QUdevDeviceData *pData = new QUdevDeviceData;
+        pData->m_strSysfsPath = strSysfsPath;
+        //get the path inside /dev
+        pData->m_strDevPath = QString::fromLatin1(udev_device_get_devnode(dev));
+        pData->m_strSubsystem = iwe.m_strSubsystem;
+        pData->m_strDeviceType = QString::fromLatin1(pcDevType);
+        pData->m_pAttributes = pAttributes;
+        pData->setProperties(QUdevLibudevEvent(dev));
 
-        ret = select(fd+1, &fds, NULL, NULL, &tv);
+        bContinue = chunker.append(QUdevDevice(pData));
+    }
 
-        //data available
-        if (ret > 0 && FD_ISSET(fd, &fds))
-        {
-            struct udev_device* parent_dev = 0;
-            //should not block due to select()
-            struct udev_device* dev = udev_monitor_receive_device(m_pMon);
+    udev_device_unref(dev);
+    return bContinue;
+}
 
-            if (dev)
-            {
-                QMutexLocker l(&m_Mutex);
-                foreach(QUdevInternalWatcherEntry iwe, m_lMonitorEntries)
-                {
-                    bool bMatch = true;
-                    bMatch &= (iwe.m_strSubsystem == QString::fromLatin1(udev_device_get_subsystem(dev)));
-                    bMatch &= (iwe.m_strDeviceType == QString::fromLatin1(udev_device_get_devtype(dev)));
-
-                    //subsystem and devicetype match, check if parent matching is requested
-                    if(bMatch)
-                    {
-                        //if the monitor entry wants a specific parent subsystem/devtype query the sysfs tree here
-                        if(!iwe.m_strParentSubSystem.isEmpty() && !iwe.m_strParentDeviceType.isEmpty())
-                        {
-                            /*
-                             * udev_device_get_parent_with_subsystem_devtype() will walk up the complete tree if needed
-                             * to find any parent with the requested subsystem/devtype combination
-                             *
-                             * We only care if any device can be found up the tree or not
-                             */
-                            parent_dev = udev_device_get_parent_with_subsystem_devtype(dev, iwe.m_strParentSubSystem.toLatin1().constData(), iwe.m_strParentDeviceType.toLatin1().constData());
-                            bMatch &= (0 != parent_dev);
-                        }
-                    }
-
-                    if(bMatch)
-                    {
-                        QUdevEvent e;
-
-                        //fill the action
-                        e.m_ueAction = getQUdevEventActionFromUdevAction(QString::fromLatin1(udev_device_get_action(dev)));
-
-                        //fill the device information
-                        e.m_udDev.m_strSubsystem = iwe.m_strSubsystem;
-                        e.m_udDev.m_strDeviceType = iwe.m_strDeviceType;
-                        e.m_udDev.m_strSysfsPath = QString::fromLatin1(udev_device_get_syspath(dev));
-                        e.m_udDev.m_strDevPath = QString::fromLatin1(udev_device_get_devnode(dev));
-
-                        //detailed information may come from the parent (if specified)
-                        struct udev_device* detail_dev = (0!=parent_dev) ? parent_dev : dev;
-
-                        e.m_udDev.m_strVendorID = QString::fromLatin1(udev_device_get_sysattr_value(detail_dev,"idVendor"));
-                        e.m_udDev.m_strProductID = QString::fromLatin1(udev_device_get_sysattr_value(detail_dev, "idProduct"));
-                        e.m_udDev.m_strManufacturer = QString::fromLatin1(udev_device_get_sysattr_value(detail_dev,"manufacturer"));
-                        e.m_udDev.m_strProduct = QString::fromLatin1(udev_device_get_sysattr_value(detail_dev,"product"));
-                        e.m_udDev.m_strSerial = QString::fromLatin1(udev_device_get_sysattr_value(detail_dev, "serial"));
-
-                        Q_Q(QUdev);
-                        emit q->newUDevEvent(e);
-                    }
-                }
-                Q_UNUSED(l);
-                udev_device_unref(dev);
-                //NOTE: parent_dev needs NOT to be unreferenced, see libudev documentation for details
-            }
-        }
-        msleep(500);
+QString QUdevPrivate::findNearestParent(const QString &strSysfsPath, const QSet<QString> &sParentPaths)
+{
+    //walk up the sysfs directories of the device, the first known parent is the nearest one
+    int iPos = strSysfsPath.lastIndexOf(QChar('/'));
+    while(iPos > 0)
+    {
+        QString strDir = strSysfsPath.left(iPos);
+        if(sParentPaths.contains(strDir)) return strDir;
+        iPos = strSysfsPath.lastIndexOf(QChar('/'), iPos - 1);
     }
+    return QString();
+}
+
+bool QUdevPrivate::addNewMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                     const QStringList &lTags, const QUdevPropertyMap &mProperties)
+{
+    QUdevInternalWatcherEntry iwe(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType, lTags, mProperties);
+    return insertMonitorRule(iwe);
 }
 
-QUdevEventAction QUdevPrivate::getQUdevEventActionFromUdevAction(const QString &strUdevAction) const
+bool QUdevPrivate::addSnapshotRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                   QUdevDeviceList &lSnapshot, const QStringList &lTags, const QUdevPropertyMap &mProperties, quint64 *piSnapshotSeqnum)
 {
-    if(m_mUdevActions.contains(strUdevAction))
+    lSnapshot.clear();
+    if(piSnapshotSeqnum) *piSnapshotSeqnum = 0;
+
+    //the monitoring thread cannot wait for its own filter, changes before it is applied would get lost
+    if(QThread::currentThread() == m_pHub)
     {
-        return m_mUdevActions[strUdevAction];
+        qWarning() << QString("QUdevPrivate::addSnapshotRule() called by the monitoring thread, which cannot apply the filter while it waits");
+        return false;
     }
-    else
+
+    QUdevInternalWatcherEntry iwe(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType, lTags, mProperties);
+    iwe.m_pSnapshotGate = new QUdevSnapshotGate;
+
+    {
+        QMutexLocker l(&m_Mutex);
+
+        //filter duplicated rules
+        if(m_Config.m_lRules.contains(iwe)) return false;
+
+        iwe.m_iRuleId = m_iNextRuleId++;
+        m_Config.m_lRules.append(iwe);
+
+        //rebuild the rule index and hand the new rules to the monitoring thread
+        rebuildRuleIndex();
+        int iGeneration = m_Config.m_iRulesGeneration;
+        m_Config.m_bMonitoringActive = true;
+        publishConfig();
+
+        //from now on every change of a matching device is either seen by the enumeration or received by the monitor.
+        //Without the filter the snapshot could miss changes, so the rule is withdrawn instead.
+        if(false == waitForFilter(iGeneration))
+        {
+            m_Config.m_lRules.removeAll(iwe);
+            rebuildRuleIndex();
+            publishConfig();
+            return false;
+        }
+        Q_UNUSED(l);
+    }
+
+    //the enumeration reflects every uevent up to this sequence number, the gate replays the newer ones
+    iwe.m_pSnapshotGate->beginSnapshot();
+    quint64 iSnapshotSeqnum = readKernelSeqnum();
+    lSnapshot = enumerateDevices(iwe);
+
+    QHash<QString, QUdevDevice> hSnapshot;
+    foreach(const QUdevDevice &udDev, lSnapshot)
     {
-        return eDeviceUnknownAction;
+        hSnapshot.insert(udDev.getSysfsPath(), udDev);
     }
+
+    //the monitoring thread replays the held events next, after the snapshot
+    m_iSnapshotsPending.fetchAndAddOrdered(1);
+    if(false == iwe.m_pSnapshotGate->release(hSnapshot, iSnapshotSeqnum)) m_iSnapshotsPending.fetchAndAddOrdered(-1);
+    m_pHub->wakeup(false);
+
+    if(piSnapshotSeqnum) *piSnapshotSeqnum = iSnapshotSeqnum;
+    return true;
+}
+
+QUdevSubscription QUdevPrivate::addSubscription(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                                QUdevSubscriber *pSubscriber, QUdevDeliveryMode eMode, QThread *pTargetThread,
+                                                const QStringList &lTags, const QUdevPropertyMap &mProperties)
+{
+    if(0 == pSubscriber) return QUdevSubscription();
+
+    //queued subscriptions get a queue of their own with the settings of the moment
+    QUdevEventQueue *pQueue = 0;
+    if(eDeliverQueued == eMode)
+    {
+        QMutexLocker l(&m_Mutex);
+        if(m_Config.m_iQueueCapacity > 0) pQueue = new QUdevEventQueue(m_Config.m_iQueueCapacity, m_Config.m_eOverflowPolicy);
+        Q_UNUSED(l);
+    }
+
+    QUdevInternalWatcherEntry iwe(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType, lTags, mProperties);
+    iwe.m_pSubscription = new QUdevSubscriptionData(this, pSubscriber, eMode, pTargetThread, pQueue);
+
+    //the subscription makes the rule unique, so it is never rejected as duplicate
+    insertMonitorRule(iwe);
+    return QUdevSubscription(iwe.m_pSubscription.data());
+}
+
+void QUdevPrivate::removeSubscription(QUdevSubscriptionData *pSubscription)
+{
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    for(int i = 0; i < m_Config.m_lRules.size(); ++i)
+    {
+        if(m_Config.m_lRules.at(i).m_pSubscription.data() != pSubscription) continue;
+
+        //rebuild the rule index and hand the new rules to the monitoring thread
+        m_Config.m_lRules.removeAt(i);
+        rebuildRuleIndex();
+        publishConfig();
+        return;
+    }
+}
+
+bool QUdevPrivate::insertMonitorRule(QUdevInternalWatcherEntry &iwe)
+{
+    bool bAutoResync;
+    {
+        QMutexLocker l(&m_Mutex);
+        //filter duplicated rules
+        if(m_Config.m_lRules.contains(iwe)) return false;
+        bAutoResync = m_Config.m_bAutoResync;
+        Q_UNUSED(l);
+    }
+
+    //remember the present devices so a resync after an overflow can report the difference
+    if(bAutoResync) iwe.m_hSeedDevices = enumerateKnownDevices(iwe);
+
+    QMutexLocker l(&m_Mutex);
+
+    //the same rule might have been added while we were scanning
+    if(m_Config.m_lRules.contains(iwe)) return false;
+
+    iwe.m_iRuleId = m_iNextRuleId++;
+    m_Config.m_lRules.append(iwe);
+
+    //rebuild the rule index and hand the new rules to the monitoring thread
+    rebuildRuleIndex();
+    m_Config.m_bMonitoringActive = true;
+    publishConfig();
+
+    Q_UNUSED(l);
+    return true;
+}
+
+bool QUdevPrivate::removeMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                     const QStringList &lTags, const QUdevPropertyMap &mProperties)
+{
+    QUdevInternalWatcherEntry iwe(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType, lTags, mProperties);
+    QMutexLocker l(&m_Mutex);
+
+    //rule must be present
+    int iIndex = m_Config.m_lRules.indexOf(iwe);
+    if(iIndex < 0) return false;
+
+    //the held events of a snapshot not replayed yet are not needed anymore
+    const QExplicitlySharedDataPointer<QUdevSnapshotGate> pGate = m_Config.m_lRules.at(iIndex).m_pSnapshotGate;
+    if(pGate && pGate->discard()) m_iSnapshotsPending.fetchAndAddOrdered(-1);
+
+    //remove the first instance of the given monitoring rule
+    m_Config.m_lRules.removeAt(iIndex);
+
+    //rebuild the rule index and hand the new rules to the monitoring thread
+    rebuildRuleIndex();
+    publishConfig();
+
+    Q_UNUSED(l);
+    return true;
+}
+
+void QUdevPrivate::processUdevDevice(const QUdevBackendEvent &ev)
+{
+    qint64 iReceived = getClockUs();
+    if(0 != m_iRecording.fetchAndAddAcquire(0)) recordEvent(&ev);
+    int iMatched = matchUdevDevice(ev, iReceived);
+
+    m_Statistics.add(eCntReceived);
+    m_Statistics.add((iMatched > 0) ? eCntMatched : eCntDropped);
+    m_Statistics.record(eHistProcessing, getClockUs() - iReceived);
+}
+
+void QUdevPrivate::recordEvent(const QUdevBackendEvent *pEvent)
+{
+    QMutexLocker l(&m_TraceMutex);
+    Q_UNUSED(l);
+
+    if(0 == m_pTraceWriter) return;
+
+    bool bWritten = pEvent ? m_pTraceWriter->writeEvent(*pEvent) : m_pTraceWriter->writeOverflow();
+    if(false == bWritten) qWarning() << QString("QUdevPrivate::recordEvent() could not write to the trace");
+}
+
+bool QUdevPrivate::startRecording(const QString &strTraceFile)
+{
+    QUdevTraceWriter *pWriter = new QUdevTraceWriter;
+    if(false == pWriter->open(strTraceFile))
+    {
+        delete pWriter;
+        return false;
+    }
+
+    QMutexLocker l(&m_TraceMutex);
+    delete m_pTraceWriter;
+    m_pTraceWriter = pWriter;
+    m_iRecording.fetchAndStoreRelease(1);
+    Q_UNUSED(l);
+
+    return true;
+}
+
+void QUdevPrivate::stopRecording()
+{
+    QMutexLocker l(&m_TraceMutex);
+    m_iRecording.fetchAndStoreRelease(0);
+    delete m_pTraceWriter;
+    m_pTraceWriter = 0;
+    Q_UNUSED(l);
+}
+
+int QUdevPrivate::matchUdevDevice(const QUdevBackendEvent &ev, qint64 iReceived)
+{
+    //the active configuration is owned by this thread, no locking needed
+    const QUdevMonitorConfig *pConfig = m_pActiveConfig;
+
+    const char *pcAction = ev.getAction();
+    const char *pcSysPath = ev.getSysPath();
+
+    //resolved parents of a removed device or of its children must not be used anymore
+    if(pcAction && (0 == qstrcmp(pcAction, "remove")) && (false == m_cParentCache.isEmpty())) invalidateParentCache(QString::fromLatin1(pcSysPath));
+
+    //an unknown subsystem atom means that no rule can match this device
+    int iSubsystemAtom = pConfig->lookupAtom(ev.getSubsystem());
+    if(iSubsystemAtom <= 0) return 0;
+
+    //the own attributes are shared by the registry and all matching rules without parent constraint
+    QExplicitlySharedDataPointer<QUdevDeviceAttributes> pOwnAttributes;
+
+    //devices of tracked subsystems keep the registry up to date, independent of any rule
+    if(pConfig->m_sRegistryAtoms.contains(iSubsystemAtom)) updateRegistry(ev, pcAction, pOwnAttributes);
+
+    const char *pcDevType = ev.getDevType();
+    int iDevTypeAtom = pConfig->lookupAtom(pcDevType);
+
+    //candidates are the rules for the exact devicetype and the rules ignoring the devicetype
+    const QVector<int> vExactRules = (iDevTypeAtom > 0) ? pConfig->m_hRuleIndex.value(qMakePair(iSubsystemAtom, iDevTypeAtom)) : QVector<int>();
+    const QVector<int> vAnyTypeRules = pConfig->m_hRuleIndex.value(qMakePair(iSubsystemAtom, 0));
+    if(vExactRules.isEmpty() && vAnyTypeRules.isEmpty()) return 0;
+
+    //converted once per device and shared by all matching rules
+    QUdevEventAction ueAction = getQUdevEventActionFromUdevAction(pcAction);
+
+    //the ancestors of a device are determined by the directory containing it, siblings share the cache entries
+    QByteArray baParentDir;
+
+    int iMatched = 0;
+
+    //the single event of merged delivery and the index of the rule providing its device data
+    QUdevEvent merged;
+    int iMergedRule = -1;
+    QExplicitlySharedDataPointer<QUdevDeviceAttributes> pMergedAttributes;
+
+    const QVector<int> *apCandidates[2] = { &vExactRules, &vAnyTypeRules };
+    for(int c = 0; c < 2; ++c)
+    {
+        foreach(int iRule, *apCandidates[c])
+        {
+            const QUdevInternalWatcherEntry &iwe = pConfig->m_lRules.at(iRule);
+            m_Statistics.add(eCntRuleEvaluations);
+
+            //cheap in-memory checks first, the socket filter only guarantees one of the tags
+            if(false == matchesTagsAndProperties(ev, iwe)) continue;
+
+            //detailed information may come from the parent (if specified)
+            QExplicitlySharedDataPointer<QUdevDeviceAttributes> pParentAttributes;
+            if(iwe.hasParentConstraint())
+            {
+                if(baParentDir.isEmpty())
+                {
+                    const char *pcLastSlash = strrchr(pcSysPath, '/');
+                    baParentDir = QByteArray(pcSysPath, pcLastSlash ? static_cast<int>(pcLastSlash - pcSysPath) : 0);
+                }
+
+                //look up the parent in the parent cache
+                pParentAttributes = resolveParent(ev, baParentDir, iwe);
+                if(!pParentAttributes) continue;
+            }
+
+            ++iMatched;
+
+            //a rule added with a snapshot holds its events until the snapshot was handed over,
+            //the gate replays those newer than the snapshot by their sequence number
+            QUdevSnapshotGate *pGate = iwe.m_pSnapshotGate.data();
+            if(pGate && (false == pGate->isOpen()))
+            {
+                QUdevEvent e;
+                e.m_ueAction = ueAction;
+                e.m_udDev = createMatchedDevice(ev, ueAction, iwe, iDevTypeAtom, pParentAttributes, pOwnAttributes);
+                if(pGate->hold(e, iReceived, QByteArray(ev.getPropertyValue("SEQNUM")).toULongLong())) continue;
+
+                //released meanwhile, the held events go first
+                openSnapshotGate(iwe);
+                trackKnownDevice(iwe.m_iRuleId, e);
+                deliverEvent(e, iwe.m_iRuleId, iwe.m_pSubscription.data(), iReceived);
+                continue;
+            }
+
+            //with merged delivery the device is created once after all rules were checked
+            if(pConfig->m_bMergeMatches && !iwe.m_pSubscription)
+            {
+                //the device data is the one of the first matching rule in the order the rules were added
+                if((iMergedRule < 0) || (iRule < iMergedRule))
+                {
+                    iMergedRule = iRule;
+                    pMergedAttributes = pParentAttributes;
+                }
+                merged.m_vMatchedRules.append(iwe.m_iRuleId);
+                continue;
+            }
+
+            QUdevEvent e;
+
+            //fill the action
+            e.m_ueAction = ueAction;
+            e.m_udDev = createMatchedDevice(ev, ueAction, iwe, iDevTypeAtom, pParentAttributes, pOwnAttributes);
+
+            trackKnownDevice(iwe.m_iRuleId, e);
+            deliverEvent(e, iwe.m_iRuleId, iwe.m_pSubscription.data(), iReceived);
+        }
+    }
+
+    if(iMergedRule >= 0)
+    {
+        merged.m_ueAction = ueAction;
+        merged.m_udDev = createMatchedDevice(ev, ueAction, pConfig->m_lRules.at(iMergedRule), iDevTypeAtom, pMergedAttributes, pOwnAttributes);
+
+        foreach(int iRuleId, merged.m_vMatchedRules)
+        {
+            trackKnownDevice(iRuleId, merged);
+        }
+        deliverEvent(merged, -1, 0, iReceived);
+    }
+
+    return iMatched;
+}
+
+QUdevDevice QUdevPrivate::createMatchedDevice(const QUdevBackendEvent &ev, QUdevEventAction ueAction, const QUdevInternalWatcherEntry &iwe, int iDevTypeAtom,
+                                              const QExplicitlySharedDataPointer<QUdevDeviceAttributes> &pParentAttributes,
+                                              QExplicitlySharedDataPointer<QUdevDeviceAttributes> &pOwnAttributes)
+{
+    const char *pcSysPath = ev.getSysPath();
+
+    //recycled data keeps its string buffers, filling it does not allocate
+    QUdevDeviceData *pData = m_pDataPool->acquire();
+    QUdevDeviceData::assignLatin1(pData->m_strSysfsPath, pcSysPath);
+    QUdevDeviceData::assignLatin1(pData->m_strDevPath, ev.getDevNode());
+    pData->m_strSubsystem = iwe.m_strSubsystem;
+    if(false == iwe.m_strDeviceType.isEmpty()) pData->m_strDeviceType = iwe.m_strDeviceType;
+    else if(iDevTypeAtom > 0) pData->m_strDeviceType = m_pActiveConfig->m_vAtomStrings.at(iDevTypeAtom - 1);
+    else QUdevDeviceData::assignLatin1(pData->m_strDeviceType, ev.getDevType());
+    pData->setProperties(ev);
+
+    if(pParentAttributes)
+    {
+        pData->m_pAttributes = pParentAttributes;
+    }
+    else if(pOwnAttributes)
+    {
+        pData->m_pAttributes = pOwnAttributes;
+    }
+    else
+    {
+        //attributes of the recycled data are only held by it, they are pointed to this device instead
+        if(!pData->m_pAttributes) pData->m_pAttributes = new QUdevDeviceAttributes(QString());
+
+        //an own copy of the path, a buffer shared with the device would be copied on the next reuse
+        pData->m_pAttributes->reset(pcSysPath);
+        pOwnAttributes = pData->m_pAttributes;
+    }
+
+    //read now what is left of a removed device, consumers asking later would find nothing at all
+    if(eDeviceRemove == ueAction) pData->m_pAttributes->preload(QUdevThreadContext::get());
+
+    return QUdevDevice(pData);
+}
+
+void QUdevPrivate::trackKnownDevice(int iRuleId, const QUdevEvent &e)
+{
+    //keep track of the present devices for a resync after an overflow
+    if(false == m_pActiveConfig->m_bAutoResync) return;
+
+    QHash<QString, QUdevDevice> &hKnownDevices = m_hKnownDevices[iRuleId];
+    if(eDeviceRemove == e.m_ueAction) hKnownDevices.remove(e.m_udDev.getSysfsPath());
+    else hKnownDevices.insert(e.m_udDev.getSysfsPath(), e.m_udDev);
+}
+
+QExplicitlySharedDataPointer<QUdevDeviceAttributes> QUdevPrivate::resolveParent(const QUdevBackendEvent &ev, const QByteArray &baParentDir, const QUdevInternalWatcherEntry &iwe)
+{
+    QByteArray baKey = baParentDir + '\0' + iwe.m_baParentSubSystem + '\0' + iwe.m_baParentDeviceType;
+
+    const QUdevParentCacheEntry *pCached = m_cParentCache.object(baKey);
+    if(pCached)
+    {
+        m_Statistics.add(eCntParentCacheHits);
+        return pCached->m_pAttributes;
+    }
+    m_Statistics.add(eCntParentWalks);
+
+    QUdevParentCacheEntry *pEntry = new QUdevParentCacheEntry;
+    pEntry->m_strParentDir = QString::fromLatin1(baParentDir);
+
+    //the backend walks up the complete tree if needed to find any parent with the requested subsystem/devtype combination
+    const char *pcParentSysPath = ev.getParentSysPath(iwe.m_baParentSubSystem.constData(), iwe.m_baParentDeviceType.constData());
+
+    //the attributes of the parent are read on first access and then shared by all children
+    if(pcParentSysPath) pEntry->m_pAttributes = new QUdevDeviceAttributes(QString::fromLatin1(pcParentSysPath));
+
+    QExplicitlySharedDataPointer<QUdevDeviceAttributes> pAttributes = pEntry->m_pAttributes;
+
+    //the cache takes ownership (and deletes the entry right away if it is disabled)
+    m_cParentCache.insert(baKey, pEntry);
+    return pAttributes;
+}
+
+bool QUdevPrivate::matchesTagsAndProperties(const QUdevBackendEvent &ev, const QUdevInternalWatcherEntry &iwe)
+{
+    foreach(const QByteArray &baTag, iwe.m_lbaTags)
+    {
+        if(false == ev.hasTag(baTag.constData())) return false;
+    }
+
+    for(int i = 0; i < iwe.m_lbaProperties.size(); ++i)
+    {
+        const char *pcValue = ev.getPropertyValue(iwe.m_lbaProperties.at(i).first.constData());
+        if(0 != qstrcmp(pcValue, iwe.m_lbaProperties.at(i).second.constData())) return false;
+    }
+
+    return true;
+}
+
+void QUdevPrivate::invalidateParentCache(const QString &strSysfsPath)
+{
+    foreach(const QByteArray &baKey, m_cParentCache.keys())
+    {
+        const QUdevParentCacheEntry *pEntry = m_cParentCache.object(baKey);
+        if(0 == pEntry) continue;
+
+        //drop every entry in the ancestor chain of the removed device, below it or resolved to it
+        bool bAffected = isSysfsPathPrefix(strSysfsPath, pEntry->m_strParentDir)
+                      || isSysfsPathPrefix(pEntry->m_strParentDir, strSysfsPath)
+                      || (pEntry->m_pAttributes && isSysfsPathPrefix(strSysfsPath, pEntry->m_pAttributes->getSysfsPath()));
+
+        if(bAffected) m_cParentCache.remove(baKey);
+    }
+}
+
+bool QUdevPrivate::isSysfsPathPrefix(const QString &strPrefix, const QString &strPath)
+{
+    if(false == strPath.startsWith(strPrefix)) return false;
+    return (strPath.size() == strPrefix.size()) || (QChar('/') == strPath.at(strPrefix.size()));
+}
+
+void QUdevPrivate::setParentCacheSize(int iEntries)
+{
+    QMutexLocker l(&m_Mutex);
+    m_Config.m_iParentCacheSize = qMax(0, iEntries);
+    publishConfig();
+    Q_UNUSED(l);
+}
+
+void QUdevPrivate::publishConfig()
+{
+    //m_Mutex is held by the caller
+    QUdevMonitorConfig *pConfig = new QUdevMonitorConfig(m_Config);
+
+    //a configuration still pending was never seen by the monitoring thread and can be dropped
+    delete m_pPendingConfig.fetchAndStoreOrdered(pConfig);
+    m_pHub->wakeup(m_Config.m_bMonitoringActive);
+}
+
+void QUdevPrivate::rebuildRuleIndex()
+{
+    //m_Mutex is held by the caller
+    m_Config.m_hRuleIndex.clear();
+
+    for(int i = 0; i < m_Config.m_lRules.size(); ++i)
+    {
+        const QUdevInternalWatcherEntry &iwe = m_Config.m_lRules.at(i);
+
+        //an empty devicetype is stored as atom 0 and matches every devicetype of the subsystem
+        m_Config.m_hRuleIndex[qMakePair(internAtom(iwe.m_strSubsystem), internAtom(iwe.m_strDeviceType))].append(i);
+    }
+
+    ++m_Config.m_iRulesGeneration;
+}
+
+int QUdevPrivate::internAtom(const QString &str)
+{
+    if(str.isEmpty()) return 0;
+
+    QByteArray ba = str.toLatin1();
+    int iAtom = m_Config.lookupAtom(ba.constData());
+    if(iAtom > 0) return iAtom;
+
+    //atom 0 is reserved for the empty string
+    m_Config.m_vAtoms.append(ba);
+    m_Config.m_vAtomStrings.append(str);
+    iAtom = m_Config.m_vAtoms.size();
+    m_Config.m_vSortedAtoms.insert(m_Config.findSortedAtom(ba.constData()), iAtom);
+    return iAtom;
+}
+
+int QUdevPrivate::QUdevMonitorConfig::lookupAtom(const char *pcStr) const
+{
+    if(0 == pcStr || 0 == *pcStr) return 0;
+
+    //compare the received string in place, no key has to be constructed
+    int iPos = findSortedAtom(pcStr);
+    if(iPos < m_vSortedAtoms.size())
+    {
+        int iAtom = m_vSortedAtoms.at(iPos);
+        if(0 == qstrcmp(m_vAtoms.at(iAtom - 1).constData(), pcStr)) return iAtom;
+    }
+    return -1;
+}
+
+int QUdevPrivate::QUdevMonitorConfig::findSortedAtom(const char *pcStr) const
+{
+    //lower bound
+    int iLow = 0;
+    int iHigh = m_vSortedAtoms.size();
+    while(iLow < iHigh)
+    {
+        int iMid = (iLow + iHigh) / 2;
+        if(qstrcmp(m_vAtoms.at(m_vSortedAtoms.at(iMid) - 1).constData(), pcStr) < 0) iLow = iMid + 1;
+        else iHigh = iMid;
+    }
+    return iLow;
+}
+
+bool QUdevPrivate::adoptPendingConfig()
+{
+    QUdevMonitorConfig *pConfig = m_pPendingConfig.fetchAndStoreOrdered(0);
+    if(0 == pConfig) return false;
+
+    delete m_pActiveConfig;
+    m_pActiveConfig = pConfig;
+
+    //the socket filter only has to be rebuilt if the rules changed
+    bool bRulesChanged = (m_iAppliedRulesGeneration != m_pActiveConfig->m_iRulesGeneration);
+    m_iAppliedRulesGeneration = m_pActiveConfig->m_iRulesGeneration;
+
+    m_cParentCache.setMaxCost(m_pActiveConfig->m_iParentCacheSize);
+
+    //keep the known devices of existing rules, new rules start with their seed
+    bool bReseed = (m_iAppliedSeedGeneration != m_pActiveConfig->m_iSeedGeneration);
+    QHash<int, QHash<QString, QUdevDevice> > hKnownDevices;
+    if(m_pActiveConfig->m_bAutoResync)
+    {
+        foreach(const QUdevInternalWatcherEntry &iwe, m_pActiveConfig->m_lRules)
+        {
+            if(!bReseed && m_hKnownDevices.contains(iwe.m_iRuleId)) hKnownDevices.insert(iwe.m_iRuleId, m_hKnownDevices.value(iwe.m_iRuleId));
+            else hKnownDevices.insert(iwe.m_iRuleId, iwe.m_hSeedDevices);
+        }
+    }
+    m_hKnownDevices = hKnownDevices;
+    m_iAppliedSeedGeneration = m_pActiveConfig->m_iSeedGeneration;
+
+    return bRulesChanged;
+}
+
+bool QUdevPrivate::waitForFilter(int iGeneration)
+{
+    Q_ASSERT(QThread::currentThread() != m_pHub);
+
+    //wakeups may be spurious or for an older generation, so the remaining time is tracked
+    QElapsedTimer tWait;
+    tWait.start();
+    while(m_iFilterGeneration < iGeneration)
+    {
+        qint64 iRemaining = s_iFilterTimeout - tWait.elapsed();
+        if((iRemaining <= 0) || (false == m_FilterApplied.wait(&m_Mutex, static_cast<unsigned long>(iRemaining))))
+        {
+            if(m_iFilterGeneration >= iGeneration) break;
+            qWarning() << QString("QUdevPrivate::waitForFilter() the monitoring thread did not apply the filter within %1ms").arg(s_iFilterTimeout);
+            return false;
+        }
+    }
+    return true;
+}
+
+void QUdevPrivate::notifyFilterApplied()
+{
+    //a registry seed may be waiting for the filter
+    QMutexLocker l(&m_Mutex);
+    m_iFilterGeneration = m_iAppliedRulesGeneration;
+    m_FilterApplied.wakeAll();
+    Q_UNUSED(l);
+}
+
+void QUdevPrivate::deliverEvent(const QUdevEvent &e, int iRuleId, QUdevSubscriptionData *pSubscription, qint64 iReceived)
+{
+    if(m_pActiveConfig->m_bCoalesceEvents) coalesceEvent(e, iRuleId, pSubscription, iReceived);
+    else emitEvent(e, pSubscription, iReceived);
+}
+
+void QUdevPrivate::coalesceEvent(const QUdevEvent &e, int iRuleId, QUdevSubscriptionData *pSubscription, qint64 iReceived)
+{
+    QPair<int, QString> key = qMakePair(iRuleId, e.m_udDev.getSysfsPath());
+
+    QHash<QPair<int, QString>, qint64>::iterator itIndex = m_hCoalescedIndex.find(key);
+    if(itIndex != m_hCoalescedIndex.end())
+    {
+        QMap<qint64, QUdevCoalescedEvent>::iterator it = m_mCoalescedEvents.find(itIndex.value());
+        QUdevEvent &pending = it.value().m_Event;
+
+        //a device appearing and vanishing within the window is not reported at all
+        if((eDeviceAdd == pending.m_ueAction) && (eDeviceRemove == e.m_ueAction))
+        {
+            m_Statistics.add(eCntCoalesced, pending.m_iRawEvents + e.m_iRawEvents);
+            m_mCoalescedEvents.erase(it);
+            m_hCoalescedIndex.erase(itIndex);
+            return;
+        }
+
+        //changes fold into a pending add or change, a remove supersedes pending changes
+        bool bFold = ((eDeviceChange == e.m_ueAction) && ((eDeviceAdd == pending.m_ueAction) || (eDeviceChange == pending.m_ueAction)))
+                  || ((eDeviceRemove == e.m_ueAction) && (eDeviceChange == pending.m_ueAction));
+        if(bFold)
+        {
+            QUdevEventAction ueAction = (eDeviceRemove == e.m_ueAction) ? eDeviceRemove : pending.m_ueAction;
+            int iRawEvents = pending.m_iRawEvents + e.m_iRawEvents;
+            QVector<int> vMatchedRules = pending.m_vMatchedRules;
+
+            m_Statistics.add(eCntCoalesced, e.m_iRawEvents);
+
+            //the latest event carries the current device data, the latency is measured from the first one
+            pending = e;
+            pending.m_ueAction = ueAction;
+            pending.m_iRawEvents = iRawEvents;
+
+            //a merged event reports every rule any of the folded events matched
+            foreach(int iRuleId, vMatchedRules)
+            {
+                if(false == pending.m_vMatchedRules.contains(iRuleId)) pending.m_vMatchedRules.append(iRuleId);
+            }
+            return;
+        }
+
+        //anything else ends the pending sequence of the device, its events keep their order
+        QUdevEvent previous = pending;
+        qint64 iPreviousReceived = it.value().m_iReceived;
+        m_mCoalescedEvents.erase(it);
+        m_hCoalescedIndex.erase(itIndex);
+        emitEvent(previous, pSubscription, iPreviousReceived);
+    }
+
+    QUdevCoalescedEvent coalesced;
+    coalesced.m_Key = key;
+    coalesced.m_Event = e;
+    coalesced.m_pSubscription = pSubscription;
+    coalesced.m_iDeadline = m_tClock.elapsed() + m_pActiveConfig->m_iCoalesceWindow;
+    coalesced.m_iReceived = iReceived;
+
+    m_mCoalescedEvents.insert(m_iCoalesceSequence, coalesced);
+    m_hCoalescedIndex.insert(key, m_iCoalesceSequence);
+    ++m_iCoalesceSequence;
+}
+
+void QUdevPrivate::releaseCoalescedEvents(bool bAll)
+{
+    qint64 iNow = m_tClock.elapsed();
+
+    //the window is fixed per event, so the oldest event is always the first one due
+    while(false == m_mCoalescedEvents.isEmpty())
+    {
+        QMap<qint64, QUdevCoalescedEvent>::iterator it = m_mCoalescedEvents.begin();
+        if((false == bAll) && (it.value().m_iDeadline > iNow)) break;
+
+        QUdevEvent e = it.value().m_Event;
+        QExplicitlySharedDataPointer<QUdevSubscriptionData> pSubscription = it.value().m_pSubscription;
+        qint64 iReceived = it.value().m_iReceived;
+        m_hCoalescedIndex.remove(it.value().m_Key);
+        m_mCoalescedEvents.erase(it);
+        emitEvent(e, pSubscription.data(), iReceived);
+    }
+}
+
+void QUdevPrivate::emitEvent(const QUdevEvent &e, QUdevSubscriptionData *pSubscription, qint64 iReceived)
+{
+    Q_Q(QUdev);
+
+    //subscribers get their events one by one, only the matching subscriber sees the event
+    if(pSubscription)
+    {
+        if(pSubscription->deliver(e, m_Statistics)) m_bEventsStaged = true;
+        m_Statistics.add(eCntEmitted);
+        m_Statistics.record(eHistLatency, getClockUs() - iReceived);
+        return;
+    }
+
+    //the thread of the QUdev object emits the queued events, batching them there if requested
+    QUdevEventQueue *pQueue = getSignalQueue();
+    if(pQueue)
+    {
+        queueSignalEvent(pQueue, e);
+        m_Statistics.add(eCntEmitted);
+        m_Statistics.record(eHistLatency, getClockUs() - iReceived);
+        return;
+    }
+
+    if(false == m_pActiveConfig->m_bBatchDelivery)
+    {
+        emit q->newUDevEvent(e);
+        m_Statistics.add(eCntEmitted);
+        m_Statistics.record(eHistLatency, getClockUs() - iReceived);
+        return;
+    }
+
+    //the latency window starts with the first event of a batch
+    if(m_vPendingEvents.isEmpty()) m_tBatchAge.start();
+    m_vPendingEvents.append(e);
+    m_vPendingReceived.append(iReceived);
+
+    if(m_vPendingEvents.size() >= m_pActiveConfig->m_iBatchMaxSize) flushPendingEvents();
+}
+
+void QUdevPrivate::flushPendingEvents()
+{
+    Q_Q(QUdev);
+
+    if(m_vPendingEvents.isEmpty()) return;
+
+    QVector<QUdevEvent> vEvents;
+    vEvents.swap(m_vPendingEvents);
+    QVector<qint64> vReceived;
+    vReceived.swap(m_vPendingReceived);
+
+    //the batch was collected before the signal queue was enabled
+    QUdevEventQueue *pQueue = getSignalQueue();
+    if(pQueue)
+    {
+        foreach(const QUdevEvent &e, vEvents)
+        {
+            queueSignalEvent(pQueue, e);
+        }
+    }
+    else
+    {
+        emit q->newUDevEvents(vEvents);
+    }
+
+    m_Statistics.add(eCntEmitted, vEvents.size());
+    qint64 iNow = getClockUs();
+    foreach(qint64 iReceived, vReceived)
+    {
+        m_Statistics.record(eHistLatency, iNow - iReceived);
+    }
+}
+
+QUdevEventQueue *QUdevPrivate::getSignalQueue()
+{
+    const QExplicitlySharedDataPointer<QUdevEventQueue> &pQueue = m_pActiveConfig->m_pSignalQueue;
+    if(pQueue == m_pSignalQueue) return pQueue.data();
+
+    //the consumer still drains the replaced queue, only its held back events have to be handed over
+    QList<QUdevEvent> lStaged;
+    if(m_pSignalQueue) lStaged = m_pSignalQueue->takeStaged();
+    m_pSignalQueue = pQueue;
+
+    foreach(const QUdevEvent &e, lStaged)
+    {
+        emitEvent(e, 0, getClockUs());
+    }
+    return pQueue.data();
+}
+
+void QUdevPrivate::queueSignalEvent(QUdevEventQueue *pQueue, const QUdevEvent &e)
+{
+    if(pQueue->push(e, m_Statistics)) QCoreApplication::postEvent(m_pQueueReceiver, new QUdevQueueWakeupEvent(pQueue));
+    if(pQueue->hasStaged()) m_bEventsStaged = true;
+}
+
+void QUdevPrivate::drainSignalQueue(QUdevEventQueue *pQueue)
+{
+    Q_Q(QUdev);
+
+    bool bBatchDelivery;
+    int iBatchMaxSize;
+    {
+        QMutexLocker l(&m_Mutex);
+        bBatchDelivery = m_Config.m_bBatchDelivery;
+        iBatchMaxSize = m_Config.m_iBatchMaxSize;
+        Q_UNUSED(l);
+    }
+
+    pQueue->beginDrain();
+
+    //events queued after beginDrain() post a new wakeup, so one round is enough and the event loop stays responsive
+    QVector<QUdevEvent> vEvents;
+    QUdevEvent e;
+    for(int i = pQueue->getCapacity(); (i > 0) && pQueue->pop(e); --i)
+    {
+        if(false == bBatchDelivery)
+        {
+            emit q->newUDevEvent(e);
+            continue;
+        }
+
+        vEvents.append(e);
+        if(vEvents.size() >= iBatchMaxSize)
+        {
+            emit q->newUDevEvents(vEvents);
+            vEvents.clear();
+        }
+    }
+
+    if(false == vEvents.isEmpty()) emit q->newUDevEvents(vEvents);
+}
+
+void QUdevPrivate::processEventQueues()
+{
+    Q_Q(QUdev);
+
+    //offer the held back events to their queues again, the consumers may have made room meanwhile
+    if(m_bEventsStaged)
+    {
+        m_bEventsStaged = false;
+
+        QUdevEventQueue *pQueue = getSignalQueue();
+        if(pQueue)
+        {
+            if(pQueue->flushStaged()) QCoreApplication::postEvent(m_pQueueReceiver, new QUdevQueueWakeupEvent(pQueue));
+            if(pQueue->hasStaged()) m_bEventsStaged = true;
+        }
+
+        foreach(const QUdevInternalWatcherEntry &iwe, m_pActiveConfig->m_lRules)
+        {
+            if(iwe.m_pSubscription && iwe.m_pSubscription->flushQueue()) m_bEventsStaged = true;
+        }
+    }
+
+    //report the queue overflows, at most every s_iQueueReportInterval during a storm
+    int iDrops = m_Statistics.get(eCntQueueDropped);
+    int iCoalesced = m_Statistics.get(eCntQueueCoalesced);
+    if((iDrops == m_iReportedQueueDrops) && (iCoalesced == m_iReportedQueueCoalesced)) return;
+
+    qint64 iNow = m_tClock.elapsed();
+    if(iNow < m_iNextQueueReport) return;
+
+    m_iNextQueueReport = iNow + s_iQueueReportInterval;
+    m_iReportedQueueDrops = iDrops;
+    m_iReportedQueueCoalesced = iCoalesced;
+    emit q->eventQueueOverflow(iDrops, iCoalesced);
+}
+
+int QUdevPrivate::getQueueTimeout()
+{
+    int iTimeout = m_bEventsStaged ? s_iStagedRetryInterval : -1;
+
+    bool bUnreported = (m_Statistics.get(eCntQueueDropped) != m_iReportedQueueDrops) ||
+                       (m_Statistics.get(eCntQueueCoalesced) != m_iReportedQueueCoalesced);
+    if(bUnreported)
+    {
+        qint64 iRemaining = m_iNextQueueReport - m_tClock.elapsed();
+        int iReportTimeout = (iRemaining > 0) ? static_cast<int>(iRemaining) : 0;
+        if((iTimeout < 0) || (iReportTimeout < iTimeout)) iTimeout = iReportTimeout;
+    }
+
+    return iTimeout;
+}
+
+void QUdevPrivate::flushAllEvents()
+{
+    releaseCoalescedEvents(true);
+    flushPendingEvents();
+    m_Statistics.setQueueDepth(0);
+}
+
+void QUdevPrivate::processDueEvents()
+{
+    Q_Q(QUdev);
+
+    //snapshots handed over meanwhile replay their held events first, the rule may not be adopted yet though
+    if(m_iSnapshotsPending.fetchAndAddAcquire(0) > 0)
+    {
+        foreach(const QUdevInternalWatcherEntry &iwe, m_pActiveConfig->m_lRules)
+        {
+            if(iwe.m_pSnapshotGate && (QUdevSnapshotGate::eGateReleased == iwe.m_pSnapshotGate->getState())) openSnapshotGate(iwe);
+        }
+    }
+
+    //coalescing was switched off meanwhile, release everything
+    releaseCoalescedEvents(false == m_pActiveConfig->m_bCoalesceEvents);
+    if(0 == getBatchTimeout()) flushPendingEvents();
+
+    processEventQueues();
+
+    m_Statistics.setQueueDepth(m_vPendingEvents.size() + m_mCoalescedEvents.size());
+
+    //push the statistics if requested
+    if(m_pActiveConfig->m_iStatisticsInterval > 0)
+    {
+        qint64 iNow = m_tClock.elapsed();
+        if(iNow >= m_iNextStatistics)
+        {
+            m_iNextStatistics = iNow + m_pActiveConfig->m_iStatisticsInterval;
+            emit q->statisticsUpdated(getStatistics());
+        }
+    }
+}
+
+QVariantMap QUdevPrivate::getStatistics()
+{
+    QVariantMap mStatistics = m_Statistics.toVariantMap();
+    mStatistics.insert(QString("overflows"), getOverflowCount());
+    return mStatistics;
+}
+
+void QUdevPrivate::setStatisticsInterval(int iIntervalMs)
+{
+    QMutexLocker l(&m_Mutex);
+    m_Config.m_iStatisticsInterval = qMax(0, iIntervalMs);
+    publishConfig();
+    Q_UNUSED(l);
+}
+
+qint64 QUdevPrivate::getClockUs() const
+{
+    return m_tClock.nsecsElapsed() / 1000;
+}
+
+int QUdevPrivate::getNextTimeout()
+{
+    int iTimeout = getBatchTimeout();
+
+    if(false == m_mCoalescedEvents.isEmpty())
+    {
+        int iCoalesceTimeout = 0;
+        if(m_pActiveConfig->m_bCoalesceEvents)
+        {
+            qint64 iRemaining = m_mCoalescedEvents.begin().value().m_iDeadline - m_tClock.elapsed();
+            iCoalesceTimeout = (iRemaining > 0) ? static_cast<int>(iRemaining) : 0;
+        }
+        if((iTimeout < 0) || (iCoalesceTimeout < iTimeout)) iTimeout = iCoalesceTimeout;
+    }
+
+    if(m_pActiveConfig->m_iStatisticsInterval > 0)
+    {
+        qint64 iRemaining = m_iNextStatistics - m_tClock.elapsed();
+        int iStatisticsTimeout = (iRemaining > 0) ? static_cast<int>(iRemaining) : 0;
+        if((iTimeout < 0) || (iStatisticsTimeout < iTimeout)) iTimeout = iStatisticsTimeout;
+    }
+
+    int iQueueTimeout = getQueueTimeout();
+    if((iQueueTimeout >= 0) && ((iTimeout < 0) || (iQueueTimeout < iTimeout))) iTimeout = iQueueTimeout;
+
+    return iTimeout;
+}
+
+int QUdevPrivate::getBatchTimeout()
+{
+    //nothing pending, wait forever
+    if(m_vPendingEvents.isEmpty()) return -1;
+
+    //batching was switched off meanwhile, deliver the remaining events immediately
+    if(false == m_pActiveConfig->m_bBatchDelivery) return 0;
+
+    qint64 iRemaining = m_pActiveConfig->m_iBatchMaxLatency - m_tBatchAge.elapsed();
+    return (iRemaining > 0) ? static_cast<int>(iRemaining) : 0;
+}
+
+void QUdevPrivate::setEventCoalescing(bool bEnabled)
+{
+    QMutexLocker l(&m_Mutex);
+    m_Config.m_bCoalesceEvents = bEnabled;
+    publishConfig();
+    Q_UNUSED(l);
+}
+
+void QUdevPrivate::setCoalescingWindow(int iWindowMs)
+{
+    QMutexLocker l(&m_Mutex);
+    m_Config.m_iCoalesceWindow = qMax(0, iWindowMs);
+    publishConfig();
+    Q_UNUSED(l);
+}
+
+void QUdevPrivate::setBatchDelivery(bool bEnabled)
+{
+    QMutexLocker l(&m_Mutex);
+    m_Config.m_bBatchDelivery = bEnabled;
+    publishConfig();
+    Q_UNUSED(l);
+}
+
+void QUdevPrivate::setEventQueue(int iCapacity, QUdevOverflowPolicy ePolicy)
+{
+    QMutexLocker l(&m_Mutex);
+    m_Config.m_iQueueCapacity = qMax(0, iCapacity);
+    m_Config.m_eOverflowPolicy = ePolicy;
+
+    //the monitoring thread switches over to the new queue, the consumer still drains the old one
+    m_Config.m_pSignalQueue.reset();
+    if(m_Config.m_iQueueCapacity > 0)
+    {
+        m_Config.m_pSignalQueue = new QUdevEventQueue(m_Config.m_iQueueCapacity, ePolicy);
+        m_lEventQueues.append(m_Config.m_pSignalQueue);
+    }
+
+    publishConfig();
+    Q_UNUSED(l);
+}
+
+void QUdevPrivate::setMergedDelivery(bool bEnabled)
+{
+    QMutexLocker l(&m_Mutex);
+    m_Config.m_bMergeMatches = bEnabled;
+    publishConfig();
+    Q_UNUSED(l);
+}
+
+int QUdevPrivate::getMonitorRuleId(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                   const QStringList &lTags, const QUdevPropertyMap &mProperties)
+{
+    QUdevInternalWatcherEntry iwe(strSubSystem, strDeviceType, strParentSubSystem, strParentDeviceType, lTags, mProperties);
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+
+    int iIndex = m_Config.m_lRules.indexOf(iwe);
+    return (iIndex < 0) ? -1 : m_Config.m_lRules.at(iIndex).m_iRuleId;
+}
+
+void QUdevPrivate::setBatchMaxSize(int iMaxEvents)
+{
+    QMutexLocker l(&m_Mutex);
+    m_Config.m_iBatchMaxSize = qMax(1, iMaxEvents);
+    publishConfig();
+    Q_UNUSED(l);
+}
+
+void QUdevPrivate::setBatchMaxLatency(int iMaxLatencyMs)
+{
+    //the monitoring thread recalculates its poll() timeout when it takes over the new configuration
+    QMutexLocker l(&m_Mutex);
+    m_Config.m_iBatchMaxLatency = qMax(0, iMaxLatencyMs);
+    publishConfig();
+    Q_UNUSED(l);
+}
+
+bool QUdevPrivate::setReceiveBufferSize(int iBytes)
+{
+    return m_pHub->setReceiveBufferSize(iBytes);
+}
+
+void QUdevPrivate::setAutoResync(bool bEnabled)
+{
+    QList<QUdevInternalWatcherEntry> lRules;
+    {
+        QMutexLocker l(&m_Mutex);
+        if(m_Config.m_bAutoResync == bEnabled) return;
+        //rules added from now on are seeded by addNewMonitorRule()
+        m_Config.m_bAutoResync = bEnabled;
+        lRules = m_Config.m_lRules;
+        Q_UNUSED(l);
+    }
+
+    //seed the known devices of all present rules outside of the lock
+    QHash<int, QHash<QString, QUdevDevice> > hSeeds;
+    if(bEnabled)
+    {
+        foreach(const QUdevInternalWatcherEntry &rule, lRules)
+        {
+            hSeeds.insert(rule.m_iRuleId, enumerateKnownDevices(rule));
+        }
+    }
+
+    QMutexLocker l(&m_Mutex);
+    for(int i = 0; i < m_Config.m_lRules.size(); ++i)
+    {
+        QUdevInternalWatcherEntry &iwe = m_Config.m_lRules[i];
+        //keep the seed of rules added during the scan
+        if(hSeeds.contains(iwe.m_iRuleId) || !bEnabled) iwe.m_hSeedDevices = hSeeds.value(iwe.m_iRuleId);
+    }
+    ++m_Config.m_iSeedGeneration;
+    publishConfig();
+    Q_UNUSED(l);
+}
+
+int QUdevPrivate::getOverflowCount()
+{
+    QMutexLocker l(&m_Mutex);
+    Q_UNUSED(l);
+    return m_iOverflowCount;
+}
+
+QHash<QString, QUdevDevice> QUdevPrivate::enumerateKnownDevices(const QUdevInternalWatcherEntry &iwe)
+{
+    //the resync runs on the monitoring thread while the owner uses m_pUdev, so the context is the one of the calling thread
+    QUdevDeviceCollector collector;
+    enumerateDevices(QUdevThreadContext::get(), iwe, &collector, INT_MAX);
+
+    QHash<QString, QUdevDevice> hDevices;
+    foreach(const QUdevDevice &udDev, collector.m_lDevices)
+    {
+        hDevices.insert(udDev.getSysfsPath(), udDev);
+    }
+    return hDevices;
+}
+
+void QUdevPrivate::handleOverflow()
+{
+    Q_Q(QUdev);
+
+    int iOverflowCount;
+    {
+        QMutexLocker l(&m_Mutex);
+        iOverflowCount = ++m_iOverflowCount;
+        Q_UNUSED(l);
+    }
+
+    qWarning() << QString("QUdevPrivate::handleOverflow() udev events were lost (overflow #%1)").arg(iOverflowCount);
+
+    //a replay has to lose the same events
+    if(0 != m_iRecording.fetchAndAddAcquire(0)) recordEvent(0);
+
+    //we may have missed remove events, so nothing in the parent cache can be trusted anymore
+    m_cParentCache.clear();
+
+    //the same holds for the registry, its subsystems are enumerated again
+    foreach(const QString &strSubsystem, m_pActiveConfig->m_lRegistrySubsystems)
+    {
+        m_pRegistry->resetSubsystem(strSubsystem, enumerateRegistryDevices(strSubsystem));
+    }
+
+    //events received before the overflow must reach the consumers before the notification
+    flushAllEvents();
+    emit q->monitorOverflow(iOverflowCount);
+
+    if(false == m_pActiveConfig->m_bAutoResync) return;
+
+    //scan sysfs again and report the difference to what the consumers know so far
+    foreach(const QUdevInternalWatcherEntry &rule, m_pActiveConfig->m_lRules)
+    {
+        //the consumers do not know the snapshot yet, the rule is resynchronized once its held events are replayed
+        if(rule.m_pSnapshotGate && (false == rule.m_pSnapshotGate->isOpen()))
+        {
+            rule.m_pSnapshotGate->markOverflow();
+            continue;
+        }
+
+        resyncRule(rule);
+    }
+}
+
+void QUdevPrivate::resyncRule(const QUdevInternalWatcherEntry &rule)
+{
+    QHash<QString, QUdevDevice> hCurrent = enumerateKnownDevices(rule);
+    QHash<QString, QUdevDevice> &hKnownDevices = m_hKnownDevices[rule.m_iRuleId];
+
+    QHash<QString, QUdevDevice>::const_iterator it;
+    for(it = hKnownDevices.constBegin(); it != hKnownDevices.constEnd(); ++it)
+    {
+        if(hCurrent.contains(it.key())) continue;
+
+        QUdevEvent e;
+        e.m_ueAction = eDeviceRemove;
+        e.m_udDev = it.value();
+        deliverEvent(e, rule.m_iRuleId, rule.m_pSubscription.data(), getClockUs());
+    }
+
+    for(it = hCurrent.constBegin(); it != hCurrent.constEnd(); ++it)
+    {
+        if(hKnownDevices.contains(it.key())) continue;
+
+        QUdevEvent e;
+        e.m_ueAction = eDeviceAdd;
+        e.m_udDev = it.value();
+        deliverEvent(e, rule.m_iRuleId, rule.m_pSubscription.data(), getClockUs());
+    }
+
+    hKnownDevices = hCurrent;
+}
+
+void QUdevPrivate::openSnapshotGate(const QUdevInternalWatcherEntry &iwe)
+{
+    QHash<QString, QUdevDevice> hSnapshot;
+    QList<QUdevEvent> lHeld;
+    QList<qint64> lReceived;
+    bool bOverflow = false;
+    if(false == iwe.m_pSnapshotGate->open(hSnapshot, lHeld, lReceived, bOverflow)) return;
+    m_iSnapshotsPending.fetchAndAddOrdered(-1);
+
+    //the consumers know the snapshot, the events received during the enumeration follow it
+    if(m_pActiveConfig->m_bAutoResync) m_hKnownDevices[iwe.m_iRuleId] = hSnapshot;
+    for(int i = 0; i < lHeld.size(); ++i)
+    {
+        trackKnownDevice(iwe.m_iRuleId, lHeld.at(i));
+        deliverEvent(lHeld.at(i), iwe.m_iRuleId, iwe.m_pSubscription.data(), lReceived.at(i));
+    }
+
+    //events lost meanwhile are recovered like after any overflow
+    if(bOverflow && m_pActiveConfig->m_bAutoResync) resyncRule(iwe);
+}
+
+void QUdevPrivate::setDeviceRegistryEnabled(bool bEnabled)
+{
+    QMutexLocker l(&m_Mutex);
+    if(m_Config.m_bRegistryEnabled == bEnabled) return;
+
+    m_Config.m_bRegistryEnabled = bEnabled;
+    if(false == bEnabled)
+    {
+        //stop tracking, the socket filter is rebuilt without the registry subsystems
+        m_pRegistry->clear();
+        m_Config.m_lRegistrySubsystems.clear();
+        m_Config.m_sRegistryAtoms.clear();
+        ++m_Config.m_iRulesGeneration;
+    }
+    publishConfig();
+    Q_UNUSED(l);
+}
+
+bool QUdevPrivate::addDeviceRegistrySubsystem(const QString &strSubSystem)
+{
+    return seedRegistry(strSubSystem);
+}
+
+QUdevDevice QUdevPrivate::getDeviceBySysfsPath(const QString &strSysfsPath)
+{
+    return m_pRegistry->findBySysfsPath(strSysfsPath);
+}
+
+QUdevDevice QUdevPrivate::getDeviceByDevPath(const QString &strDevPath)
+{
+    return m_pRegistry->findByDevPath(strDevPath);
+}
+
+QUdevDeviceList QUdevPrivate::getDevicesBySerial(const QString &strSerial)
+{
+    return m_pRegistry->findBySerial(strSerial);
+}
+
+bool QUdevPrivate::seedRegistry(const QString &strSubSystem)
+{
+    if(strSubSystem.isEmpty()) return false;
+
+    //the monitoring thread cannot wait for its own filter, the query is answered by an enumeration instead
+    if(QThread::currentThread() == m_pHub) return false;
+
+    {
+        QMutexLocker l(&m_Mutex);
+        if(false == m_Config.m_bRegistryEnabled) return false;
+        if(false == m_pRegistry->beginSeed(strSubSystem)) return false;
+
+        //let the monitor receive the events of the subsystem
+        m_Config.m_lRegistrySubsystems.append(strSubSystem);
+        m_Config.m_sRegistryAtoms.insert(internAtom(strSubSystem));
+        int iGeneration = ++m_Config.m_iRulesGeneration;
+        m_Config.m_bMonitoringActive = true;
+        publishConfig();
+
+        //changes between the enumeration and the new socket filter would get lost, so wait for the filter
+        if(false == waitForFilter(iGeneration))
+        {
+            m_Config.m_lRegistrySubsystems.removeAll(strSubSystem);
+            m_Config.m_sRegistryAtoms.remove(internAtom(strSubSystem));
+            ++m_Config.m_iRulesGeneration;
+            publishConfig();
+            m_pRegistry->abortSeed(strSubSystem);
+            return false;
+        }
+        Q_UNUSED(l);
+    }
+
+    //events received meanwhile are newer than the enumeration and win
+    m_pRegistry->finishSeed(strSubSystem, enumerateRegistryDevices(strSubSystem));
+    return true;
+}
+
+QList<QUdevDeviceRegistry::QUdevRegistryDevice> QUdevPrivate::enumerateRegistryDevices(const QString &strSubSystem)
+{
+    struct udev_list_entry *devices = 0;
+    struct udev_list_entry *dev_list_entry = 0;
+
+    QList<QUdevDeviceRegistry::QUdevRegistryDevice> lDevices;
+
+    //called by the seeding thread and by the monitoring thread after an overflow, each with its own context
+    struct udev *pUdev = QUdevThreadContext::get();
+
+    struct udev_enumerate *enumerate = udev_enumerate_new(pUdev);
+    udev_enumerate_add_match_subsystem(enumerate, strSubSystem.toLatin1().constData());
+    udev_enumerate_scan_devices(enumerate);
+    devices = udev_enumerate_get_list_entry(enumerate);
+
+    udev_list_entry_foreach(dev_list_entry, devices)
+    {
+        struct udev_device *dev = udev_device_new_from_syspath(pUdev, udev_list_entry_get_name(dev_list_entry));
+        if(0 == dev) continue;
+
+        lDevices.append(createRegistryDevice(QUdevLibudevEvent(dev), QExplicitlySharedDataPointer<QUdevDeviceAttributes>()));
+        udev_device_unref(dev);
+    }
+    udev_enumerate_unref(enumerate);
+
+    return lDevices;
+}
+
+QUdevDeviceRegistry::QUdevRegistryDevice QUdevPrivate::createRegistryDevice(const QUdevBackendEvent &ev, QExplicitlySharedDataPointer<QUdevDeviceAttributes> pAttributes)
+{
+    QUdevDeviceData *pData = new QUdevDeviceData;
+    pData->m_strSysfsPath = QString::fromLatin1(ev.getSysPath());
+    pData->m_strDevPath = QString::fromLatin1(ev.getDevNode());
+    pData->m_strSubsystem = QString::fromLatin1(ev.getSubsystem());
+    pData->m_strDeviceType = QString::fromLatin1(ev.getDevType());
+    pData->m_pAttributes = pAttributes ? pAttributes : QExplicitlySharedDataPointer<QUdevDeviceAttributes>(new QUdevDeviceAttributes(pData->m_strSysfsPath));
+    pData->setProperties(ev);
+
+    //the serial is taken from the udev database, so no sysfs access is needed
+    const char *pcSerial = ev.getPropertyValue("ID_SERIAL_SHORT");
+    if(0 == pcSerial) pcSerial = ev.getPropertyValue("ID_SERIAL");
+
+    return qMakePair(QUdevDevice(pData), QString::fromLatin1(pcSerial));
+}
+
+void QUdevPrivate::updateRegistry(const QUdevBackendEvent &ev, const char *pcAction, QExplicitlySharedDataPointer<QUdevDeviceAttributes> &pOwnAttributes)
+{
+    QString strSysfsPath = QString::fromLatin1(ev.getSysPath());
+
+    if(pcAction && (0 == qstrcmp(pcAction, "remove")))
+    {
+        m_pRegistry->removeDevice(strSysfsPath);
+        return;
+    }
+
+    //a renamed device is only registered with its new path
+    if(pcAction && (0 == qstrcmp(pcAction, "move")))
+    {
+        const char *pcOldDevPath = ev.getPropertyValue("DEVPATH_OLD");
+        if(pcOldDevPath)
+        {
+            //the syspath is the sysfs mount point followed by the devpath
+            QString strSysfsMount = strSysfsPath.left(strSysfsPath.size() - qstrlen(ev.getDevPath()));
+            m_pRegistry->removeDevice(strSysfsMount + QString::fromLatin1(pcOldDevPath));
+        }
+    }
+
+    if(!pOwnAttributes) pOwnAttributes = new QUdevDeviceAttributes(strSysfsPath);
+
+    QUdevDeviceRegistry::QUdevRegistryDevice device = createRegistryDevice(ev, pOwnAttributes);
+    m_pRegistry->updateDevice(device.first, device.second);
+}
+
+QUdevEventAction QUdevPrivate::getQUdevEventActionFromUdevAction(const char *pcUdevAction) const
+{
+    //compared in place, the received action is not converted to a QString
+    if(pcUdevAction)
+    {
+        QLatin1String strUdevAction(pcUdevAction);
+        for(QMap<QString, QUdevEventAction>::const_iterator it = m_mUdevActions.constBegin(); it != m_mUdevActions.constEnd(); ++it)
+        {
+            if(it.key() == strUdevAction) return it.value();
+        }
+    }
+
+    return eDeviceUnknownAction;
 }
@@ -23,8 +23,19 @@
 #include <libudev.h>
 
 #include "QUdevDeclarations.h"
+#include "QUdevDevice_private.h"
+#include "QUdevDeviceRegistry_private.h"
+#include "QUdevStatistics_private.h"
+#include "QUdevBackend_private.h"
+#include "QUdevTrace_private.h"
+#include "QUdevSubscription_private.h"
+#include "QUdevEventQueue_private.h"
+#include "QUdevSnapshotGate_private.h"
 
 class QUdev;
+class QUdevEnumerationChunker;
+class QUdevEnumerationJob;
+class QUdevMonitorHub;
 
 /**
  * Internal QUdev implementation
@@ -32,15 +43,20 @@ class QUdev;
  * This class can enumerate current available devices based on given subsystem and devicetype information.
  * It can also be used to monitor for multiple subsystem/devicetype combination to be notified if any of
  * these devices produces an udev event.
+ *
+ * The monitor socket and thread are provided by the QUdevMonitorHub of the monitor group, which calls the
+ * "monitoring thread only" methods of all its attached instances.
  */
-class QUdevPrivate : public QThread
+class QUdevPrivate
 {
     public:
 
         /**
          * Default constructor
+         *
+         * @param strMonitorGroup The monitor group whose socket and thread are used
          */
-        explicit QUdevPrivate(QUdev *parent);
+        QUdevPrivate(QUdev *parent, const QString &strMonitorGroup);
 
         /**
          * Default destructor
@@ -78,6 +94,31 @@ class QUdevPrivate : public QThread
          */
         QUdevDeviceList getUDevDevicesForSubsystem(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType);
 
+        /**
+         * Hand all devices matching the given parameters to the visitor while the enumeration walks sysfs
+         *
+         * @return The number of devices handed to the visitor
+         */
+        int visitUDevDevicesForSubsystem(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                         QUdevDeviceVisitor *pVisitor, int iChunkSize);
+
+        /**
+         * Run several queries with one single sysfs scan
+         *
+         * @return One device list per query, in the order of lQueries
+         */
+        QList<QUdevDeviceList> getUDevDevicesForQueries(const QList<QUdevDeviceQuery> &lQueries);
+
+        /**
+         * Run getUDevDevicesForSubsystem() on the enumeration thread pool
+         */
+        QFuture<QUdevDeviceList> getUDevDevicesForSubsystemAsync(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType);
+
+        /**
+         * Set the number of threads used by one asynchronous enumeration
+         */
+        void setEnumerationParallelism(int iThreads);
+
         /**
          * Add a new monitor rule to the list of monitored udev devices.
          *
@@ -90,10 +131,42 @@ class QUdevPrivate : public QThread
          *        With an empty string this parameter is ignored
          * @param strParentDeviceType The device type for the parent
          *        With an empty string this parameter is ignored
+         * @param lTags The device must carry all of these udev tags
+         * @param mProperties The device must have all of these udev properties with exactly these values
          *
          * @return True if the rule could be added to the monitoring framework. False if the parameters are invalid or such a rule is already present
          */
-        bool addNewMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType);
+        bool addNewMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                               const QStringList &lTags, const QUdevPropertyMap &mProperties);
+
+        /**
+         * Add a monitor rule and enumerate its present devices without losing the events in between
+         *
+         * @param lSnapshot Receives the present devices
+         * @param piSnapshotSeqnum Receives the kernel uevent sequence number when the enumeration started, may be 0
+         *
+         * @return False if the parameters are invalid or such a rule is already present
+         */
+        bool addSnapshotRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                             QUdevDeviceList &lSnapshot, const QStringList &lTags, const QUdevPropertyMap &mProperties, quint64 *piSnapshotSeqnum);
+
+        /**
+         * Add a monitor rule whose events are only handed to the given subscriber
+         *
+         * @param pSubscriber Receives the matching events
+         * @param eMode Call the subscriber on the monitoring thread or from the event loop of the target thread
+         * @param pTargetThread The thread receiving queued events, 0 for the calling thread
+         *
+         * @return The handle of the subscription, invalid if the parameters are invalid
+         */
+        QUdevSubscription addSubscription(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                          QUdevSubscriber *pSubscriber, QUdevDeliveryMode eMode, QThread *pTargetThread,
+                                          const QStringList &lTags, const QUdevPropertyMap &mProperties);
+
+        /**
+         * Remove the rule of an ended subscription
+         */
+        void removeSubscription(QUdevSubscriptionData *pSubscription);
 
         /**
          * Remove an existing monitor rule from the list of monitored udev devices.
@@ -102,19 +175,125 @@ class QUdevPrivate : public QThread
          * @param strDeviceType The desired devicetype
          * @param strParentSubSystem The parent subsystem
          * @param strParentDeviceType The device type for the parent
+         * @param lTags The required tags of the rule
+         * @param mProperties The required properties of the rule
          *
          * @return True if the rule could be removed from the monitoring framework. False if such a rule could not be found in the current monitor list
          */
-        bool removeMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType);
+        bool removeMonitorRule(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                               const QStringList &lTags, const QUdevPropertyMap &mProperties);
 
-    private:
+        /**
+         * Switch between per event delivery (newUDevEvent) and batched delivery (newUDevEvents)
+         */
+        void setBatchDelivery(bool bEnabled);
 
-        virtual void run();
+        /**
+         * Emit one event per udev event carrying all matched rules instead of one event per matched rule
+         */
+        void setMergedDelivery(bool bEnabled);
 
         /**
-         * Translate the udev action strings to our internal enumeration members
+         * Hand the events to the consumers through bounded queues (0 disables them)
+         */
+        void setEventQueue(int iCapacity, QUdevOverflowPolicy ePolicy);
+
+        /**
+         * Get the id of a rule added with addNewMonitorRule(), -1 if there is no such rule
+         */
+        int getMonitorRuleId(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                             const QStringList &lTags, const QUdevPropertyMap &mProperties);
+
+        /**
+         * Maximum number of events collected before a batch is delivered
+         */
+        void setBatchMaxSize(int iMaxEvents);
+
+        /**
+         * Maximum time in milliseconds the first event of a batch may wait for delivery
+         */
+        void setBatchMaxLatency(int iMaxLatencyMs);
+
+        /**
+         * Enable or disable the coalescing of events per device
+         */
+        void setEventCoalescing(bool bEnabled);
+
+        /**
+         * Set the coalescing window in milliseconds
          */
-        QUdevEventAction getQUdevEventActionFromUdevAction(const QString &strUdevAction) const;
+        void setCoalescingWindow(int iWindowMs);
+
+        /**
+         * Get the runtime statistics
+         */
+        QVariantMap getStatistics();
+
+        /**
+         * Set the interval of statisticsUpdated() in milliseconds (0 to disable)
+         */
+        void setStatisticsInterval(int iIntervalMs);
+
+        /**
+         * Start recording the received events into a trace file
+         */
+        bool startRecording(const QString &strTraceFile);
+
+        /**
+         * Stop recording and close the trace file
+         */
+        void stopRecording();
+
+        /**
+         * Set the size of the netlink receive buffer of the monitor socket
+         */
+        bool setReceiveBufferSize(int iBytes);
+
+        /**
+         * Enable or disable the re-enumeration of all monitored rules after an overflow
+         */
+        void setAutoResync(bool bEnabled);
+
+        /**
+         * Get the number of detected receive buffer overflows
+         */
+        int getOverflowCount();
+
+        /**
+         * Set the maximum number of resolved parents kept in the parent cache
+         */
+        void setParentCacheSize(int iEntries);
+
+        /**
+         * Enable or disable the device registry
+         */
+        void setDeviceRegistryEnabled(bool bEnabled);
+
+        /**
+         * Start tracking the given subsystem in the device registry
+         */
+        bool addDeviceRegistrySubsystem(const QString &strSubSystem);
+
+        /**
+         * Registry lookup by sysfs path
+         */
+        QUdevDevice getDeviceBySysfsPath(const QString &strSysfsPath);
+
+        /**
+         * Registry lookup by device node
+         */
+        QUdevDevice getDeviceByDevPath(const QString &strDevPath);
+
+        /**
+         * Registry lookup by serial
+         */
+        QUdevDeviceList getDevicesBySerial(const QString &strSerial);
+
+    private:
+
+        friend class QUdevEnumerationJob;
+        friend class QUdevMonitorHub;
+        friend class QUdevQueueReceiver;
 
         /**
          * This entry defines one rule for events we want to be notified about
@@ -137,20 +316,85 @@ class QUdevPrivate : public QThread
              * The parent devicetype
              */
             QString m_strParentDeviceType;
+            /**
+             * Tags the device must carry
+             */
+            QStringList m_lTags;
+            /**
+             * Properties the device must have
+             */
+            QUdevPropertyMap m_mProperties;
+            /**
+             * Unique id of the rule, assigned when the rule is added
+             */
+            int m_iRuleId;
+            /**
+             * Devices present when the rule was added (or auto resync was enabled), indexed by their sysfs path
+             */
+            QHash<QString, QUdevDevice> m_hSeedDevices;
+
+            /**
+             * The subscription receiving the events of the rule, null for rules emitting the QUdev signals
+             */
+            QExplicitlySharedDataPointer<QUdevSubscriptionData> m_pSubscription;
+
+            /**
+             * Holds the events of a rule added with a snapshot until the snapshot was handed over, null for other rules
+             */
+            QExplicitlySharedDataPointer<QUdevSnapshotGate> m_pSnapshotGate;
 
-            QUdevInternalWatcherEntry(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType)
+            /**
+             * Latin1 copies of the parent constraints handed to libudev for every event
+             */
+            QByteArray m_baParentSubSystem;
+            QByteArray m_baParentDeviceType;
+
+            /**
+             * Latin1 copies of the tag and property constraints
+             */
+            QList<QByteArray> m_lbaTags;
+            QList<QPair<QByteArray, QByteArray> > m_lbaProperties;
+
+            QUdevInternalWatcherEntry(const QString &strSubSystem, const QString &strDeviceType, const QString &strParentSubSystem, const QString &strParentDeviceType,
+                                      const QStringList &lTags = QStringList(), const QUdevPropertyMap &mProperties = QUdevPropertyMap())
               : m_strSubsystem(strSubSystem),
                 m_strDeviceType(strDeviceType),
                 m_strParentSubSystem(strParentSubSystem),
-                m_strParentDeviceType(strParentDeviceType)
+                m_strParentDeviceType(strParentDeviceType),
+                m_lTags(lTags),
+                m_mProperties(mProperties),
+                m_iRuleId(-1),
+                m_baParentSubSystem(strParentSubSystem.toLatin1()),
+                m_baParentDeviceType(strParentDeviceType.toLatin1())
             {
+                //the order of the tags does not matter for duplicate detection
+                m_lTags.removeDuplicates();
+                m_lTags.sort();
 
+                foreach(const QString &strTag, m_lTags)
+                {
+                    m_lbaTags.append(strTag.toLatin1());
+                }
+
+                QUdevPropertyMap::const_iterator it;
+                for(it = m_mProperties.constBegin(); it != m_mProperties.constEnd(); ++it)
+                {
+                    m_lbaProperties.append(qMakePair(it.key().toLatin1(), it.value().toLatin1()));
+                }
+            }
+
+            /**
+             * Parent matching is only done if both parent subsystem and devicetype are given
+             */
+            bool hasParentConstraint() const
+            {
+                return !m_baParentSubSystem.isEmpty() && !m_baParentDeviceType.isEmpty();
             }
 
             /**
              * Comparison operator to identify duplicated monitor entries
              */
-            bool operator==(const QUdevInternalWatcherEntry &Other)
+            bool operator==(const QUdevInternalWatcherEntry &Other) const
             {
                 bool bSame = true;
                 if(this != &Other)
@@ -159,6 +403,10 @@ class QUdevPrivate : public QThread
                     bSame &= (m_strDeviceType == Other.m_strDeviceType);
                     bSame &= (m_strParentSubSystem == Other.m_strParentSubSystem);
                     bSame &= (m_strParentDeviceType == Other.m_strParentDeviceType);
+                    bSame &= (m_lTags == Other.m_lTags);
+                    bSame &= (m_mProperties == Other.m_mProperties);
+                    //several subscribers may use the same rule
+                    bSame &= (m_pSubscription == Other.m_pSubscription);
                 }
                 return bSame;
             }
@@ -166,19 +414,460 @@ class QUdevPrivate : public QThread
         } QUdevInternalWatcherEntry;
 
         /**
-         * Handle to the udev library
+         * Everything the monitoring thread needs to know about rules and settings
+         *
+         * The writer side keeps the current configuration in m_Config (protected by m_Mutex) and publishes
+         * immutable copies of it. The monitoring thread adopts the latest copy on wakeup and reads it without locking.
          */
-        struct udev *m_pUdev;
+        struct QUdevMonitorConfig
+        {
+            QUdevMonitorConfig()
+              : m_bMonitoringActive(false),
+                m_iRulesGeneration(0),
+                m_bMergeMatches(false),
+                m_bBatchDelivery(false),
+                m_iBatchMaxSize(64),
+                m_iBatchMaxLatency(10),
+                m_bAutoResync(false),
+                m_iSeedGeneration(0),
+                m_iParentCacheSize(512),
+                m_bRegistryEnabled(false),
+                m_bCoalesceEvents(false),
+                m_iCoalesceWindow(50),
+                m_iStatisticsInterval(0),
+                m_iQueueCapacity(0),
+                m_eOverflowPolicy(eOverflowDropOldest)
+            {
+
+            }
+
+            /**
+             * Get the atom for a string returned by libudev without converting it (-1 if unknown, 0 for empty/null)
+             */
+            int lookupAtom(const char *pcStr) const;
+
+            /**
+             * Get the position of the string in m_vSortedAtoms, or the position it would have to be inserted at
+             */
+            int findSortedAtom(const char *pcStr) const;
+
+            /**
+             * Hold the status of the monitoring status
+             */
+            bool m_bMonitoringActive;
+
+            /**
+             * All rules for device events we are currently monitoring
+             */
+            QList<QUdevInternalWatcherEntry> m_lRules;
+
+            /**
+             * Indices into m_lRules keyed by the (subsystem, devicetype) atoms of the rules
+             *
+             * Rules with an empty devicetype are stored with devicetype atom 0.
+             */
+            QHash<QPair<int, int>, QVector<int> > m_hRuleIndex;
+
+            /**
+             * Interned subsystem and devicetype strings of all rules ever added, atom i is stored at index i - 1
+             */
+            QVector<QByteArray> m_vAtoms;
+
+            /**
+             * The atoms as QString, matched devices share them instead of converting the received strings
+             */
+            QVector<QString> m_vAtomStrings;
+
+            /**
+             * The atoms ordered by their strings, lookupAtom() searches the received strings without allocating
+             */
+            QVector<int> m_vSortedAtoms;
+
+            /**
+             * Incremented whenever the rules change, the socket filter is rebuilt if it differs from the applied one
+             */
+            int m_iRulesGeneration;
+
+            /**
+             * Emit one event carrying all matched rules per udev event instead of one event per rule
+             */
+            bool m_bMergeMatches;
+
+            /**
+             * Deliver events in batches with newUDevEvents() instead of newUDevEvent()
+             */
+            bool m_bBatchDelivery;
+
+            /**
+             * A batch is delivered as soon as it holds this many events
+             */
+            int m_iBatchMaxSize;
+
+            /**
+             * A batch is delivered at the latest this many milliseconds after its first event
+             */
+            int m_iBatchMaxLatency;
+
+            /**
+             * Re-enumerate all monitored rules after a receive buffer overflow
+             */
+            bool m_bAutoResync;
+
+            /**
+             * Incremented whenever the seed devices of all rules were enumerated again
+             */
+            int m_iSeedGeneration;
+
+            /**
+             * Maximum number of entries in the parent cache
+             */
+            int m_iParentCacheSize;
+
+            /**
+             * Answer queries from the device registry
+             */
+            bool m_bRegistryEnabled;
+
+            /**
+             * Subsystems tracked by the device registry, they are part of the socket filter
+             */
+            QStringList m_lRegistrySubsystems;
+
+            /**
+             * Atoms of m_lRegistrySubsystems
+             */
+            QSet<int> m_sRegistryAtoms;
+
+            /**
+             * Coalesce the events of a device within m_iCoalesceWindow
+             */
+            bool m_bCoalesceEvents;
+
+            /**
+             * Coalescing window in milliseconds, starting with the first event of a device
+             */
+            int m_iCoalesceWindow;
+
+            /**
+             * Interval of statisticsUpdated() in milliseconds, 0 if disabled
+             */
+            int m_iStatisticsInterval;
+
+            /**
+             * Capacity of the event queues, 0 if the events are handed over without queue
+             */
+            int m_iQueueCapacity;
+
+            /**
+             * What happens to the events of a full queue
+             */
+            QUdevOverflowPolicy m_eOverflowPolicy;
+
+            /**
+             * The queue feeding the QUdev signals, null if disabled
+             */
+            QExplicitlySharedDataPointer<QUdevEventQueue> m_pSignalQueue;
+        };
+
+        /**
+         * Publish a copy of m_Config to the monitoring thread and start it if needed (m_Mutex must be held)
+         */
+        void publishConfig();
+
+        /**
+         * Rebuild the rule index of m_Config after the rules changed (m_Mutex must be held)
+         */
+        void rebuildRuleIndex();
+
+        /**
+         * Get the atom for the given string, creating it if needed. The empty string is atom 0. (m_Mutex must be held)
+         */
+        int internAtom(const QString &str);
+
+        /**
+         * Take over the latest published configuration (monitoring thread only)
+         *
+         * @return True if the rules changed and the socket filter has to be rebuilt
+         */
+        bool adoptPendingConfig();
+
+        /**
+         * Tell waiting registry seeds that the socket filter now includes the adopted rules (monitoring thread only)
+         */
+        void notifyFilterApplied();
+
+        /**
+         * Wait until the monitoring thread applied the socket filter of the given rules generation (m_Mutex must be held)
+         *
+         * A snapshot or seed taken before the filter is applied would silently miss events, so the caller has to fail
+         * if the filter is not applied within s_iFilterTimeout. That happens if the monitoring thread waits for a full
+         * queue (eOverflowBlock) drained by the calling thread, it applies the filter only after returning to its loop.
+         * Must not be called by the monitoring thread for the same reason.
+         *
+         * @return False on timeout
+         */
+        bool waitForFilter(int iGeneration);
+
+        /**
+         * Enumerate a subsystem into the device registry after the monitor receives its events (m_Mutex must NOT be held)
+         */
+        bool seedRegistry(const QString &strSubSystem);
+
+        /**
+         * Enumerate all devices of a subsystem for the device registry
+         */
+        QList<QUdevDeviceRegistry::QUdevRegistryDevice> enumerateRegistryDevices(const QString &strSubSystem);
+
+        /**
+         * Create the registry representation of a device
+         *
+         * @param pAttributes The attributes of the device if already created, otherwise they are created
+         */
+        QUdevDeviceRegistry::QUdevRegistryDevice createRegistryDevice(const QUdevBackendEvent &ev, QExplicitlySharedDataPointer<QUdevDeviceAttributes> pAttributes);
 
         /**
-         * Handle to the udev monitor interface
+         * Apply a received event of a tracked subsystem to the device registry (monitoring thread only)
          */
-        struct udev_monitor* m_pMon;
+        void updateRegistry(const QUdevBackendEvent &ev, const char *pcAction, QExplicitlySharedDataPointer<QUdevDeviceAttributes> &pOwnAttributes);
 
         /**
-         * All rules for device events we are currently monitoring
+         * Match a single received device against all monitor rules, emit the resulting events and update the statistics
          */
-        QList<QUdevInternalWatcherEntry> m_lMonitorEntries;
+        void processUdevDevice(const QUdevBackendEvent &ev);
+
+        /**
+         * Match a single received device against all monitor rules and emit the resulting events
+         *
+         * @param iReceived getClockUs() when the device was received
+         *
+         * @return The number of matching rules
+         */
+        int matchUdevDevice(const QUdevBackendEvent &ev, qint64 iReceived);
+
+        /**
+         * Append the event (or an overflow marker if ev is 0) to the trace
+         */
+        void recordEvent(const QUdevBackendEvent *pEvent);
+
+        /**
+         * Seed the rule and hand it to the monitoring thread unless the same rule is already present
+         */
+        bool insertMonitorRule(QUdevInternalWatcherEntry &iwe);
+
+        /**
+         * Create the device handed to the consumers of a matching rule
+         *
+         * The attributes of remove events are read right away, all others on first access.
+         *
+         * @param pParentAttributes The attributes of the resolved parent, null for rules without parent constraint
+         * @param pOwnAttributes The attributes of the device itself, created on first use and shared by all rules
+         */
+        QUdevDevice createMatchedDevice(const QUdevBackendEvent &ev, QUdevEventAction ueAction, const QUdevInternalWatcherEntry &iwe, int iDevTypeAtom,
+                                        const QExplicitlySharedDataPointer<QUdevDeviceAttributes> &pParentAttributes,
+                                        QExplicitlySharedDataPointer<QUdevDeviceAttributes> &pOwnAttributes);
+
+        /**
+         * Remember the device of an event as present (or gone) for the resync of the rule
+         */
+        void trackKnownDevice(int iRuleId, const QUdevEvent &e);
+
+        /**
+         * Hand a matched event to the coalescing stage or directly to emitEvent()
+         *
+         * @param iRuleId The matched rule, -1 for a merged event of several rules
+         * @param pSubscription The subscription of the rule, 0 for the signals
+         */
+        void deliverEvent(const QUdevEvent &e, int iRuleId, QUdevSubscriptionData *pSubscription, qint64 iReceived);
+
+        /**
+         * Fold the event into the pending event of the same device and rule if possible
+         */
+        void coalesceEvent(const QUdevEvent &e, int iRuleId, QUdevSubscriptionData *pSubscription, qint64 iReceived);
+
+        /**
+         * Hand the coalesced events whose window is exhausted (or all of them) to emitEvent()
+         */
+        void releaseCoalescedEvents(bool bAll);
+
+        /**
+         * Hand an event to its subscription or to the QUdev signals, either directly or through the pending batch
+         *
+         * @param pSubscription The subscription of the matched rule, 0 for the signals
+         */
+        void emitEvent(const QUdevEvent &e, QUdevSubscriptionData *pSubscription, qint64 iReceived);
+
+        /**
+         * Emit all events of the pending batch
+         */
+        void flushPendingEvents();
+
+        /**
+         * Get the queue feeding the signals, switching over to the one of the adopted configuration (monitoring thread only)
+         */
+        QUdevEventQueue *getSignalQueue();
+
+        /**
+         * Push an event into the signal queue and wake up the thread of the QUdev object if needed (monitoring thread only)
+         */
+        void queueSignalEvent(QUdevEventQueue *pQueue, const QUdevEvent &e);
+
+        /**
+         * Emit the queued events, called in the thread of the QUdev object
+         */
+        void drainSignalQueue(QUdevEventQueue *pQueue);
+
+        /**
+         * Move held back events into their queues and report queue overflows (monitoring thread only)
+         */
+        void processEventQueues();
+
+        /**
+         * Get the poll() timeout until the held back events are retried or the queue overflows are reported (-1 if nothing is pending)
+         */
+        int getQueueTimeout();
+
+        /**
+         * Deliver all coalesced and batched events right away
+         */
+        void flushAllEvents();
+
+        /**
+         * Deliver the coalesced events, the batch and the statistics if they are due
+         */
+        void processDueEvents();
+
+        /**
+         * Get the poll() timeout until the pending batch is due (-1 if nothing is pending)
+         */
+        int getBatchTimeout();
+
+        /**
+         * Get the poll() timeout until the next coalesced event, the pending batch, the statistics or the event queues are due (-1 if nothing is pending)
+         */
+        int getNextTimeout();
+
+        /**
+         * Get the current time of m_tClock in microseconds
+         */
+        qint64 getClockUs() const;
+
+        /**
+         * Report a receive buffer overflow and resynchronize the monitored rules if requested
+         */
+        void handleOverflow();
+
+        /**
+         * Enumerate the devices of the rule again and report the difference to its known devices (monitoring thread only)
+         */
+        void resyncRule(const QUdevInternalWatcherEntry &rule);
+
+        /**
+         * Replay the held events of a released snapshot gate and open it (monitoring thread only)
+         */
+        void openSnapshotGate(const QUdevInternalWatcherEntry &iwe);
+
+        /**
+         * Translate the udev action strings to our internal enumeration members
+         */
+        QUdevEventAction getQUdevEventActionFromUdevAction(const char *pcUdevAction) const;
+
+        /**
+         * One resolved parent lookup for all devices sharing the same parent directory
+         */
+        struct QUdevParentCacheEntry
+        {
+            /**
+             * The sysfs directory containing the devices this entry was resolved for
+             */
+            QString m_strParentDir;
+            /**
+             * Detail attributes of the found parent, null if there is no parent with the requested subsystem/devtype
+             */
+            QExplicitlySharedDataPointer<QUdevDeviceAttributes> m_pAttributes;
+        };
+
+        /**
+         * Get the parent matching the parent constraint of the rule, either from the parent cache or from sysfs
+         *
+         * @return The detail attributes of the found parent or null if there is no matching parent (monitoring thread only)
+         */
+        QExplicitlySharedDataPointer<QUdevDeviceAttributes> resolveParent(const QUdevBackendEvent &ev, const QByteArray &baParentDir, const QUdevInternalWatcherEntry &iwe);
+
+        /**
+         * Remove all parent cache entries affected by the removal of the given device (monitoring thread only)
+         */
+        void invalidateParentCache(const QString &strSysfsPath);
+
+        /**
+         * Check if strPrefix is strPath itself or one of its parent directories
+         */
+        static bool isSysfsPathPrefix(const QString &strPrefix, const QString &strPath);
+
+        /**
+         * Check the tag and property constraints of the rule against the device
+         */
+        static bool matchesTagsAndProperties(const QUdevBackendEvent &ev, const QUdevInternalWatcherEntry &iwe);
+
+        /**
+         * Create an enumerator with all matches of the rule libudev can check during the scan
+         */
+        struct udev_enumerate *createEnumerate(struct udev *pUdev, const QUdevInternalWatcherEntry &iwe);
+
+        /**
+         * Check the sysfs attributes of a query on a device libudev did not check them for
+         */
+        static bool matchesSysAttrs(struct udev_device *dev, const QUdevPropertyMap &mSysAttrs);
+
+        /**
+         * Enumerate all devices currently matching the given rule
+         */
+        QUdevDeviceList enumerateDevices(const QUdevInternalWatcherEntry &iwe);
+
+        /**
+         * Hand all devices currently matching the given rule in chunks to the visitor
+         *
+         * Only the given udev context is used, so this can run on any thread.
+         *
+         * @return The number of devices handed to the visitor
+         */
+        int enumerateDevices(struct udev *pUdev, const QUdevInternalWatcherEntry &iwe, QUdevDeviceVisitor *pVisitor, int iChunkSize);
+
+        /**
+         * Check a single enumerated device and hand it to the chunker
+         *
+         * @param strDetailPath The sysfs path of the device providing the detail attributes
+         *
+         * @return False if the visitor asked to stop
+         */
+        bool visitEnumeratedDevice(struct udev *pUdev, const QString &strSysfsPath, const QString &strDetailPath, const QUdevInternalWatcherEntry &iwe,
+                                   QHash<QString, QExplicitlySharedDataPointer<QUdevDeviceAttributes> > &hAttributes, QUdevEnumerationChunker &chunker);
+
+        /**
+         * Body of an asynchronous enumeration (enumeration thread pool only)
+         *
+         * The scan uses its own udev context, the attributes of the result are then read in parallel.
+         */
+        void runEnumerationJob(const QUdevInternalWatcherEntry &iwe, QFutureInterface<QUdevDeviceList> &fi);
+
+        /**
+         * Get the deepest of the given parent paths containing the sysfs path (empty if none does)
+         */
+        static QString findNearestParent(const QString &strSysfsPath, const QSet<QString> &sParentPaths);
+
+        /**
+         * Enumerate all devices currently matching the given rule, indexed by their sysfs path
+         */
+        QHash<QString, QUdevDevice> enumerateKnownDevices(const QUdevInternalWatcherEntry &iwe);
+
+        /**
+         * Handle to the udev library
+         */
+        struct udev *m_pUdev;
+
+        /**
+         * The shared monitor socket and thread (reference held)
+         */
+        QUdevMonitorHub *m_pHub;
 
         /**
          * Map from udev action strings to the QUdevEventAction enumeration
@@ -192,14 +881,204 @@ class QUdevPrivate : public QThread
         Q_DECLARE_PUBLIC(QUdev);
 
         /**
-         * Thread safe monitor event list handling
+         * Serializes all changes of m_Config
+         *
+         * Never taken by the monitoring thread while dispatching events.
          */
         QMutex m_Mutex;
 
         /**
-         * Hold the status of the monitoring status
+         * The current configuration of the writer side
+         */
+        QUdevMonitorConfig m_Config;
+
+        /**
+         * Next id handed out to a new rule
+         */
+        int m_iNextRuleId;
+
+        /**
+         * The latest published configuration not yet taken over by the monitoring thread
+         */
+        QAtomicPointer<QUdevMonitorConfig> m_pPendingConfig;
+
+        /**
+         * The configuration used by the monitoring thread (only accessed by the monitoring thread)
+         */
+        QUdevMonitorConfig *m_pActiveConfig;
+
+        /**
+         * Rules generation the socket filter was built for (only accessed by the monitoring thread)
+         */
+        int m_iAppliedRulesGeneration;
+
+        /**
+         * Seed generation the known devices were taken from (only accessed by the monitoring thread)
+         */
+        int m_iAppliedSeedGeneration;
+
+        /**
+         * Events waiting for batch delivery (only accessed by the monitoring thread)
+         */
+        QVector<QUdevEvent> m_vPendingEvents;
+
+        /**
+         * Age of the pending batch (only accessed by the monitoring thread)
+         */
+        QElapsedTimer m_tBatchAge;
+
+        /**
+         * getClockUs() when the events of the pending batch were received (only accessed by the monitoring thread)
+         */
+        QVector<qint64> m_vPendingReceived;
+
+        /**
+         * One event waiting in the coalescing stage
+         */
+        struct QUdevCoalescedEvent
+        {
+            /**
+             * Rule id and sysfs path of the device
+             */
+            QPair<int, QString> m_Key;
+            /**
+             * The folded event, carrying the latest device data
+             */
+            QUdevEvent m_Event;
+            /**
+             * The subscription of the rule, null for the signals
+             */
+            QExplicitlySharedDataPointer<QUdevSubscriptionData> m_pSubscription;
+            /**
+             * Time of m_tClock the event is due
+             */
+            qint64 m_iDeadline;
+            /**
+             * getClockUs() when the first folded event was received
+             */
+            qint64 m_iReceived;
+        };
+
+        /**
+         * Coalesced events in arrival order, also the order of their deadlines (only accessed by the monitoring thread)
+         */
+        QMap<qint64, QUdevCoalescedEvent> m_mCoalescedEvents;
+
+        /**
+         * Arrival number of the coalesced event of each rule and device (only accessed by the monitoring thread)
+         */
+        QHash<QPair<int, QString>, qint64> m_hCoalescedIndex;
+
+        /**
+         * Next arrival number (only accessed by the monitoring thread)
+         */
+        qint64 m_iCoalesceSequence;
+
+        /**
+         * Time base of the coalescing deadlines, the statistics interval and the latency measurements
+         */
+        QElapsedTimer m_tClock;
+
+        /**
+         * Time of m_tClock the statistics are pushed next (only accessed by the monitoring thread)
+         */
+        qint64 m_iNextStatistics;
+
+        /**
+         * Runtime statistics
+         */
+        QUdevStatistics m_Statistics;
+
+        /**
+         * Child of the QUdev object, the wakeups of the signal queue are posted to it
+         */
+        QUdevQueueReceiver *m_pQueueReceiver;
+
+        /**
+         * The signal queue currently fed (only accessed by the monitoring thread)
+         */
+        QExplicitlySharedDataPointer<QUdevEventQueue> m_pSignalQueue;
+
+        /**
+         * All queues handed out so far, closed on destruction to release a blocked monitoring thread (protected by m_Mutex)
+         */
+        QList<QExplicitlySharedDataPointer<QUdevEventQueue> > m_lEventQueues;
+
+        /**
+         * Set while a queue holds back events (only accessed by the monitoring thread)
+         */
+        bool m_bEventsStaged;
+
+        /**
+         * Queue drops and coalesced events last reported with eventQueueOverflow() (only accessed by the monitoring thread)
+         */
+        int m_iReportedQueueDrops;
+        int m_iReportedQueueCoalesced;
+
+        /**
+         * Time of m_tClock the queue overflows may be reported next (only accessed by the monitoring thread)
+         */
+        qint64 m_iNextQueueReport;
+
+        /**
+         * Recycles the device data of the monitored events, closed (not deleted) on destruction
+         */
+        QUdevDeviceDataPool *m_pDataPool;
+
+        /**
+         * Held while the trace writer is used
+         */
+        QMutex m_TraceMutex;
+
+        /**
+         * Records the received events, 0 if not recording (protected by m_TraceMutex)
+         */
+        QUdevTraceWriter *m_pTraceWriter;
+
+        /**
+         * Non-zero while recording, checked by the monitoring thread without taking m_TraceMutex
+         */
+        QAtomicInt m_iRecording;
+
+        /**
+         * Devices currently present per rule id, used for the resync after an overflow (only accessed by the monitoring thread)
+         */
+        QHash<int, QHash<QString, QUdevDevice> > m_hKnownDevices;
+
+        /**
+         * Number of receive buffer overflows detected so far (protected by m_Mutex)
+         */
+        int m_iOverflowCount;
+
+        /**
+         * Number of released snapshot gates the monitoring thread has not opened yet
+         */
+        QAtomicInt m_iSnapshotsPending;
+
+        /**
+         * Resolved parent lookups keyed by parent directory and parent subsystem/devtype (only accessed by the monitoring thread)
+         */
+        QCache<QByteArray, QUdevParentCacheEntry> m_cParentCache;
+
+        /**
+         * The device registry, kept up to date by the monitoring thread
+         */
+        QUdevDeviceRegistry *m_pRegistry;
+
+        /**
+         * Rules generation the socket filter was last built for (protected by m_Mutex)
+         */
+        int m_iFilterGeneration;
+
+        /**
+         * Signalled whenever the socket filter was rebuilt (used with m_Mutex)
+         */
+        QWaitCondition m_FilterApplied;
+
+        /**
+         * Runs asynchronous enumerations and their attribute reads
          */
-        bool m_bMonitoringActive;
+        QThreadPool m_EnumerationPool;
 };
 
 #endif // QUDEVIMPL_H
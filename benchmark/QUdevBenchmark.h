@@ -0,0 +1,87 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QUDEVBENCHMARK_H
+#define QUDEVBENCHMARK_H
+
+#include <QObject>
+#include <QAtomicInt>
+
+#include "QUdev.h"
+
+/**
+ * Counts the emitted events, connected directly to the monitoring thread
+ */
+class QUdevBenchmarkReceiver : public QObject
+{
+    Q_OBJECT
+
+    public:
+
+        QUdevBenchmarkReceiver()
+          : m_iEvents(0)
+        {
+
+        }
+
+        int getEventCount() const
+        {
+            return m_iEvents.fetchAndAddAcquire(0);
+        }
+
+    public slots:
+
+        void onNewUDevEvent(QUdevEvent e)
+        {
+            Q_UNUSED(e);
+            m_iEvents.fetchAndAddRelaxed(1);
+        }
+
+        void onNewUDevEvents(QVector<QUdevEvent> vEvents)
+        {
+            m_iEvents.fetchAndAddRelaxed(vEvents.size());
+        }
+
+    private:
+
+        mutable QAtomicInt m_iEvents;
+};
+
+/**
+ * Counts the devices of a streaming enumeration
+ */
+class QUdevBenchmarkVisitor : public QUdevDeviceVisitor
+{
+    public:
+
+        QUdevBenchmarkVisitor()
+          : m_iDevices(0)
+        {
+
+        }
+
+        virtual bool visitDevices(const QUdevDeviceList &lDevices)
+        {
+            m_iDevices += lDevices.size();
+            return true;
+        }
+
+        int m_iDevices;
+};
+
+#endif // QUDEVBENCHMARK_H
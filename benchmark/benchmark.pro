@@ -0,0 +1,41 @@
+#-------------------------------------------------
+#
+# Throughput and latency benchmark of QUdev
+#
+# Uses the synthetic backend for the monitor path, so no
+# hot-pluggable hardware is needed. The enumeration path
+# is measured against the sysfs of the machine.
+#
+#-------------------------------------------------
+
+QT       -= gui
+
+TARGET = QUdevBenchmark
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+#the library is compiled in to reach the private backend classes
+DEFINES += QUDEV_LIBRARY
+INCLUDEPATH += ..
+
+SOURCES += main.cpp \
+    ../QUdev.cpp \
+    ../QUdev_private.cpp \
+    ../QUdevDevice.cpp \
+    ../QUdevDeviceRegistry.cpp \
+    ../QUdevMonitorHub.cpp \
+    ../QUdevStatistics.cpp \
+    ../QUdevLibudevBackend.cpp \
+    ../QUdevSyntheticBackend.cpp \
+    ../QUdevTrace.cpp \
+    ../QUdevReplayBackend.cpp \
+    ../QUdevNetlinkBackend.cpp \
+    ../QUdevSubscription.cpp \
+    ../QUdevEventQueue.cpp \
+    ../QUdevSnapshotGate.cpp
+
+HEADERS += QUdevBenchmark.h \
+    ../QUdev.h
+
+LIBS += -ludev
@@ -0,0 +1,281 @@
+/*
+ * This file is part of QUdev.
+ * Copyright 2011 Johannes Pfeiffer (johannes.obticeo.de)
+ *
+ * QUdev is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * QUdev is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with QUdev. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QVector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "QUdevBenchmark.h"
+#include "QUdevMonitorHub_private.h"
+#include "QUdevSyntheticBackend_private.h"
+#include "QUdevReplayBackend_private.h"
+
+/*
+ * Every allocation of the process is counted by replacing the allocator entry points of glibc,
+ * operator new ends up in malloc() as well. A plain counter is used as malloc() runs before any
+ * static initialization.
+ */
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t nmemb, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+static int s_iAllocations = 0;
+
+extern "C" void *malloc(size_t size)
+{
+    __sync_fetch_and_add(&s_iAllocations, 1);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t nmemb, size_t size)
+{
+    __sync_fetch_and_add(&s_iAllocations, 1);
+    return __libc_calloc(nmemb, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    __sync_fetch_and_add(&s_iAllocations, 1);
+    return __libc_realloc(ptr, size);
+}
+
+static int getAllocationCount()
+{
+    return __sync_fetch_and_add(&s_iAllocations, 0);
+}
+
+/**
+ * Get the value of the command line option --strName=value
+ */
+static QString getOption(const QStringList &lArgs, const QString &strName, const QString &strDefault)
+{
+    QString strPrefix = QString("--%1=").arg(strName);
+    foreach(const QString &strArg, lArgs)
+    {
+        if(strArg.startsWith(strPrefix)) return strArg.mid(strPrefix.size());
+    }
+    return strDefault;
+}
+
+/**
+ * Parse a device mix like "block:disk:4,net::1" (subsystem:devicetype:weight)
+ */
+static QList<QUdevSyntheticBackend::QUdevSyntheticDeviceType> parseDeviceMix(const QString &strMix)
+{
+    QList<QUdevSyntheticBackend::QUdevSyntheticDeviceType> lTypes;
+    foreach(const QString &strType, strMix.split(',', QString::SkipEmptyParts))
+    {
+        QStringList lParts = strType.split(':');
+        lTypes.append(QUdevSyntheticBackend::QUdevSyntheticDeviceType(lParts.value(0).toLatin1(), lParts.value(1).toLatin1(), qMax(1, lParts.value(2, "1").toInt())));
+    }
+    return lTypes;
+}
+
+/**
+ * Get the upper bound of the bucket of a QUdev::getStatistics() histogram holding the given percentile
+ */
+static QString getHistogramPercentile(const QVariantMap &mHistogram, double dPercentile)
+{
+    QVariantList lBounds = mHistogram.value("boundsUs").toList();
+    QVariantList lCounts = mHistogram.value("counts").toList();
+
+    qint64 iTotal = 0;
+    foreach(const QVariant &count, lCounts) iTotal += count.toLongLong();
+    if(0 == iTotal) return QString("-");
+
+    qint64 iSeen = 0;
+    for(int i = 0; i < lCounts.size(); ++i)
+    {
+        iSeen += lCounts.at(i).toLongLong();
+        if(iSeen >= dPercentile * iTotal)
+        {
+            qint64 iBound = lBounds.at(i).toLongLong();
+            return (iBound < 0) ? QString(">%1us").arg(lBounds.at(i - 1).toLongLong()) : QString("<%1us").arg(iBound);
+        }
+    }
+    return QString("-");
+}
+
+/**
+ * Get the given percentile of sorted values
+ */
+static qint64 getPercentile(const QVector<qint64> &vSorted, double dPercentile)
+{
+    if(vSorted.isEmpty()) return 0;
+    return vSorted.at(qMin(vSorted.size() - 1, static_cast<int>(dPercentile * vSorted.size())));
+}
+
+static void printHistogram(const char *pcName, const QVariantMap &mHistogram)
+{
+    printf("  %-22s p50 %s  p90 %s  p99 %s  p99.9 %s\n", pcName,
+           qPrintable(getHistogramPercentile(mHistogram, 0.5)), qPrintable(getHistogramPercentile(mHistogram, 0.9)),
+           qPrintable(getHistogramPercentile(mHistogram, 0.99)), qPrintable(getHistogramPercentile(mHistogram, 0.999)));
+}
+
+/**
+ * Feed the events of a synthetic or replay backend through the complete monitor path and report the throughput,
+ * allocations and latencies
+ *
+ * @param lRules One rule per kind, the first one additionally walks up to the root ancestor "synthetic"/"level0"
+ */
+template<class Backend> static void runMonitorBenchmark(const QString &strName, Backend *pBackend, const QList<QUdevSyntheticBackend::QUdevSyntheticDeviceType> &lRules,
+                                                        int iParentDepth, bool bBatch)
+{
+    static int s_iRun = 0;
+    QString strGroup = QString("QUdevBenchmark-%1").arg(++s_iRun);
+
+    //the hub of the group takes ownership of the backend
+    if(false == QUdevMonitorHub::installBackend(strGroup, pBackend))
+    {
+        delete pBackend;
+        return;
+    }
+
+    QUdev udev(strGroup);
+    QUdevBenchmarkReceiver receiver;
+    QObject::connect(&udev, SIGNAL(newUDevEvent(QUdevEvent)), &receiver, SLOT(onNewUDevEvent(QUdevEvent)), Qt::DirectConnection);
+    QObject::connect(&udev, SIGNAL(newUDevEvents(QVector<QUdevEvent>)), &receiver, SLOT(onNewUDevEvents(QVector<QUdevEvent>)), Qt::DirectConnection);
+    udev.setBatchDelivery(bBatch);
+
+    int iAllocations = getAllocationCount();
+    QElapsedTimer t;
+    t.start();
+
+    for(int i = 0; i < lRules.size(); ++i)
+    {
+        const QUdevSyntheticBackend::QUdevSyntheticDeviceType &type = lRules.at(i);
+        udev.addNewMonitorRule(QString::fromLatin1(type.m_baSubsystem), QString::fromLatin1(type.m_baDevType), QString(), QString());
+        if((0 == i) && (iParentDepth > 0)) udev.addNewMonitorRule(QString::fromLatin1(type.m_baSubsystem), QString::fromLatin1(type.m_baDevType), "synthetic", "level0");
+    }
+
+    while(false == pBackend->isFinished()) usleep(1000);
+    qint64 iElapsedNs = t.nsecsElapsed();
+
+    //wait for the events still held for batching
+    QVariantMap mStatistics = udev.getStatistics();
+    forever
+    {
+        usleep(5000);
+        QVariantMap mLatest = udev.getStatistics();
+        bool bSettled = (0 == mLatest.value("queueDepth").toInt()) && (mLatest.value("emitted") == mStatistics.value("emitted"));
+        mStatistics = mLatest;
+        if(bSettled) break;
+    }
+
+    int iGenerated = pBackend->getGeneratedCount();
+    double dSeconds = iElapsedNs / 1e9;
+
+    printf("monitor (%s, %s delivery)\n", qPrintable(strName), bBatch ? "batched" : "single");
+    printf("  generated %d, received %d, emitted %d (receiver %d) in %.3fs\n", iGenerated, mStatistics.value("received").toInt(),
+           mStatistics.value("emitted").toInt(), receiver.getEventCount(), dSeconds);
+    printf("  %.0f events/s received, %.0f events/s emitted\n", mStatistics.value("received").toInt() / dSeconds, mStatistics.value("emitted").toInt() / dSeconds);
+    printf("  %.2f allocations per generated event\n", static_cast<double>(getAllocationCount() - iAllocations) / qMax(1, iGenerated));
+    printHistogram("dispatch latency", mStatistics.value("latencyUs").toMap());
+    printHistogram("matching time", mStatistics.value("processingUs").toMap());
+}
+
+/**
+ * Enumerate a subsystem of this machine repeatedly and report the throughput, allocations and call latencies
+ */
+static void runEnumerationBenchmark(const QString &strSubsystem, int iIterations)
+{
+    QUdev udev;
+
+    for(int iVariant = 0; iVariant < 2; ++iVariant)
+    {
+        QVector<qint64> vDurations;
+        int iDevices = 0;
+        int iAllocations = getAllocationCount();
+        QElapsedTimer tTotal;
+        tTotal.start();
+
+        for(int i = 0; i < iIterations; ++i)
+        {
+            QElapsedTimer t;
+            t.start();
+
+            if(0 == iVariant)
+            {
+                iDevices += udev.getUDevDevicesForSubsystem(strSubsystem, QString(), QString(), QString()).size();
+            }
+            else
+            {
+                QUdevBenchmarkVisitor visitor;
+                iDevices += udev.visitUDevDevicesForSubsystem(strSubsystem, QString(), QString(), QString(), &visitor, 16);
+            }
+
+            vDurations.append(t.nsecsElapsed() / 1000);
+        }
+
+        double dSeconds = tTotal.nsecsElapsed() / 1e9;
+        std::sort(vDurations.begin(), vDurations.end());
+
+        printf("enumeration (%s, subsystem '%s', %d calls)\n", (0 == iVariant) ? "list" : "visitor", qPrintable(strSubsystem), iIterations);
+        printf("  %d devices in %.3fs, %.0f devices/s\n", iDevices, dSeconds, iDevices / dSeconds);
+        printf("  %.2f allocations per device\n", static_cast<double>(getAllocationCount() - iAllocations) / qMax(1, iDevices));
+        printf("  %-22s p50 %lldus  p90 %lldus  p99 %lldus\n", "call latency", getPercentile(vDurations, 0.5), getPercentile(vDurations, 0.9), getPercentile(vDurations, 0.99));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList lArgs = app.arguments();
+
+    if(lArgs.contains("--help"))
+    {
+        printf("usage: QUdevBenchmark [--events=N] [--rate=N] [--devices=N] [--depth=N] [--mix=subsystem:devtype:weight,...]\n"
+               "                      [--trace=FILE [--original-timing]] [--subsystem=NAME] [--iterations=N]\n"
+               "\n"
+               "With --trace the monitor path replays a trace recorded with QUdev::startRecording() instead of generating\n"
+               "events, --mix then selects the monitor rules.\n");
+        return 0;
+    }
+
+    QUdevSyntheticBackend::QUdevSyntheticConfig config;
+    config.m_iMaxEvents = qMax(1, getOption(lArgs, "events", "200000").toInt());
+    config.m_iRate = getOption(lArgs, "rate", "0").toInt();
+    config.m_iDeviceCount = getOption(lArgs, "devices", "256").toInt();
+    config.m_iParentDepth = getOption(lArgs, "depth", "3").toInt();
+    config.m_lDeviceTypes = parseDeviceMix(getOption(lArgs, "mix", "block:disk:4,block:partition:4,net::1,usb:usb_device:1"));
+
+    QString strTrace = getOption(lArgs, "trace", QString());
+    for(int iBatch = 0; iBatch < 2; ++iBatch)
+    {
+        if(strTrace.isEmpty())
+        {
+            QString strName = QString("synthetic, %1 devices, parent depth %2").arg(config.m_iDeviceCount).arg(config.m_iParentDepth);
+            runMonitorBenchmark(strName, new QUdevSyntheticBackend(config), config.m_lDeviceTypes, config.m_iParentDepth, (iBatch > 0));
+        }
+        else
+        {
+            bool bOriginalTiming = lArgs.contains("--original-timing");
+            QString strName = QString("replay of %1%2").arg(strTrace).arg(bOriginalTiming ? ", original timing" : "");
+            runMonitorBenchmark(strName, new QUdevReplayBackend(strTrace, bOriginalTiming), config.m_lDeviceTypes, 0, (iBatch > 0));
+        }
+    }
+    runEnumerationBenchmark(getOption(lArgs, "subsystem", "block"), getOption(lArgs, "iterations", "50").toInt());
+
+    return 0;
+}